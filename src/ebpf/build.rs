@@ -37,6 +37,12 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
     // Copy libbpf.a
     std::fs::copy("c/.output/libbpf.a", Path::new(&out_dir).join("libbpf.a"))?;
 
+    // Event constants and layouts generated from c/event_schema.h (rs/types.rs)
+    std::fs::copy(
+        "c/.output/event_schema.rs",
+        Path::new(&out_dir).join("event_schema.rs"),
+    )?;
+
     // Tell cargo where to find the libraries
     println!("cargo:rustc-link-search=native={}", out_dir);
 
@@ -0,0 +1,243 @@
+// Load generator for benchmarking the eBPF pipeline.
+//
+// Starts one worker process per CPU (or -w N), each pinned to its CPU and
+// issuing fork/exec and/or openat calls at a fixed rate, so the consumer
+// (bench_consumer) sees a known, reproducible event load. Processes, not
+// threads: the handlers only trace a process's main thread.
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// ----------------------------------------------
+// Options
+// ----------------------------------------------
+enum class mode
+{
+  exec,
+  openat,
+  mix
+};
+
+struct options
+{
+  unsigned workers = 0;  // 0 = one per online CPU
+  uint64_t rate = 1000;  // operations per second per worker, 0 = unthrottled
+  unsigned seconds = 10; // how long to run
+  mode kind = mode::mix;
+};
+
+static void usage(const char *prog)
+{
+  std::fprintf(stderr,
+               "usage: %s [-w workers] [-r ops/s per worker, 0 = max] [-d seconds] [-m exec|openat|mix]\n",
+               prog);
+}
+
+static bool parse_args(int argc, char **argv, options &o)
+{
+  int c;
+  while ((c = getopt(argc, argv, "w:r:d:m:h")) != -1)
+  {
+    switch (c)
+    {
+    case 'w':
+      o.workers = std::strtoul(optarg, nullptr, 10);
+      break;
+    case 'r':
+      o.rate = std::strtoull(optarg, nullptr, 10);
+      break;
+    case 'd':
+      o.seconds = std::strtoul(optarg, nullptr, 10);
+      break;
+    case 'm':
+      if (!std::strcmp(optarg, "exec"))
+        o.kind = mode::exec;
+      else if (!std::strcmp(optarg, "openat"))
+        o.kind = mode::openat;
+      else if (!std::strcmp(optarg, "mix"))
+        o.kind = mode::mix;
+      else
+        return false;
+      break;
+    default:
+      return false;
+    }
+  }
+  return true;
+}
+
+// ----------------------------------------------
+// Workers
+// ----------------------------------------------
+static uint64_t monotonic_ns()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+struct worker_result
+{
+  uint64_t execs = 0;
+  uint64_t opens = 0;
+  uint64_t errors = 0;
+};
+
+// One short-lived child: fork, exec /bin/true, reap
+static bool spawn_true()
+{
+  static char *const child_argv[] = {const_cast<char *>("true"), nullptr};
+  pid_t pid = fork();
+  if (pid < 0)
+    return false;
+  if (pid == 0)
+  {
+    execv("/bin/true", child_argv);
+    _exit(127);
+  }
+  int status;
+  return waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void run_worker(unsigned cpu, const options &o, const std::string &path,
+                       const std::atomic<bool> &stop, worker_result &r)
+{
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  sched_setaffinity(0, sizeof(set), &set);
+
+  const uint64_t interval_ns = o.rate ? 1000000000ULL / o.rate : 0;
+  uint64_t next = monotonic_ns();
+  for (uint64_t i = 0; !stop.load(std::memory_order_relaxed); ++i)
+  {
+    const bool do_exec = o.kind == mode::exec || (o.kind == mode::mix && i % 2 == 0);
+    if (do_exec)
+    {
+      if (spawn_true())
+        ++r.execs;
+      else
+        ++r.errors;
+    }
+    else
+    {
+      int fd = openat(AT_FDCWD, path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd >= 0)
+      {
+        close(fd);
+        ++r.opens;
+      }
+      else
+        ++r.errors;
+    }
+
+    // Absolute deadlines, so a slow call doesn't lower the average rate
+    if (interval_ns)
+    {
+      next += interval_ns;
+      timespec ts{time_t(next / 1000000000ULL), long(next % 1000000000ULL)};
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+        ;
+    }
+  }
+}
+
+// ----------------------------------------------
+// main()
+// ----------------------------------------------
+int main(int argc, char **argv)
+{
+  options o;
+  if (!parse_args(argc, argv, o))
+  {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  const unsigned ncpus = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+  if (!o.workers)
+    o.workers = ncpus;
+
+  // Target of the openat storm
+  char path[] = "/tmp/tracer-loadgen-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+  {
+    std::perror("mkstemp");
+    return EXIT_FAILURE;
+  }
+  close(fd);
+
+  // The stop flag, then the results, shared with the workers
+  struct alignas(worker_result) shared_flag
+  {
+    std::atomic<bool> stop{false};
+  };
+  static_assert(std::atomic<bool>::is_always_lock_free, "the stop flag is shared between processes");
+  const size_t shared_size = sizeof(shared_flag) + o.workers * sizeof(worker_result);
+  void *map = mmap(nullptr, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED)
+  {
+    std::perror("mmap");
+    unlink(path);
+    return EXIT_FAILURE;
+  }
+  auto *shared = new (map) shared_flag;
+  auto *results = reinterpret_cast<worker_result *>(shared + 1);
+  std::uninitialized_value_construct_n(results, o.workers);
+
+  std::vector<pid_t> workers;
+  const uint64_t start = monotonic_ns();
+  for (unsigned w = 0; w < o.workers; ++w)
+  {
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      run_worker(w % ncpus, o, path, shared->stop, results[w]);
+      _exit(0);
+    }
+    if (pid < 0)
+    {
+      std::perror("fork");
+      break;
+    }
+    workers.push_back(pid);
+  }
+
+  std::this_thread::sleep_for(std::chrono::seconds(o.seconds));
+  shared->stop = true;
+  for (pid_t pid : workers)
+    waitpid(pid, nullptr, 0);
+  const double elapsed = (monotonic_ns() - start) / 1e9;
+  unlink(path);
+
+  worker_result total;
+  for (unsigned w = 0; w < workers.size(); ++w)
+  {
+    const worker_result &r = results[w];
+    total.execs += r.execs;
+    total.opens += r.opens;
+    total.errors += r.errors;
+  }
+  std::printf("workers:   %zu\n", workers.size());
+  std::printf("elapsed:   %.2f s\n", elapsed);
+  std::printf("execs:     %llu (%.0f/s)\n", (unsigned long long)total.execs, total.execs / elapsed);
+  std::printf("opens:     %llu (%.0f/s)\n", (unsigned long long)total.opens, total.opens / elapsed);
+  std::printf("errors:    %llu\n", (unsigned long long)total.errors);
+  return EXIT_SUCCESS;
+}
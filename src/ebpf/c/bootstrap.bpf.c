@@ -10,7 +10,22 @@
 
 // .rodata: globals tunable from user space
 const volatile bool debug_enabled SEC(".rodata") = false;
-const volatile u64 system_boot_ns SEC(".rodata") = 0;
+const volatile bool boot_clock SEC(".rodata") = false; // stamp records with CLOCK_BOOTTIME
+const volatile bool filter_tracked SEC(".rodata") = false; // only emit events for tracked processes
+const volatile u32 nr_cpus SEC(".rodata") = 1;              // possible CPUs, for summing per-CPU maps
+const volatile u64 wakeup_watermark SEC(".rodata") = 0;     // 0 = wake the consumer for every record
+const volatile u32 max_args SEC(".rodata") = (u32)-1;      // argv entries reported per exec
+const volatile u32 max_str_len SEC(".rodata") = MAX_STR_LEN; // bytes per exec filename (summary mode)
+const volatile u32 argv_bytes SEC(".rodata") = MAX_ARGV_BYTES; // argument bytes copied per exec
+const volatile u32 max_path_len SEC(".rodata") = MAX_PATH_LEN; // bytes per openat filename
+const volatile u32 ring_layout SEC(".rodata") = RING_LAYOUT_SHARED;
+const volatile bool process_summary SEC(".rodata") = false; // pair exec/exit into one record
+const volatile u64 short_process_ns SEC(".rodata") = 0;     // ...and aggregate processes shorter than this
+const volatile u32 page_size SEC(".rodata") = 4096;
+const volatile bool dedup_filenames SEC(".rodata") = false; // send repeated filenames as a hash
+const volatile bool profile_handlers SEC(".rodata") = false; // time handlers into handler_latency
+const volatile bool block_rq_has_queue SEC(".rodata") = false; // block_rq_{insert,issue}(q, rq), before 5.11
+const volatile bool use_bpf_loop SEC(".rodata") = false; // run the argv and filename scans under bpf_loop() (5.17+)
 
 // Ring buffer interface to user‑space reader (bootstrap.c)
 struct
@@ -19,6 +34,207 @@ struct
   __uint(max_entries, 8 * 1024 * 1024);
 } rb SEC(".maps");
 
+// Per-CPU or per-NUMA-node rings, so producers on different CPUs don't
+// contend on one ring's lock. Sized and filled from user space (see
+// ring_set.c); unused with RING_LAYOUT_SHARED. The template's size is set
+// before load as well, to a page at least.
+struct ring_template
+{
+  __uint(type, BPF_MAP_TYPE_RINGBUF);
+  __uint(max_entries, 4096);
+};
+
+struct
+{
+  __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+  __uint(max_entries, 1);
+  __type(key, u32);
+  __array(values, struct ring_template);
+} rings SEC(".maps");
+
+// Last time a record was dropped from each ring (rb, or rings[i]), which
+// drives shedding (see should_shed()). Per ring, as small split rings
+// overflow on their own: one CPU's burst shouldn't shed syscalls on all.
+struct
+{
+  __uint(type, BPF_MAP_TYPE_ARRAY);
+  __uint(max_entries, 1);
+  __type(key, u32);
+  __type(value, u64);
+} ring_drops SEC(".maps");
+
+// Per-CPU staging area: records are assembled here, then copied into the
+// ring at their real length instead of the worst-case sizeof(struct event)
+struct
+{
+  __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+  __uint(max_entries, 1);
+  __type(key, u32);
+  __type(value, struct event);
+} scratch SEC(".maps");
+
+// Delivery counters, indexed by enum event_slot
+struct
+{
+  __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+  __uint(max_entries, EVENT_SLOT_COUNT);
+  __type(key, u32);
+  __type(value, struct event_stats);
+} stats SEC(".maps");
+
+// Handler run times, indexed by enum event_slot (profile_handlers only)
+struct
+{
+  __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+  __uint(max_entries, EVENT_SLOT_COUNT);
+  __type(key, u32);
+  __type(value, struct latency_hist);
+} handler_latency SEC(".maps");
+
+// Per-process I/O totals, keyed by upid. LRU so that processes whose exit
+// was never seen age out instead of filling the map.
+struct
+{
+  __uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
+  __uint(max_entries, 16384);
+  __type(key, u64);
+  __type(value, struct syscall__io_summary__payload);
+} io_counters SEC(".maps");
+
+// Per-process scheduling totals, keyed by upid. Shared by all CPUs (and
+// updated with atomic adds): a per-CPU copy of two histograms per process
+// would cost megabytes per CPU.
+struct
+{
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 16384);
+  __type(key, u64);
+  __type(value, struct sched__sched_stats__payload);
+} sched_stats SEC(".maps");
+
+// Per-process block I/O totals, keyed by upid. Shared, like sched_stats.
+struct
+{
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 16384);
+  __type(key, u64);
+  __type(value, struct block__block_io_stats__payload);
+} block_stats SEC(".maps");
+
+// Exec metadata of running processes, keyed by upid, until their exit turns
+// it into a summary record. LRU, as exits may be missed.
+struct exec_info
+{
+  u64 exec_ns;
+  char filename[MAX_STR_LEN];
+};
+
+struct
+{
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 16384);
+  __type(key, u64);
+  __type(value, struct exec_info);
+} exec_infos SEC(".maps");
+
+// Totals of processes shorter than short_process_ns, by comm
+struct
+{
+  __uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
+  __uint(max_entries, 4096);
+  __type(key, struct process_aggregate_key);
+  __type(value, struct process_aggregate);
+} process_aggregates SEC(".maps");
+
+// Filenames sent recently, by hash (dedup_filenames). An entry only stands
+// in for the filename once FILENAME_SETTLE_NS have passed since it was sent,
+// so the full record is always ahead of its repeats in the ring, or in the
+// timestamp merge of split rings. User space bumps filename_generation when
+// it forgets its side of the table, invalidating every entry at once.
+struct sent_filename
+{
+  u64 sent_ns;
+  u32 generation;
+};
+
+struct
+{
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 16384);
+  __type(key, u64);
+  __type(value, struct sent_filename);
+} sent_filenames SEC(".maps");
+
+u32 filename_generation = 0;
+
+#define FILENAME_SETTLE_NS 10000000ULL // 10 ms, well past RING_SET_SLACK_NS
+
+// Wall-clock time minus the record clock (see record_clock_ns()), refreshed
+// by user space as the wall clock is adjusted
+u64 clock_offset_ns = 0;
+
+#define SHED_WINDOW_NS 100000000ULL // shed for 100 ms after a drop
+#define SHED_FILL_SHIFT 2           // ...or while the ring is over 3/4 full
+
+// Processes of the traced pipeline, keyed by tgid. Roots are inserted from
+// user space; descendants inherit membership on fork (or exec, for children
+// forked before their parent was tracked). Value: tgid of the tracked root.
+struct
+{
+  __uint(type, BPF_MAP_TYPE_HASH);
+  __uint(max_entries, 65536);
+  __type(key, u32);
+  __type(value, u32);
+} tracked_pids SEC(".maps");
+
+// Cgroup v2 ids whose every process counts as tracked
+struct
+{
+  __uint(type, BPF_MAP_TYPE_HASH);
+  __uint(max_entries, 1024);
+  __type(key, u64);
+  __type(value, u8);
+} tracked_cgroups SEC(".maps");
+
+// Identity of each process that has sent an event, keyed by tgid, so the
+// handlers of a busy process get it from one lookup instead of re-reading
+// its parent and start times every event. An entry only stands while the
+// process's leader and parent are the tasks it was computed from, which
+// covers tgid reuse and reparenting; exec recomputes it (for the new comm),
+// and exit deletes it. LRU, as exits may be missed.
+struct proc_ident
+{
+  u64 leader; // task_struct of the thread-group leader
+  u64 parent; // task_struct of its parent
+  u32 ppid;
+  u32 reserved;
+  u64 upid;
+  u64 uppid;
+  char comm[TASK_COMM_LEN]; // whole, NUL-padded
+};
+
+struct
+{
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 16384);
+  __type(key, u32);
+  __type(value, struct proc_ident);
+} proc_idents SEC(".maps");
+
+// The clock of record timestamps, before clock_offset_ns: CLOCK_MONOTONIC,
+// or CLOCK_BOOTTIME, which also counts time suspended
+static __always_inline u64 record_clock_ns(void)
+{
+  return boot_clock ? bpf_ktime_get_boot_ns() : bpf_ktime_get_ns();
+}
+
+// When `task` was forked, on the clock of record timestamps
+static __always_inline u64 task_start_ns(struct task_struct *task)
+{
+  return (boot_clock ? BPF_CORE_READ(task, start_boottime) : BPF_CORE_READ(task, start_time)) +
+         clock_offset_ns;
+}
+
 // Print in debug mode
 static __always_inline void debug_printk(const char *fmt)
 {
@@ -35,6 +251,159 @@ static __always_inline u64 make_upid(u32 pid, u64 start_ns)
   return ((u64)(pid & PID_MASK) << 40) | (start_ns & TIME_MASK);
 }
 
+enum ident_mode
+{
+  IDENT_CACHED,   // use the cached entry while it stands
+  IDENT_REFRESH,  // recompute it: the process exec'd
+  IDENT_NO_STORE, // use it, but don't cache a new one: the process is exiting
+};
+
+// Identity of the process whose leader is `leader`, from proc_idents, or
+// computed (and cached) if missing or stale. Costs one pointer read plus the
+// lookup when cached.
+static __always_inline void process_ident(struct task_struct *leader, u32 tgid,
+                                          enum ident_mode mode, struct proc_ident *out)
+{
+  struct task_struct *parent = BPF_CORE_READ(leader, parent);
+  struct proc_ident *cached = bpf_map_lookup_elem(&proc_idents, &tgid);
+
+  if (cached && mode != IDENT_REFRESH && cached->leader == (u64)leader &&
+      cached->parent == (u64)parent)
+  {
+    *out = *cached;
+    return;
+  }
+  out->leader = (u64)leader;
+  out->parent = (u64)parent;
+  out->ppid = BPF_CORE_READ(parent, tgid);
+  out->reserved = 0;
+  out->upid = make_upid(tgid, BPF_CORE_READ(leader, start_time));
+  out->uppid = make_upid(out->ppid, BPF_CORE_READ(parent, start_time));
+  BPF_CORE_READ_INTO(&out->comm, leader, comm);
+  if (mode != IDENT_NO_STORE)
+    bpf_map_update_elem(&proc_idents, &tgid, out, BPF_ANY);
+}
+
+// The whole comm of process `tgid`, from proc_idents if there
+static __always_inline void process_comm(struct task_struct *task, u32 tgid, char *comm)
+{
+  struct proc_ident *cached = bpf_map_lookup_elem(&proc_idents, &tgid);
+
+  if (cached)
+    __builtin_memcpy(comm, cached->comm, TASK_COMM_LEN);
+  else
+    BPF_CORE_READ_INTO((char(*)[TASK_COMM_LEN])comm, task, comm);
+}
+
+// Whether events of the current process should reach user space at all.
+// With filtering on, this runs before anything is reserved or read.
+static __always_inline bool is_tracked(u32 tgid, bool inherit)
+{
+  if (!filter_tracked)
+    return true;
+  if (bpf_map_lookup_elem(&tracked_pids, &tgid))
+    return true;
+
+  u64 cgid = bpf_get_current_cgroup_id();
+  if (bpf_map_lookup_elem(&tracked_cgroups, &cgid))
+    return true;
+  if (!inherit)
+    return false;
+
+  // Inherit from the parent, covering children forked before it was tracked
+  struct task_struct *task = (struct task_struct *)bpf_get_current_task();
+  u32 ptgid = BPF_CORE_READ(task, parent, tgid);
+  u32 *root = bpf_map_lookup_elem(&tracked_pids, &ptgid);
+  if (!root)
+    return false;
+  bpf_map_update_elem(&tracked_pids, &tgid, root, BPF_ANY);
+  return true;
+}
+
+// The ring records of the current CPU go to, and its index in ring_drops
+static __always_inline void *current_ring(u32 *idx)
+{
+  *idx = 0;
+  if (ring_layout == RING_LAYOUT_SHARED)
+    return &rb;
+
+  *idx = ring_layout == RING_LAYOUT_PER_NODE ? bpf_get_numa_node_id() : bpf_get_smp_processor_id();
+  return bpf_map_lookup_elem(&rings, idx);
+}
+
+// floor(log2(v)), clamped to the last histogram bucket
+static __always_inline u32 log2_bucket(u64 v)
+{
+  u32 r, shift;
+
+  r = (v > 0xFFFFFFFF) << 5;
+  v >>= r;
+  shift = (v > 0xFFFF) << 4;
+  v >>= shift;
+  r |= shift;
+  shift = (v > 0xFF) << 3;
+  v >>= shift;
+  r |= shift;
+  shift = (v > 0xF) << 2;
+  v >>= shift;
+  r |= shift;
+  shift = (v > 0x3) << 1;
+  v >>= shift;
+  r |= shift;
+  r |= (v >> 1);
+  return r < LATENCY_BUCKETS ? r : LATENCY_BUCKETS - 1;
+}
+
+static __always_inline void record_latency(u32 slot, u64 ns)
+{
+  struct latency_hist *h = bpf_map_lookup_elem(&handler_latency, &slot);
+
+  if (h)
+    h->buckets[log2_bucket(ns) & (LATENCY_BUCKETS - 1)]++;
+}
+
+// Evaluates a handler body, timing it into `slot` with profile_handlers.
+// Off, the .rodata check prunes the clock reads away.
+#define PROFILED(slot, body)                                    \
+  ({                                                            \
+    u64 __start = profile_handlers ? bpf_ktime_get_ns() : 0;    \
+    body;                                                       \
+    if (profile_handlers)                                       \
+      record_latency(slot, bpf_ktime_get_ns() - __start);       \
+    0;                                                          \
+  })
+
+// Syscall events are high-volume and the least valuable to lose. They are
+// skipped once the ring has overflowed recently or is close to it, keeping
+// room for exec/exit/OOM records.
+static __always_inline bool should_shed(void *ring, u32 idx, enum event_type type, u64 now)
+{
+  if (type < EVENT__SYSCALL__SYS_ENTER_OPENAT || type > EVENT__SYSCALL__OPENAT ||
+      type == EVENT__SYSCALL__IO_SUMMARY)
+    return false;
+  u64 *last_drop_ns = bpf_map_lookup_elem(&ring_drops, &idx);
+  if (last_drop_ns && now - *last_drop_ns < SHED_WINDOW_NS)
+    return true;
+
+  u64 size = bpf_ringbuf_query(ring, BPF_RB_RING_SIZE);
+  return bpf_ringbuf_query(ring, BPF_RB_AVAIL_DATA) > size - (size >> SHED_FILL_SHIFT);
+}
+
+// Each submit normally wakes the consumer. With a watermark set, records are
+// committed silently until enough data is waiting, leaving the consumer's
+// poll timeout as the latency bound. Exits and OOM kills always wake it.
+static __always_inline u64 submit_flags(void *ring, enum event_type type, u32 len)
+{
+  if (!wakeup_watermark)
+    return 0;
+  if (type == EVENT__SCHED__SCHED_PROCESS_EXIT || type == EVENT__SCHED__PROCESS_SUMMARY ||
+      type == EVENT__OOM__MARK_VICTIM)
+    return BPF_RB_FORCE_WAKEUP;
+  if (bpf_ringbuf_query(ring, BPF_RB_AVAIL_DATA) + len >= wakeup_watermark)
+    return BPF_RB_FORCE_WAKEUP;
+  return BPF_RB_NO_WAKEUP;
+}
+
 /* -------------------------------------------------------------------------- */
 /* 1.  Event registration table                       */
 /* -------------------------------------------------------------------------- */
@@ -44,169 +413,1469 @@ static __always_inline u64 make_upid(u32 pid, u64 start_ns)
     "tracepoint/sched/sched_process_exec", fill_sched_process_exec)                                            \
   X(SCHED__SCHED_PROCESS_EXIT, trace_event_raw_sched_process_template,                                         \
     "tracepoint/sched/sched_process_exit", fill_sched_process_exit)                                            \
-  X(VMSCAN__MM_VMSCAN_DIRECT_RECLAIM_BEGIN, trace_event_raw_vmscan_direct_reclaim_begin,                       \
-    "tracepoint/vmscan/mm_vmscan_direct_reclaim_begin", fill_vmscan_mm_vmscan_direct_reclaim_begin)            \
+  X(SCHED__PROCESS_SUMMARY, trace_event_raw_sched_process_template,                                            \
+    "tracepoint/sched/sched_process_exit", fill_process_summary)                                               \
   X(OOM__MARK_VICTIM, trace_event_raw_mark_victim,                                                             \
     "tracepoint/oom/mark_victim", fill_oom_mark_victim)                                                        \
   X(SYSCALL__SYS_ENTER_OPENAT, trace_event_raw_sys_enter,                                                      \
-    "tracepoint/syscalls/sys_enter_openat", fill_sys_enter_openat)
+    "tracepoint/syscalls/sys_enter_openat", fill_sys_enter_openat)                                             \
+  X(SYSCALL__OPENAT, do_sys_openat2_ctx,                                                                       \
+    "fexit/do_sys_openat2", fill_openat)                                                                       \
+  X(SYSCALL__IO_SUMMARY, trace_event_raw_sched_process_template,                                               \
+    "tracepoint/sched/sched_process_exit", fill_io_summary)                                                    \
+  X(SCHED__SCHED_STATS, trace_event_raw_sched_process_template,                                                \
+    "tracepoint/sched/sched_process_exit", fill_sched_stats)                                                   \
+  X(BLOCK__BLOCK_IO_STATS, trace_event_raw_sched_process_template,                                             \
+    "tracepoint/sched/sched_process_exit", fill_block_io_stats)
 
 /* -------------------------------------------------------------------------- */
 /* 2.  Variant‑specific payload helpers                    */
 /* -------------------------------------------------------------------------- */
 
-// Process launched successfully
-static __always_inline void
-fill_sched_process_exec(struct event *e,
-                        struct trace_event_raw_sched_process_exec *ctx)
+// Each helper fills its payload and returns the number of payload bytes used,
+// or NO_RECORD when there is nothing to send
+#define PAYLOAD_SIZE_UPTO(type, member, extra) (__builtin_offsetof(struct type, member) + (extra))
+#define NO_RECORD ((u32)-1)
+
+// Summary mode: keep what the exit's summary needs from the exec
+static __always_inline void remember_exec(struct event *e,
+                                          struct trace_event_raw_sched_process_exec *ctx)
+{
+  struct exec_info info = {.exec_ns = e->header.timestamp_ns};
+  u32 filename_off = ctx->__data_loc_filename & 0xFFFF;
+
+  bpf_probe_read_kernel_str(info.filename, max_str_len, (void *)ctx + filename_off);
+  bpf_map_update_elem(&exec_infos, &e->header.upid, &info, BPF_ANY);
+}
+
+struct argv_scan
+{
+  const char *buf;
+  u32 len;
+  u32 max;
+  u32 count;    // NULs so far
+  u32 end_word; // 1 + the last word with one, 0 = none yet
+  u32 k;        // the end is that word's k-th NUL
+};
+
+// One word of whole_args(). Returns 1 once past the end, as bpf_loop() callbacks do.
+static long scan_argv_word(u32 w, struct argv_scan *s)
+{
+  const u64 low7 = 0x7f7f7f7f7f7f7f7fULL;
+  u32 at = w * 8;
+
+  if (at >= s->len || at > MAX_ARGV_BYTES - 8)
+    return 1;
+
+  u64 v = *(const u64 *)&s->buf[at];
+  if (s->len - at < 8) // bytes past the end must not count
+  {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v |= ~0ULL << ((s->len - at) * 8);
+#else
+    v |= ~0ULL >> ((s->len - at) * 8);
+#endif
+  }
+  // Top bit of each byte set iff the byte is zero, then summed by multiply
+  u64 t = ~(((v & low7) + low7) | v | low7);
+  u32 n = ((t >> 7) * 0x0101010101010101ULL) >> 56;
+  if (!n)
+    return 0;
+
+  s->end_word = w + 1;
+  if (n >= s->max - s->count) // the end is this word's (max - count)-th NUL
+  {
+    s->k = s->max - s->count;
+    s->count = s->max;
+    return 1;
+  }
+  s->k = n; // its last NUL, unless a later word has one
+  s->count += n;
+  return 0;
+}
+
+// Where the command line in the first `len` bytes of `buf` ends on a whole
+// argument: past its `max`-th NUL or, if it has fewer, its last one (0 if
+// none). Sets `*argc` to the arguments that leaves. NULs are counted a word
+// at a time; only the word holding the end is searched byte by byte. Under
+// bpf_loop() the verifier checks the word once, not once per word of the
+// budget; without it (before 5.17) the loop is bounded by that budget.
+static __always_inline u32 whole_args(const char *buf, u32 len, u32 max, u32 *argc)
+{
+  struct argv_scan s = {.buf = buf, .len = len, .max = max};
+  u32 k;
+
+  if (use_bpf_loop)
+    bpf_loop((len + 7) / 8, scan_argv_word, &s, 0);
+  else
+  {
+    for (u32 w = 0; w < MAX_ARGV_BYTES / 8; w++)
+      if (scan_argv_word(w, &s))
+        break;
+  }
+  *argc = s.count;
+  if (!s.end_word)
+    return 0;
+
+  k = s.k;
+  u32 at = (s.end_word - 1) * 8;
+  if (at > MAX_ARGV_BYTES - 8)
+    return 0;
+  for (u32 b = 0; b < 8; b++)
+    if (at + b < len && !buf[at + b] && !--k)
+      return at + b + 1;
+  return 0;
+}
+
+// Fills the exec payload (comm, start time, command line) of `task`. The
+// command line is read from the current process's memory, or, with
+// `remote` (a constant, so the other branch is compiled out), from another
+// task's through the sleepable bpf_copy_from_user_task().
+static __always_inline u32 fill_exec_payload(struct event *e, struct task_struct *task, bool remote)
 {
-  struct task_struct *task = (struct task_struct *)bpf_get_current_task();
   struct mm_struct *mm;
-  unsigned long arg_start, arg_end, arg_ptr;
-  u32 i;
+  unsigned long arg_start, arg_end;
+  u32 i, len, off = 0;
 
   BPF_CORE_READ_STR_INTO(&e->sched__sched_process_exec__payload.comm, task, comm);
 
   e->sched__sched_process_exec__payload.argc = 0;
+  e->sched__sched_process_exec__payload.flags = 0;
+  e->sched__sched_process_exec__payload.start_ns = task_start_ns(task);
   mm = BPF_CORE_READ(task, mm);
   if (!mm)
-    return;
+    goto out;
 
   arg_start = BPF_CORE_READ(mm, arg_start);
   arg_end = BPF_CORE_READ(mm, arg_end);
-  arg_ptr = arg_start;
+  if (unlikely(arg_end <= arg_start))
+    goto out;
+  len = arg_end - arg_start > argv_bytes ? argv_bytes : arg_end - arg_start;
 
-  for (i = 0; i < MAX_ARR_LEN; i++)
+  // The kernel already laid the arguments out NUL-separated, so copy the
+  // area as is, one chunk at a time: the cost follows the real length
+  for (i = 0; i < MAX_ARGV_BYTES / ARGV_CHUNK; i++)
   {
-    if (unlikely(arg_ptr >= arg_end))
+    u32 at = i * ARGV_CHUNK;
+    if (at >= len)
       break;
-    long n = bpf_probe_read_user_str(&e->sched__sched_process_exec__payload.argv[i],
-                                     MAX_STR_LEN, (void *)arg_ptr);
-    if (n <= 0)
+    u32 n = len - at > ARGV_CHUNK ? ARGV_CHUNK : len - at;
+    long err = remote ? bpf_copy_from_user_task(&e->sched__sched_process_exec__payload.argv[at], n,
+                                                (void *)(arg_start + at), task, 0)
+                      : bpf_probe_read_user(&e->sched__sched_process_exec__payload.argv[at], n,
+                                            (void *)(arg_start + at));
+    if (err)
       break;
-    e->sched__sched_process_exec__payload.argc++;
-    arg_ptr += n; // jump over NUL byte
+    off = at + n;
+  }
+  if (!off)
+    goto out;
+
+  // Past max_args, or cut short by the budget (or a failed read), end on a
+  // whole argument, so that the bytes after it are not sent
+  u32 argc, end = whole_args(e->sched__sched_process_exec__payload.argv, off, max_args, &argc);
+  if (argc == max_args || off < arg_end - arg_start)
+  {
+    if (end < arg_end - arg_start)
+      e->sched__sched_process_exec__payload.flags |= EXEC_ARGV_TRUNCATED;
+    off = end;
   }
+  e->sched__sched_process_exec__payload.argc = argc;
+
+out:
+  e->sched__sched_process_exec__payload.argv_len = off;
+  return PAYLOAD_SIZE_UPTO(sched__sched_process_exec__payload, argv, off);
 }
 
-// Process exited
-static __always_inline void
-fill_sched_process_exit(struct event *e,
-                        struct trace_event_raw_sched_process_template *ctx)
+// Process launched successfully
+static __always_inline u32
+fill_sched_process_exec(struct event *e,
+                        struct trace_event_raw_sched_process_exec *ctx)
 {
-  struct task_struct *task = (struct task_struct *)bpf_get_current_task();
+  // Sent as part of the process summary at exit instead
+  if (process_summary)
+  {
+    remember_exec(e, ctx);
+    return NO_RECORD;
+  }
+  return fill_exec_payload(e, (struct task_struct *)bpf_get_current_task(), false);
+}
 
+static __always_inline int exit_status(struct task_struct *task)
+{
   // Read both exit_code and exit_signal
   int exit_code = BPF_CORE_READ(task, exit_code);
   int exit_signal = BPF_CORE_READ(task, exit_signal);
 
   // Combine them: typically exit_code contains the status
   // but exit_signal might have the signal if killed
-  e->sched__sched_process_exit__payload.status = exit_code ? exit_code : exit_signal;
+  return exit_code ? exit_code : exit_signal;
+}
+
+// Process exited
+static __always_inline u32
+fill_sched_process_exit(struct event *e,
+                        struct trace_event_raw_sched_process_template *ctx)
+{
+  struct task_struct *task = (struct task_struct *)bpf_get_current_task();
+
+  e->sched__sched_process_exit__payload.status = exit_status(task);
+  return sizeof(struct sched__sched_process_exit__payload);
 }
 
-// File open request started
 static __always_inline void
+aggregate_short_process(struct task_struct *task, const struct event *e, u64 runtime_ns)
+{
+  struct process_aggregate_key key;
+  struct process_aggregate *agg;
+
+  // The whole (NUL-padded) comm, so equal names make equal keys
+  process_comm(task, e->header.pid, key.comm);
+  agg = bpf_map_lookup_elem(&process_aggregates, &key);
+  if (!agg)
+  {
+    struct process_aggregate zero = {};
+    bpf_map_update_elem(&process_aggregates, &key, &zero, BPF_NOEXIST);
+    agg = bpf_map_lookup_elem(&process_aggregates, &key);
+    if (!agg)
+      return;
+  }
+  agg->count++;
+  if (e->sched__process_summary__payload.status)
+    agg->failures++;
+  agg->runtime_ns += runtime_ns;
+  agg->cpu_ns += e->sched__process_summary__payload.cpu_ns;
+  if (e->sched__process_summary__payload.max_rss_kb > agg->max_rss_kb)
+    agg->max_rss_kb = e->sched__process_summary__payload.max_rss_kb;
+}
+
+// Summary mode: the process's exec and exit in one record. The exit
+// tracepoint fires after the mm is released, so the peak RSS is the one
+// accounted to the signal struct (set when the last thread exits).
+static __always_inline u32
+fill_process_summary(struct event *e,
+                     struct trace_event_raw_sched_process_template *ctx)
+{
+  struct task_struct *task = (struct task_struct *)bpf_get_current_task();
+  struct signal_struct *sig = BPF_CORE_READ(task, signal);
+  struct exec_info *info = bpf_map_lookup_elem(&exec_infos, &e->header.upid);
+  long n = 0;
+
+  e->sched__process_summary__payload.status = exit_status(task);
+  e->sched__process_summary__payload.cpu_ns =
+      BPF_CORE_READ(sig, sum_sched_runtime) + BPF_CORE_READ(task, se.sum_exec_runtime);
+  e->sched__process_summary__payload.utime_ns = BPF_CORE_READ(sig, utime) + BPF_CORE_READ(task, utime);
+  e->sched__process_summary__payload.stime_ns = BPF_CORE_READ(sig, stime) + BPF_CORE_READ(task, stime);
+  e->sched__process_summary__payload.max_rss_kb = BPF_CORE_READ(sig, maxrss) * (page_size / 1024);
+  process_comm(task, e->header.pid, e->sched__process_summary__payload.comm);
+
+  if (info)
+  {
+    e->sched__process_summary__payload.start_ns = info->exec_ns;
+    e->sched__process_summary__payload.flags = PROCESS_SUMMARY_EXECED;
+    n = bpf_probe_read_kernel_str(e->sched__process_summary__payload.filename, max_str_len,
+                                  info->filename);
+    bpf_map_delete_elem(&exec_infos, &e->header.upid);
+  }
+  else
+  {
+    // Exec'd before the tracer started (or not at all)
+    e->sched__process_summary__payload.start_ns = task_start_ns(task);
+    e->sched__process_summary__payload.flags = 0;
+  }
+  if (n <= 0)
+  {
+    e->sched__process_summary__payload.filename[0] = '\0';
+    n = 1;
+  }
+
+  u64 runtime_ns = e->header.timestamp_ns - e->sched__process_summary__payload.start_ns;
+  if (runtime_ns < short_process_ns)
+  {
+    aggregate_short_process(task, e, runtime_ns);
+    return NO_RECORD;
+  }
+  return PAYLOAD_SIZE_UPTO(sched__process_summary__payload, filename, n);
+}
+
+struct filename_hash
+{
+  const char *name;
+  u32 len; // bytes hashed, the NUL excluded
+  u64 hash;
+};
+
+// One byte of dedup_filename()'s FNV-1a, as a bpf_loop() callback
+static long hash_filename_byte(u32 i, struct filename_hash *h)
+{
+  if (i >= h->len)
+    return 1;
+  h->hash ^= (u8)h->name[i & (MAX_PATH_LEN - 1)];
+  h->hash *= STRING_HASH_PRIME;
+  return 0;
+}
+
+// Hashes the `n`-byte (NUL included) filename of an openat record. If the
+// same one was sent recently, empties it and marks the record as a repeat;
+// otherwise records it as sent. Returns whether the filename was dropped.
+static __always_inline bool dedup_filename(struct event *e, long n)
+{
+  struct filename_hash h = {
+      .name = e->syscall__sys_enter_openat__payload.filename,
+      .len = n > MAX_PATH_LEN ? MAX_PATH_LEN - 1 : n > 1 ? n - 1 : 0,
+      .hash = STRING_HASH_OFFSET,
+  };
+
+  if (use_bpf_loop)
+    bpf_loop(h.len, hash_filename_byte, &h, 0);
+  else
+  {
+    for (u32 i = 0; i < MAX_PATH_LEN - 1; i++)
+      if (hash_filename_byte(i, &h))
+        break;
+  }
+  u64 hash = h.hash ? h.hash : 1;
+  e->syscall__sys_enter_openat__payload.filename_hash = hash;
+
+  u64 now = e->header.timestamp_ns;
+  struct sent_filename *sent = bpf_map_lookup_elem(&sent_filenames, &hash);
+  if (sent && sent->generation == filename_generation && now - sent->sent_ns > FILENAME_SETTLE_NS)
+  {
+    e->syscall__sys_enter_openat__payload.filename_flags |= OPENAT_FILENAME_REPEATED;
+    e->syscall__sys_enter_openat__payload.filename[0] = '\0';
+    return true;
+  }
+  if (!sent || sent->generation != filename_generation)
+  {
+    struct sent_filename v = {.sent_ns = now, .generation = filename_generation};
+    bpf_map_update_elem(&sent_filenames, &hash, &v, BPF_ANY);
+  }
+  return false;
+}
+
+// A first sighting that never reached the ring must be sent in full again
+static __always_inline void forget_filename(struct event *e)
+{
+  u64 hash = e->syscall__sys_enter_openat__payload.filename_hash;
+
+  if (dedup_filenames && !(e->syscall__sys_enter_openat__payload.filename_flags & OPENAT_FILENAME_REPEATED))
+    bpf_map_delete_elem(&sent_filenames, &hash);
+}
+
+// Path components walked per opened file, at most; deeper paths are sent
+// as the process passed them
+#define MAX_PATH_DEPTH 32
+
+// Names of the dentries between an opened file and the root, leaf first.
+// Per CPU: only the openat handler, which doesn't nest, uses it.
+struct path_walk
+{
+  const unsigned char *name[MAX_PATH_DEPTH];
+  u32 len[MAX_PATH_DEPTH];
+};
+
+struct
+{
+  __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+  __uint(max_entries, 1);
+  __type(key, u32);
+  __type(value, struct path_walk);
+} path_walks SEC(".maps");
+
+// The open file behind fd `fd` of the current process
+static __always_inline struct file *current_fd_file(int fd)
+{
+  struct task_struct *task = (struct task_struct *)bpf_get_current_task();
+  struct fdtable *fdt = BPF_CORE_READ(task, files, fdt);
+  struct file **fds = BPF_CORE_READ(fdt, fd);
+  struct file *file = NULL;
+
+  if (fd < 0 || (u32)fd >= BPF_CORE_READ(fdt, max_fds))
+    return NULL;
+  bpf_probe_read_kernel(&file, sizeof(file), &fds[fd]);
+  return file;
+}
+
+static __always_inline struct mount *real_mount(struct vfsmount *mnt)
+{
+  return (struct mount *)((void *)mnt - bpf_core_field_offset(struct mount, mnt));
+}
+
+// Writes the absolute path of `path`, as seen from the current process's
+// root, into `buf` the way d_path() would: up the dentries to each mount's
+// root, then across to the mount point. (bpf_d_path() itself is not allowed
+// in a do_sys_openat2 trampoline.) Returns the length with the NUL, or 0 if
+// the path was deeper than MAX_PATH_DEPTH or longer than max_path_len.
+static __always_inline long resolve_path(struct path *path, char *buf)
+{
+  struct task_struct *task = (struct task_struct *)bpf_get_current_task();
+  struct dentry *root_dentry = BPF_CORE_READ(task, fs, root.dentry);
+  struct vfsmount *root_mnt = BPF_CORE_READ(task, fs, root.mnt);
+  struct dentry *dentry = BPF_CORE_READ(path, dentry);
+  struct vfsmount *vfsmnt = BPF_CORE_READ(path, mnt);
+  struct mount *mnt = real_mount(vfsmnt);
+  u32 zero = 0, depth = 0, i;
+  bool done = false;
+
+  struct path_walk *w = bpf_map_lookup_elem(&path_walks, &zero);
+  if (!w)
+    return 0;
+  for (i = 0; i < 2 * MAX_PATH_DEPTH; i++)
+  {
+    if (dentry == root_dentry && vfsmnt == root_mnt)
+    {
+      done = true;
+      break;
+    }
+    if (dentry == BPF_CORE_READ(vfsmnt, mnt_root))
+    {
+      struct mount *parent = BPF_CORE_READ(mnt, mnt_parent);
+      if (parent == mnt) // root of the mount namespace
+      {
+        done = true;
+        break;
+      }
+      dentry = BPF_CORE_READ(mnt, mnt_mountpoint);
+      mnt = parent;
+      vfsmnt = &parent->mnt;
+      continue;
+    }
+    struct dentry *parent = BPF_CORE_READ(dentry, d_parent);
+    if (parent == dentry || depth >= MAX_PATH_DEPTH)
+      break; // not below a mount root (pseudo file systems), or too deep
+    w->name[depth] = BPF_CORE_READ(dentry, d_name.name);
+    w->len[depth] = BPF_CORE_READ(dentry, d_name.len);
+    depth++;
+    dentry = parent;
+  }
+  if (!done)
+    return 0;
+
+  u32 off = 0;
+  for (i = 0; i < MAX_PATH_DEPTH; i++)
+  {
+    if (i >= depth)
+      break;
+    u32 part = (depth - 1 - i) & (MAX_PATH_DEPTH - 1);
+    u32 len = w->len[part];
+    if (off + 1 + len >= max_path_len)
+      return 0;
+    buf[off & (MAX_PATH_LEN - 1)] = '/';
+    off++;
+    bpf_probe_read_kernel(&buf[off & (MAX_PATH_LEN - 1)], len & (MAX_PATH_LEN - 1), w->name[part]);
+    off += len;
+  }
+  if (!off)
+    buf[off++] = '/';
+  buf[off & (MAX_PATH_LEN - 1)] = '\0';
+  return off + 1;
+}
+
+// Describes the opened file from its struct file. Returns the length of the
+// resolved path written to `filename` with its NUL, or 0 if there is none.
+static __always_inline long fill_open_file(struct event *e, struct file *file)
+{
+  struct inode *inode = BPF_CORE_READ(file, f_inode);
+
+  if (!inode)
+    return 0;
+  e->syscall__sys_enter_openat__payload.dev = BPF_CORE_READ(inode, i_sb, s_dev);
+  e->syscall__sys_enter_openat__payload.ino = BPF_CORE_READ(inode, i_ino);
+  e->syscall__sys_enter_openat__payload.size = BPF_CORE_READ(inode, i_size);
+  e->syscall__sys_enter_openat__payload.filename_flags = OPENAT_FILE_INFO;
+
+  long n = resolve_path(&file->f_path, e->syscall__sys_enter_openat__payload.filename);
+  if (n > 0)
+    e->syscall__sys_enter_openat__payload.filename_flags |= OPENAT_FILENAME_RESOLVED;
+  return n;
+}
+
+// Fills the openat payload. With the opened `file` (NULL before or without
+// a result), the file is described and its path resolved in the kernel;
+// otherwise the filename is read from user memory.
+static __always_inline u32 fill_openat_payload(struct event *e, int dfd, int flags, int mode,
+                                               const char *filename, int ret, struct file *file)
+{
+  e->syscall__sys_enter_openat__payload.dfd = dfd;
+  e->syscall__sys_enter_openat__payload.flags = flags;
+  e->syscall__sys_enter_openat__payload.mode = mode;
+  e->syscall__sys_enter_openat__payload.ret = ret;
+
+  e->syscall__sys_enter_openat__payload.filename_flags = 0;
+  e->syscall__sys_enter_openat__payload.filename_hash = 0;
+  e->syscall__sys_enter_openat__payload.dev = 0;
+  e->syscall__sys_enter_openat__payload.ino = 0;
+  e->syscall__sys_enter_openat__payload.size = 0;
+
+  long n = file ? fill_open_file(e, file) : 0;
+  if (n <= 0)
+    n = bpf_probe_read_user_str(e->syscall__sys_enter_openat__payload.filename,
+                                max_path_len, filename);
+  if (n <= 0)
+  {
+    e->syscall__sys_enter_openat__payload.filename[0] = '\0';
+    n = 1;
+  }
+  if (dedup_filenames && dedup_filename(e, n))
+    n = 1;
+  return PAYLOAD_SIZE_UPTO(syscall__sys_enter_openat__payload, filename, n);
+}
+
+// File open request started (fallback where fexit is unavailable)
+static __always_inline u32
 fill_sys_enter_openat(struct event *e,
                       struct trace_event_raw_sys_enter *ctx)
 {
-  e->syscall__sys_enter_openat__payload.dfd = BPF_CORE_READ(ctx, args[0]);
-  bpf_probe_read_user_str(e->syscall__sys_enter_openat__payload.filename,
-                          MAX_STR_LEN, (void *)BPF_CORE_READ(ctx, args[1]));
-  e->syscall__sys_enter_openat__payload.flags = BPF_CORE_READ(ctx, args[2]);
-  e->syscall__sys_enter_openat__payload.mode = BPF_CORE_READ(ctx, args[3]);
+  return fill_openat_payload(e, BPF_CORE_READ(ctx, args[0]), BPF_CORE_READ(ctx, args[2]),
+                             BPF_CORE_READ(ctx, args[3]), (const char *)BPF_CORE_READ(ctx, args[1]), 0,
+                             NULL);
 }
 
-// File open request successful
-static __always_inline void
-fill_sys_exit_openat(struct event *e,
-                     struct trace_event_raw_sys_exit *ctx)
+// What an fexit program on do_sys_openat2(dfd, filename, how) sees: each
+// argument, then the return value, as a u64
+struct do_sys_openat2_ctx
+{
+  u64 dfd;
+  u64 filename;
+  u64 how;
+  u64 ret;
+};
+
+// File open finished. Every open(2) flavour goes through do_sys_openat2, so
+// one trampoline gets the filename and the resulting fd together, without
+// the cost of the syscall tracepoints. The fd is installed by now, so a
+// successful open also reports what it opened.
+static __always_inline u32 fill_openat(struct event *e, struct do_sys_openat2_ctx *ctx)
 {
-  e->syscall__sys_exit_openat__payload.fd = ctx->ret;
+  struct open_how *how = (struct open_how *)ctx->how;
+  int ret = (int)ctx->ret;
+
+  return fill_openat_payload(e, (int)ctx->dfd, (int)BPF_CORE_READ(how, flags), (int)BPF_CORE_READ(how, mode),
+                             (const char *)ctx->filename, ret, ret >= 0 ? current_fd_file(ret) : NULL);
 }
 
-// File read
-static __always_inline void
-fill_sys_enter_read(struct event *e,
-                    struct trace_event_raw_sys_enter *ctx)
+struct io_sum_ctx
+{
+  u64 upid;
+  struct syscall__io_summary__payload sum;
+};
+
+static long sum_io_counters(u32 cpu, struct io_sum_ctx *c)
 {
-  e->syscall__sys_enter_read__payload.fd = BPF_CORE_READ(ctx, args[0]);
-  e->syscall__sys_enter_read__payload.count = BPF_CORE_READ(ctx, args[1]);
+  struct syscall__io_summary__payload *v = bpf_map_lookup_percpu_elem(&io_counters, &c->upid, cpu);
+  if (!v)
+    return 0;
+  c->sum.read_calls += v->read_calls;
+  c->sum.read_bytes += v->read_bytes;
+  c->sum.write_calls += v->write_calls;
+  c->sum.write_bytes += v->write_bytes;
+  c->sum.openat_calls += v->openat_calls;
+  c->sum.openat_failures += v->openat_failures;
+  return 0;
 }
 
-// File write
-static __always_inline void
-fill_sys_enter_write(struct event *e,
-                     struct trace_event_raw_sys_enter *ctx)
+// I/O totals of an exiting process, summed over CPUs (needs 5.19+ for
+// bpf_map_lookup_percpu_elem; not loaded otherwise)
+static __always_inline u32
+fill_io_summary(struct event *e,
+                struct trace_event_raw_sched_process_template *ctx)
 {
-  e->syscall__sys_enter_write__payload.fd = BPF_CORE_READ(ctx, args[0]);
-  e->syscall__sys_enter_write__payload.count = BPF_CORE_READ(ctx, args[1]);
+  struct io_sum_ctx c = {.upid = e->header.upid};
+
+  if (!bpf_map_lookup_elem(&io_counters, &c.upid))
+    return NO_RECORD; // no I/O at all
+  bpf_loop(nr_cpus, sum_io_counters, &c, 0);
+  bpf_map_delete_elem(&io_counters, &c.upid);
+
+  e->syscall__io_summary__payload = c.sum;
+  return sizeof(struct syscall__io_summary__payload);
 }
 
-// Memory reclaim event
-static __always_inline void
-fill_vmscan_mm_vmscan_direct_reclaim_begin(struct event *e,
-                                           struct trace_event_raw_vmscan_direct_reclaim_begin *ctx)
+static __always_inline void count_last_stretch(u64 upid);
+
+// Run-queue and on-CPU totals of an exiting process
+static __always_inline u32
+fill_sched_stats(struct event *e,
+                 struct trace_event_raw_sched_process_template *ctx)
 {
-  (void)e;
+  count_last_stretch(e->header.upid);
+  struct sched__sched_stats__payload *s = bpf_map_lookup_elem(&sched_stats, &e->header.upid);
+
+  if (!s)
+    return NO_RECORD; // never scheduled while tracked
+  bpf_probe_read_kernel(&e->sched__sched_stats__payload, sizeof(*s), s);
+  bpf_map_delete_elem(&sched_stats, &e->header.upid);
+  return sizeof(struct sched__sched_stats__payload);
+}
+
+// Block device totals of an exiting process
+static __always_inline u32
+fill_block_io_stats(struct event *e,
+                    struct trace_event_raw_sched_process_template *ctx)
+{
+  struct block__block_io_stats__payload *s = bpf_map_lookup_elem(&block_stats, &e->header.upid);
+
+  if (!s)
+    return NO_RECORD; // no request while tracked
+  // Made when a request was queued, which may not have completed yet
+  bool completed = s->read_bytes || s->write_bytes || s->reads || s->writes;
+  bpf_probe_read_kernel(&e->block__block_io_stats__payload, sizeof(*s), s);
+  bpf_map_delete_elem(&block_stats, &e->header.upid);
+  return completed ? sizeof(struct block__block_io_stats__payload) : NO_RECORD;
 }
 
 // OOM mark victim event
-static __always_inline void
+static __always_inline u32
 fill_oom_mark_victim(struct event *e,
                      struct trace_event_raw_mark_victim *ctx __attribute__((unused)))
 {
   (void)e;
+  return 0;
 }
 
 /* -------------------------------------------------------------------------- */
 /* 3.  Generic handler generator                       */
 /* -------------------------------------------------------------------------- */
 
+// Events sent from the process's exit, after which its identity is dropped
+#define AT_EXIT(type)                                                             \
+  ((type) == EVENT__SCHED__SCHED_PROCESS_EXIT || (type) == EVENT__SCHED__PROCESS_SUMMARY || \
+   (type) == EVENT__SYSCALL__IO_SUMMARY || (type) == EVENT__SCHED__SCHED_STATS || \
+   (type) == EVENT__BLOCK__BLOCK_IO_STATS)
+
+#define IDENT_MODE(type)                                                          \
+  ((type) == EVENT__SCHED__SCHED_PROCESS_EXEC ? IDENT_REFRESH                     \
+   : AT_EXIT(type)                            ? IDENT_NO_STORE                    \
+                                              : IDENT_CACHED)
+
 #define HANDLER_DECL(name, ctx_t, sec, fill_fn)                                   \
+  static __always_inline void emit__##name(struct ctx_t *ctx);                    \
+                                                                                  \
   SEC(sec)                                                                        \
   int handle__##name(struct ctx_t *ctx)                                           \
   {                                                                               \
-    u64 id = bpf_get_current_pid_tgid();                                          \
+    return PROFILED(SLOT__##name, emit__##name(ctx));                             \
+  }                                                                               \
+                                                                                  \
+  static __always_inline void emit__##name(struct ctx_t *ctx)                     \
+  {                                                                               \
+    u64 id = bpf_get_current_pid_tgid();                                          \
     u32 tgid = id >> 32;      /* thread-group id (the process id) */             \
     u32 pid = (u32)id;        /* actual kernel thread id (tid) */                \
                                                                                   \
     /* For non-exit events, ignore non-leader threads (only consider group leader) */ \
     if (EVENT__##name != EVENT__SCHED__SCHED_PROCESS_EXIT && tgid != pid)        \
-      return 0;                                                                   \
+      return;                                                                     \
                                                                                   \
     /* For EXIT, only report when the main thread (tgid == pid) exits */         \
     if (EVENT__##name == EVENT__SCHED__SCHED_PROCESS_EXIT && tgid != pid)        \
-      return 0;                                                                   \
+      return;                                                                     \
+                                                                                  \
+    /* Untracked processes never touch the ring. (I/O, scheduling and block   \
+       totals only exist for tracked processes, and may outlive their exit's     \
+       untracking.) */                                                           \
+    if (EVENT__##name != EVENT__SYSCALL__IO_SUMMARY &&                            \
+        EVENT__##name != EVENT__SCHED__SCHED_STATS &&                             \
+        EVENT__##name != EVENT__BLOCK__BLOCK_IO_STATS &&                          \
+        !is_tracked(tgid, EVENT__##name == EVENT__SCHED__SCHED_PROCESS_EXEC))    \
+      return;                                                                     \
+                                                                                  \
+    u32 slot = SLOT__##name;                                                      \
+    struct event_stats *st = bpf_map_lookup_elem(&stats, &slot);                  \
+    if (st)                                                                       \
+      st->seen++;                                                                 \
                                                                                   \
-    struct event *e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);                    \
+    u64 now = record_clock_ns();                                                  \
+    u32 ring_idx;                                                                 \
+    void *ring = current_ring(&ring_idx);                                         \
+    if (!ring)                                                                    \
+    {                                                                             \
+      if (st)                                                                     \
+        st->dropped++;                                                            \
+      return;                                                                     \
+    }                                                                             \
+    if (should_shed(ring, ring_idx, EVENT__##name, now))                          \
+    {                                                                             \
+      if (st)                                                                     \
+        st->shed++;                                                               \
+      return;                                                                     \
+    }                                                                             \
+                                                                                  \
+    u32 zero = 0;                                                                 \
+    struct event *e = bpf_map_lookup_elem(&scratch, &zero);                       \
     if (!e)                                                                       \
-      return 0;                                                                   \
+      return;                                                                     \
                                                                                   \
-    /* Fill fields common to every event */                                       \
+    /* Fill fields common to every event (the current task is the leader) */   \
     struct task_struct *task = (struct task_struct *)bpf_get_current_task();      \
-    struct task_struct *parent = BPF_CORE_READ(task, parent);                     \
+    struct proc_ident ident;                                                      \
+    process_ident(task, tgid, IDENT_MODE(EVENT__##name), &ident);                 \
                                                                                   \
-    e->event_type = EVENT__##name;                                                \
-    e->timestamp_ns = bpf_ktime_get_ns() + system_boot_ns;                        \
+    e->header.event_type = EVENT__##name;                                         \
+    e->header.layout = EVENT_LAYOUT_HASH;                                         \
+    e->header.timestamp_ns = now + clock_offset_ns;                               \
     /* store the process id (tgid) as the logical PID for events */              \
-    e->pid = tgid;                                                                \
-    e->ppid = BPF_CORE_READ(parent, tgid);                                        \
-                                                                                  \
+    e->header.pid = tgid;                                                         \
+    e->header.ppid = ident.ppid;                                                  \
     /* Use the leader/start-time pairing that makes upid unique: */               \
-    u64 start_ns = BPF_CORE_READ(task, start_time);                               \
-    u64 pstart_ns = BPF_CORE_READ(parent, start_time);                            \
-    e->upid = make_upid(e->pid, start_ns);                                        \
-    e->uppid = make_upid(e->ppid, pstart_ns);                                     \
+    e->header.upid = ident.upid;                                                  \
+    e->header.uppid = ident.uppid;                                                \
                                                                                   \
-    fill_fn(e, ctx);                                                              \
+    /* The process is gone; its tgid may be reused by an unrelated one */         \
+    if (filter_tracked && (EVENT__##name == EVENT__SCHED__SCHED_PROCESS_EXIT ||   \
+                           EVENT__##name == EVENT__SCHED__PROCESS_SUMMARY))        \
+      bpf_map_delete_elem(&tracked_pids, &tgid);                                  \
                                                                                   \
-    bpf_ringbuf_submit(e, 0);                                                     \
-    return 0;                                                                     \
+    /* Emit only the header plus the payload bytes actually used */              \
+    u32 payload_len = fill_fn(e, ctx);                                            \
+    if (AT_EXIT(EVENT__##name))                                                   \
+      bpf_map_delete_elem(&proc_idents, &tgid);                                   \
+    if (payload_len == NO_RECORD)                                                 \
+      return;                                                                     \
+    u32 len = sizeof(struct event_header) + payload_len;                          \
+    if (len > sizeof(*e))                                                         \
+      len = sizeof(*e);                                                           \
+    e->header.len = len;                                                          \
+                                                                                  \
+    if (bpf_ringbuf_output(ring, e, len, submit_flags(ring, EVENT__##name, len))) \
+    {                                                                             \
+      bpf_map_update_elem(&ring_drops, &ring_idx, &now, BPF_ANY);                 \
+      if (st)                                                                     \
+        st->dropped++;                                                            \
+      if (EVENT__##name == EVENT__SYSCALL__SYS_ENTER_OPENAT ||                    \
+          EVENT__##name == EVENT__SYSCALL__OPENAT)                                \
+        forget_filename(e);                                                       \
+    }                                                                             \
+    else if (st)                                                                  \
+      st->emitted++;                                                              \
   }
 
 EVENT_LIST(HANDLER_DECL)
 #undef HANDLER_DECL
 
+/* -------------------------------------------------------------------------- */
+/* 4.  Snapshot of running processes                                          */
+/* -------------------------------------------------------------------------- */
+
+#define PF_EXITING 0x00000004 // include/linux/sched.h
+#define PF_KTHREAD 0x00200000
+
+// Staging area of the snapshot iterator. Sleepable programs may be
+// interrupted by handlers on the same CPU, so it can't share `scratch`.
+struct
+{
+  __uint(type, BPF_MAP_TYPE_ARRAY);
+  __uint(max_entries, 1);
+  __type(key, u32);
+  __type(value, struct event);
+} snapshot_scratch SEC(".maps");
+
+// Run from tracer_attach() (tracer_opts.snapshot_existing): writes one
+// EVENT__SCHED__PROCESS_SNAPSHOT record per user-space process already
+// running, in the exec layout, to the iterator's output. Sleepable, to read
+// other processes' command lines.
+SEC("iter.s/task")
+int snapshot_tasks(struct bpf_iter__task *ctx)
+{
+  struct task_struct *task = ctx->task;
+  u32 zero = 0;
+
+  if (!task)
+    return 0;
+  u32 tgid = BPF_CORE_READ(task, tgid);
+  if (BPF_CORE_READ(task, pid) != tgid || BPF_CORE_READ(task, flags) & PF_KTHREAD)
+    return 0;
+  if (filter_tracked && !bpf_map_lookup_elem(&tracked_pids, &tgid))
+  {
+    u64 cgid = BPF_CORE_READ(task, cgroups, dfl_cgrp, kn, id);
+    if (!bpf_map_lookup_elem(&tracked_cgroups, &cgid))
+      return 0;
+  }
+
+  struct event *e = bpf_map_lookup_elem(&snapshot_scratch, &zero);
+  if (!e)
+    return 0;
+
+  struct task_struct *parent = BPF_CORE_READ(task, parent);
+  e->header.event_type = EVENT__SCHED__PROCESS_SNAPSHOT;
+  e->header.layout = EVENT_LAYOUT_HASH;
+  e->header.timestamp_ns = record_clock_ns() + clock_offset_ns;
+  e->header.pid = tgid;
+  e->header.ppid = BPF_CORE_READ(parent, tgid);
+  e->header.upid = make_upid(tgid, BPF_CORE_READ(task, start_time));
+  e->header.uppid = make_upid(e->header.ppid, BPF_CORE_READ(parent, start_time));
+
+  u32 len = sizeof(struct event_header) + fill_exec_payload(e, task, true);
+  if (len > sizeof(*e))
+    len = sizeof(*e);
+  e->header.len = len;
+  bpf_seq_write(ctx->meta->seq, e, len);
+  return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+/* 5.  Tracked-process propagation                                            */
+/* -------------------------------------------------------------------------- */
+
+// New processes forked by a tracked process are tracked too. Only loaded
+// when filtering is enabled.
+SEC("tp_btf/sched_process_fork")
+int BPF_PROG(handle__sched_process_fork, struct task_struct *parent, struct task_struct *child)
+{
+  u32 ptgid = BPF_CORE_READ(parent, tgid);
+  u32 ctgid = BPF_CORE_READ(child, tgid);
+
+  // New threads share the parent's tgid and need no entry of their own
+  if (!filter_tracked || ctgid == ptgid || BPF_CORE_READ(child, pid) != ctgid)
+    return 0;
+
+  u32 *root = bpf_map_lookup_elem(&tracked_pids, &ptgid);
+  if (root)
+    bpf_map_update_elem(&tracked_pids, &ctgid, root, BPF_ANY);
+  return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+/* 6.  In-kernel I/O accounting                                               */
+/* -------------------------------------------------------------------------- */
+
+// read/write/openat are far too frequent for a record per call. Instead they
+// bump per-CPU counters of the calling process, sent as one
+// EVENT__SYSCALL__IO_SUMMARY record at exit or read with tracer_io_stats().
+
+static __always_inline struct syscall__io_summary__payload *current_io_counters(void)
+{
+  u32 tgid = bpf_get_current_pid_tgid() >> 32;
+  if (!is_tracked(tgid, false))
+    return NULL;
+
+  // Any thread may do the I/O; account it to the process (leader) upid
+  struct task_struct *task = (struct task_struct *)bpf_get_current_task();
+  struct proc_ident ident;
+  process_ident(BPF_CORE_READ(task, group_leader), tgid, IDENT_CACHED, &ident);
+  u64 upid = ident.upid;
+
+  struct syscall__io_summary__payload *c = bpf_map_lookup_elem(&io_counters, &upid);
+  if (c)
+    return c;
+
+  struct syscall__io_summary__payload zero = {};
+  bpf_map_update_elem(&io_counters, &upid, &zero, BPF_NOEXIST);
+  return bpf_map_lookup_elem(&io_counters, &upid);
+}
+
+static __always_inline void count_read(struct trace_event_raw_sys_exit *ctx)
+{
+  struct syscall__io_summary__payload *c = current_io_counters();
+  if (!c)
+    return;
+  c->read_calls++;
+  if (ctx->ret > 0)
+    c->read_bytes += ctx->ret;
+}
+
+SEC("tracepoint/syscalls/sys_exit_read")
+int handle__sys_exit_read(struct trace_event_raw_sys_exit *ctx)
+{
+  return PROFILED(SLOT__SYSCALL__SYS_EXIT_READ, count_read(ctx));
+}
+
+static __always_inline void count_write(struct trace_event_raw_sys_exit *ctx)
+{
+  struct syscall__io_summary__payload *c = current_io_counters();
+  if (!c)
+    return;
+  c->write_calls++;
+  if (ctx->ret > 0)
+    c->write_bytes += ctx->ret;
+}
+
+SEC("tracepoint/syscalls/sys_exit_write")
+int handle__sys_exit_write(struct trace_event_raw_sys_exit *ctx)
+{
+  return PROFILED(SLOT__SYSCALL__SYS_EXIT_WRITE, count_write(ctx));
+}
+
+static __always_inline void count_openat(struct trace_event_raw_sys_exit *ctx)
+{
+  struct syscall__io_summary__payload *c = current_io_counters();
+  if (!c)
+    return;
+  c->openat_calls++;
+  if (ctx->ret < 0)
+    c->openat_failures++;
+}
+
+SEC("tracepoint/syscalls/sys_exit_openat")
+int handle__sys_exit_openat(struct trace_event_raw_sys_exit *ctx)
+{
+  return PROFILED(SLOT__SYSCALL__SYS_EXIT_OPENAT, count_openat(ctx));
+}
+
+/* -------------------------------------------------------------------------- */
+/* 7.  Memory-pressure accounting                                             */
+/* -------------------------------------------------------------------------- */
+
+// Direct reclaims and memory stalls come in bursts exactly when the node is
+// short of memory, so a record each would add to the pressure. Instead they
+// are timed into per-CPU counters of the process, which the library drains
+// into one EVENT__VMSCAN__MEMORY_PRESSURE record per process and interval.
+
+struct
+{
+  __uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
+  __uint(max_entries, 16384);
+  __type(key, u64); // upid
+  __type(value, struct mem_pressure);
+} mem_pressure SEC(".maps");
+
+// When the thread (by tid) entered the reclaim or stall in progress
+struct
+{
+  __uint(type, BPF_MAP_TYPE_HASH);
+  __uint(max_entries, 16384);
+  __type(key, u32);
+  __type(value, u64);
+} reclaim_start SEC(".maps");
+
+struct
+{
+  __uint(type, BPF_MAP_TYPE_HASH);
+  __uint(max_entries, 16384);
+  __type(key, u32);
+  __type(value, u64);
+} memstall_start SEC(".maps");
+
+static __always_inline struct mem_pressure *current_pressure(void)
+{
+  u32 tgid = bpf_get_current_pid_tgid() >> 32;
+  struct task_struct *task = (struct task_struct *)bpf_get_current_task();
+  struct proc_ident ident;
+  process_ident(BPF_CORE_READ(task, group_leader), tgid, IDENT_CACHED, &ident);
+  u64 upid = ident.upid;
+
+  struct mem_pressure *p = bpf_map_lookup_elem(&mem_pressure, &upid);
+  if (p)
+    return p;
+
+  struct mem_pressure init = {.pid = tgid, .ppid = ident.ppid, .uppid = ident.uppid};
+  bpf_map_update_elem(&mem_pressure, &upid, &init, BPF_NOEXIST);
+  return bpf_map_lookup_elem(&mem_pressure, &upid);
+}
+
+// Notes when the current thread of a tracked process entered the interval
+static __always_inline void begin_interval(void *start_map)
+{
+  u64 id = bpf_get_current_pid_tgid();
+  u32 tid = (u32)id;
+  u64 now = bpf_ktime_get_ns();
+
+  if (is_tracked(id >> 32, false))
+    bpf_map_update_elem(start_map, &tid, &now, BPF_ANY);
+}
+
+// Time since the matching begin_interval(), or 0 if there was none
+static __always_inline u64 end_interval(void *start_map)
+{
+  u32 tid = (u32)bpf_get_current_pid_tgid();
+  u64 *start = bpf_map_lookup_elem(start_map, &tid);
+
+  if (!start)
+    return 0;
+  u64 ns = bpf_ktime_get_ns() - *start;
+  bpf_map_delete_elem(start_map, &tid);
+  return ns ? ns : 1;
+}
+
+SEC("tracepoint/vmscan/mm_vmscan_direct_reclaim_begin")
+int handle__mm_vmscan_direct_reclaim_begin(void *ctx)
+{
+  return PROFILED(SLOT__VMSCAN__MM_VMSCAN_DIRECT_RECLAIM_BEGIN, begin_interval(&reclaim_start));
+}
+
+static __always_inline void count_reclaim(struct trace_event_raw_mm_vmscan_direct_reclaim_end_template *ctx)
+{
+  u64 ns = end_interval(&reclaim_start);
+  if (!ns)
+    return;
+  struct mem_pressure *p = current_pressure();
+  if (!p)
+    return;
+  p->counts.reclaim_count++;
+  p->counts.reclaim_ns += ns;
+  p->counts.reclaimed_pages += BPF_CORE_READ(ctx, nr_reclaimed);
+}
+
+SEC("tracepoint/vmscan/mm_vmscan_direct_reclaim_end")
+int handle__mm_vmscan_direct_reclaim_end(struct trace_event_raw_mm_vmscan_direct_reclaim_end_template *ctx)
+{
+  return PROFILED(SLOT__VMSCAN__MM_VMSCAN_DIRECT_RECLAIM_END, count_reclaim(ctx));
+}
+
+// psi_memstall_enter/leave(unsigned long *flags) have no tracepoints, so
+// they are traced with trampolines where available. A stall nested in
+// another one leaves *flags set: at enter's exit, and at leave's entry.
+struct psi_memstall_ctx
+{
+  u64 flags;
+};
+
+static __always_inline bool memstall_nested(struct psi_memstall_ctx *ctx)
+{
+  unsigned long nested = 0;
+
+  bpf_probe_read_kernel(&nested, sizeof(nested), (void *)ctx->flags);
+  return nested;
+}
+
+static __always_inline void count_memstall_enter(struct psi_memstall_ctx *ctx)
+{
+  if (!memstall_nested(ctx))
+    begin_interval(&memstall_start);
+}
+
+SEC("fexit/psi_memstall_enter")
+int handle__psi_memstall_enter(struct psi_memstall_ctx *ctx)
+{
+  return PROFILED(SLOT__SCHED__PSI_MEMSTALL_ENTER, count_memstall_enter(ctx));
+}
+
+static __always_inline void count_memstall(struct psi_memstall_ctx *ctx)
+{
+  if (memstall_nested(ctx))
+    return;
+  u64 ns = end_interval(&memstall_start);
+  if (!ns)
+    return;
+  struct mem_pressure *p = current_pressure();
+  if (!p)
+    return;
+  p->counts.memstall_count++;
+  p->counts.memstall_ns += ns;
+}
+
+SEC("fentry/psi_memstall_leave")
+int handle__psi_memstall_leave(struct psi_memstall_ctx *ctx)
+{
+  return PROFILED(SLOT__SCHED__PSI_MEMSTALL_LEAVE, count_memstall(ctx));
+}
+
+/* -------------------------------------------------------------------------- */
+/* 8.  Scheduler accounting                                                   */
+/* -------------------------------------------------------------------------- */
+
+// sched_switch fires millions of times a second host-wide, so it only
+// updates the sched_stats histograms of the process; the exit sends them as
+// one EVENT__SCHED__SCHED_STATS record.
+
+#define TASK_RUNNING 0
+
+// When the thread (by tid) became runnable, and when it got its CPU; 0 if
+// not queued or not running
+struct sched_times
+{
+  u64 queued_ns;
+  u64 oncpu_ns;
+};
+
+// LRU: threads that exit while queued leave their entry behind
+struct
+{
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 65536);
+  __type(key, u32);
+  __type(value, struct sched_times);
+} sched_times SEC(".maps");
+
+// Before 5.14, task_struct::__state was `long state`
+struct task_struct___o
+{
+  long state;
+} __attribute__((preserve_access_index));
+
+static __always_inline bool task_runnable(struct task_struct *task)
+{
+  if (bpf_core_field_exists(task->__state))
+    return BPF_CORE_READ(task, __state) == TASK_RUNNING;
+  return BPF_CORE_READ((struct task_struct___o *)task, state) == TASK_RUNNING;
+}
+
+// Whether the leader of `task` has begun its exit. Its sched_process_exit
+// then sends (or has sent) the totals and drops the identity, so nothing of
+// the process is counted from there on: that would only bring back entries
+// for a dead upid, which take LRU slots from live processes.
+static __always_inline bool process_exiting(struct task_struct *task)
+{
+  return BPF_CORE_READ(task, group_leader, flags) & PF_EXITING;
+}
+
+// is_tracked() for another task than the current one
+static __always_inline bool task_tracked(struct task_struct *task, u32 tgid)
+{
+  if (!filter_tracked)
+    return true;
+  if (bpf_map_lookup_elem(&tracked_pids, &tgid))
+    return true;
+
+  u64 cgid = BPF_CORE_READ(task, cgroups, dfl_cgrp, kn, id);
+  return bpf_map_lookup_elem(&tracked_cgroups, &cgid);
+}
+
+// Times of a tracked thread, created as needed; NULL for untracked ones
+static __always_inline struct sched_times *thread_times(struct task_struct *task, u32 *tgid)
+{
+  u32 tid = BPF_CORE_READ(task, pid);
+
+  *tgid = BPF_CORE_READ(task, tgid);
+  if (!tid || !task_tracked(task, *tgid)) // the idle task is pid 0
+    return NULL;
+  if (process_exiting(task))
+  {
+    bpf_map_delete_elem(&sched_times, &tid);
+    return NULL;
+  }
+
+  struct sched_times *t = bpf_map_lookup_elem(&sched_times, &tid);
+  if (t)
+    return t;
+
+  struct sched_times zero = {};
+  bpf_map_update_elem(&sched_times, &tid, &zero, BPF_NOEXIST);
+  return bpf_map_lookup_elem(&sched_times, &tid);
+}
+
+static __always_inline struct sched__sched_stats__payload *upid_sched_stats(u64 upid)
+{
+  struct sched__sched_stats__payload *s = bpf_map_lookup_elem(&sched_stats, &upid);
+  if (s)
+    return s;
+
+  struct sched__sched_stats__payload zero = {};
+  bpf_map_update_elem(&sched_stats, &upid, &zero, BPF_NOEXIST);
+  return bpf_map_lookup_elem(&sched_stats, &upid);
+}
+
+static __always_inline struct sched__sched_stats__payload *process_sched_stats(struct task_struct *task, u32 tgid)
+{
+  struct proc_ident ident;
+  process_ident(BPF_CORE_READ(task, group_leader), tgid, IDENT_CACHED, &ident);
+  return upid_sched_stats(ident.upid);
+}
+
+static __always_inline void hist_add(struct latency_hist *h, u64 ns)
+{
+  __sync_fetch_and_add(&h->buckets[log2_bucket(ns) & (LATENCY_BUCKETS - 1)], 1);
+}
+
+static __always_inline void count_oncpu(struct sched__sched_stats__payload *s, u64 ns)
+{
+  __sync_fetch_and_add(&s->oncpu_ns, ns);
+  hist_add(&s->oncpu, ns);
+}
+
+// From fill_sched_stats(): the exiting leader is still on its CPU, and the
+// switch away from it only comes once the totals are sent, so the current
+// stretch is counted now
+static __always_inline void count_last_stretch(u64 upid)
+{
+  u32 tid = (u32)bpf_get_current_pid_tgid();
+  struct sched_times *t = bpf_map_lookup_elem(&sched_times, &tid);
+  struct sched__sched_stats__payload *s;
+
+  if (!t)
+    return; // untracked
+  if (t->oncpu_ns && (s = upid_sched_stats(upid)))
+    count_oncpu(s, bpf_ktime_get_ns() - t->oncpu_ns);
+  bpf_map_delete_elem(&sched_times, &tid);
+}
+
+static __always_inline void count_wakeup(struct task_struct *task)
+{
+  u32 tgid;
+  struct sched_times *t = thread_times(task, &tgid);
+
+  if (t && !t->queued_ns)
+    t->queued_ns = bpf_ktime_get_ns();
+}
+
+SEC("tp_btf/sched_wakeup")
+int BPF_PROG(handle__sched_wakeup, struct task_struct *task)
+{
+  return PROFILED(SLOT__SCHED__SCHED_WAKEUP, count_wakeup(task));
+}
+
+SEC("tp_btf/sched_wakeup_new")
+int BPF_PROG(handle__sched_wakeup_new, struct task_struct *task)
+{
+  return PROFILED(SLOT__SCHED__SCHED_WAKEUP, count_wakeup(task));
+}
+
+static __always_inline void count_switch(struct task_struct *prev, struct task_struct *next)
+{
+  u64 now = bpf_ktime_get_ns();
+  struct sched__sched_stats__payload *s;
+  struct sched_times *t;
+  u32 tgid;
+
+  // prev leaves its CPU, and stays queued if it was preempted. After
+  // exit_notify() this is a thread's last switch: it leaves for good.
+  t = thread_times(prev, &tgid);
+  if (t && (s = process_sched_stats(prev, tgid)))
+  {
+    if (t->oncpu_ns)
+    {
+      count_oncpu(s, now - t->oncpu_ns);
+      t->oncpu_ns = 0;
+    }
+    if (task_runnable(prev))
+    {
+      __sync_fetch_and_add(&s->preemptions, 1);
+      t->queued_ns = now;
+    }
+  }
+  if (t && BPF_CORE_READ(prev, exit_state))
+  {
+    u32 tid = BPF_CORE_READ(prev, pid);
+    bpf_map_delete_elem(&sched_times, &tid);
+  }
+
+  // next gets it, ending its wait
+  t = thread_times(next, &tgid);
+  if (!t)
+    return;
+  if (t->queued_ns && (s = process_sched_stats(next, tgid)))
+  {
+    u64 ns = now - t->queued_ns;
+    __sync_fetch_and_add(&s->runq_ns, ns);
+    hist_add(&s->runq_delay, ns);
+  }
+  t->queued_ns = 0;
+  t->oncpu_ns = now;
+}
+
+SEC("tp_btf/sched_switch")
+int BPF_PROG(handle__sched_switch, bool preempt, struct task_struct *prev, struct task_struct *next)
+{
+  return PROFILED(SLOT__SCHED__SCHED_SWITCH, count_switch(prev, next));
+}
+
+/* -------------------------------------------------------------------------- */
+/* 9.  On-CPU stack sampling                                                  */
+/* -------------------------------------------------------------------------- */
+
+// Attached by the library to a CPU-clock perf event per CPU, firing
+// tracer_opts.profile_hz times a second. Samples of tracked processes are
+// only counted here, per process and pair of stacks, so the cost doesn't
+// grow with the number of samples; tracer_profile_read() symbolizes them.
+// The counts of processes no one reads age out of the LRU map. Both maps
+// are shrunk to one entry when profiling is off.
+
+struct
+{
+  __uint(type, BPF_MAP_TYPE_STACK_TRACE);
+  __uint(max_entries, 16384);
+  __type(key, u32);
+  __uint(value_size, PROFILE_MAX_DEPTH * sizeof(u64));
+} stack_traces SEC(".maps");
+
+struct
+{
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 32768);
+  __type(key, struct profile_key);
+  __type(value, u64);
+} profile_counts SEC(".maps");
+
+static __always_inline void sample_stack(struct bpf_perf_event_data *ctx)
+{
+  u32 tgid = bpf_get_current_pid_tgid() >> 32;
+
+  if (!tgid || !is_tracked(tgid, false)) // tgid 0: the CPU was idle
+    return;
+
+  struct task_struct *task = (struct task_struct *)bpf_get_current_task();
+  struct proc_ident ident;
+  process_ident(BPF_CORE_READ(task, group_leader), tgid, IDENT_CACHED, &ident);
+
+  struct profile_key key = {.upid = ident.upid, .pid = tgid};
+  key.user_stack = bpf_get_stackid(ctx, &stack_traces, BPF_F_USER_STACK);
+  key.kernel_stack = bpf_get_stackid(ctx, &stack_traces, 0);
+
+  u64 *count = bpf_map_lookup_elem(&profile_counts, &key);
+  if (count)
+  {
+    __sync_fetch_and_add(count, 1);
+    return;
+  }
+  u64 one = 1;
+  if (!bpf_map_update_elem(&profile_counts, &key, &one, BPF_NOEXIST))
+    return;
+  count = bpf_map_lookup_elem(&profile_counts, &key); // another CPU added it first
+  if (count)
+    __sync_fetch_and_add(count, 1);
+}
+
+SEC("perf_event")
+int handle__profile_sample(struct bpf_perf_event_data *ctx)
+{
+  return PROFILED(SLOT__PROFILE__CPU_SAMPLE, sample_stack(ctx));
+}
+
+/* -------------------------------------------------------------------------- */
+/* 10. Block I/O accounting                                                   */
+/* -------------------------------------------------------------------------- */
+
+// Requests complete in interrupt context, long after and away from the task
+// that caused them. So each one is tagged with its owner when queued
+// (block_rq_insert) or, if it bypasses the queue, issued (block_rq_issue),
+// and its completions add to the owner's block_stats. The exit sends those
+// as one EVENT__BLOCK__BLOCK_IO_STATS record; no record is sent per request.
+// Requests that only kernel threads touched (writeback, flushes) have no
+// owner and aren't counted.
+
+#define REQ_OP_MASK 0xff
+#define REQ_OP_READ 0
+#define REQ_OP_WRITE 1
+
+// Owner of a request in flight, keyed by its struct request
+struct block_request
+{
+  u64 upid;
+  u64 issue_ns;   // 0 while queued
+  u32 bytes_left; // completions can be partial
+  u32 write;
+};
+
+// LRU: requests merged into others, or failed early, never complete
+struct
+{
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 16384);
+  __type(key, u64);
+  __type(value, struct block_request);
+} block_requests SEC(".maps");
+
+// The request of a block_rq_insert/block_rq_issue tracepoint, whose
+// request_queue argument went away in 5.11
+#define TP_REQUEST(ctx) ((struct request *)(block_rq_has_queue ? (ctx)[1] : (ctx)[0]))
+
+// Upid of the current task if it may own a request: a tracked user process,
+// not past its exit. Its block_stats entry is made here, in its context, so
+// that completions after the exit sent the totals find none and are dropped
+// rather than re-creating it for a dead upid.
+static __always_inline bool request_owner(u64 *upid)
+{
+  u32 tgid = bpf_get_current_pid_tgid() >> 32;
+  struct task_struct *task = (struct task_struct *)bpf_get_current_task();
+
+  if (!tgid || BPF_CORE_READ(task, flags) & PF_KTHREAD || !is_tracked(tgid, false) ||
+      process_exiting(task))
+    return false;
+
+  struct proc_ident ident;
+  process_ident(BPF_CORE_READ(task, group_leader), tgid, IDENT_CACHED, &ident);
+  *upid = ident.upid;
+
+  struct block__block_io_stats__payload zero = {};
+  bpf_map_update_elem(&block_stats, upid, &zero, BPF_NOEXIST);
+  return true;
+}
+
+static __always_inline void queue_request(struct request *rq)
+{
+  u64 key = (u64)rq;
+  struct block_request r = {};
+
+  // A request is reused once freed: whatever was left under it is stale
+  if (request_owner(&r.upid))
+    bpf_map_update_elem(&block_requests, &key, &r, BPF_ANY);
+  else
+    bpf_map_delete_elem(&block_requests, &key);
+}
+
+static __always_inline void issue_request(struct request *rq)
+{
+  u64 key = (u64)rq;
+  u32 op = BPF_CORE_READ(rq, cmd_flags) & REQ_OP_MASK;
+  u32 bytes = BPF_CORE_READ(rq, __data_len); // final, merges happen while queued
+
+  if ((op != REQ_OP_READ && op != REQ_OP_WRITE) || !bytes) // flushes, discards...
+  {
+    bpf_map_delete_elem(&block_requests, &key);
+    return;
+  }
+
+  // Owned by whoever queued it; if it wasn't queued, by the issuer. A
+  // dispatch from another task, or a requeued issue, keeps the owner.
+  struct block_request *r = bpf_map_lookup_elem(&block_requests, &key);
+  struct block_request issued = {};
+  if (r)
+    issued.upid = r->upid;
+  else if (!request_owner(&issued.upid))
+    return;
+  issued.issue_ns = bpf_ktime_get_ns();
+  issued.bytes_left = bytes;
+  issued.write = op == REQ_OP_WRITE;
+  bpf_map_update_elem(&block_requests, &key, &issued, BPF_ANY);
+}
+
+SEC("tp_btf/block_rq_insert")
+int BPF_PROG(handle__block_rq_insert)
+{
+  return PROFILED(SLOT__BLOCK__BLOCK_RQ_INSERT, queue_request(TP_REQUEST(ctx)));
+}
+
+SEC("tp_btf/block_rq_issue")
+int BPF_PROG(handle__block_rq_issue)
+{
+  return PROFILED(SLOT__BLOCK__BLOCK_RQ_ISSUE, issue_request(TP_REQUEST(ctx)));
+}
+
+static __always_inline void complete_request(struct request *rq, int error, u32 nr_bytes)
+{
+  u64 key = (u64)rq;
+  struct block_request *r = bpf_map_lookup_elem(&block_requests, &key);
+
+  if (!r || !r->issue_ns)
+    return;
+  struct block__block_io_stats__payload *s = bpf_map_lookup_elem(&block_stats, &r->upid);
+  if (!s)
+  {
+    bpf_map_delete_elem(&block_requests, &key); // the owner has exited
+    return;
+  }
+
+  __sync_fetch_and_add(r->write ? &s->write_bytes : &s->read_bytes, nr_bytes);
+  if (nr_bytes && nr_bytes < r->bytes_left)
+  {
+    r->bytes_left -= nr_bytes;
+    return;
+  }
+
+  // The last part: the request is done
+  u64 ns = bpf_ktime_get_ns() - r->issue_ns;
+  if (r->write)
+  {
+    __sync_fetch_and_add(&s->writes, 1);
+    __sync_fetch_and_add(&s->write_ns, ns);
+    hist_add(&s->write_latency, ns);
+  }
+  else
+  {
+    __sync_fetch_and_add(&s->reads, 1);
+    __sync_fetch_and_add(&s->read_ns, ns);
+    hist_add(&s->read_latency, ns);
+  }
+  if (error)
+    __sync_fetch_and_add(&s->errors, 1);
+  bpf_map_delete_elem(&block_requests, &key);
+}
+
+SEC("tp_btf/block_rq_complete")
+int BPF_PROG(handle__block_rq_complete, struct request *rq, int error, unsigned int nr_bytes)
+{
+  return PROFILED(SLOT__BLOCK__BLOCK_RQ_COMPLETE, complete_request(rq, error, nr_bytes));
+}
+
 // Licence, required to invoke GPL-restricted BPF functions
-char LICENSE[] SEC("license") = "GPL";
\ No newline at end of file
+char LICENSE[] SEC("license") = "GPL";
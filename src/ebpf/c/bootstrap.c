@@ -1,19 +1,32 @@
 #define _POSIX_C_SOURCE 200809L
+#include <dirent.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/resource.h>
 #include <time.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
 #include <errno.h>
 
+#include <bpf/bpf.h>
+#include <bpf/btf.h>
 #include <bpf/libbpf.h>
 
 #include "bootstrap.h"
 #include "bootstrap.skel.h"
 #include "bootstrap_api.h"
+#include "handoff.h"
+#include "ring_set.h"
+#include "ring_view.h"
+#include "spill.h"
+#include "stack_profile.h"
+#include "string_table.h"
 
 #ifndef likely
 #define likely(x) __builtin_expect(!!(x), 1)
@@ -22,31 +35,65 @@
 #define unlikely(x) __builtin_expect(!!(x), 0)
 #endif
 
-/* Time calibration constants */
+/* How often tracer_poll() re-measures the offset of the record clock to the wall clock */
 #define RECALIBRATION_INTERVAL_NS (60ULL * 1000000000) /* 60 seconds in ns */
 
+#define POLL_TIMEOUT_MS 200
+
+/* Zero-copy consumption */
+#define MAX_VIEWS 256
+#define ZERO_COPY_BACKOFF_NS (10ULL * 1000000) /* consumer acknowledged nothing */
+
+/* Per-CPU / per-node rings: default size of each, unless set in tracer_opts */
+#define SHARED_RING_SIZE (8U * 1024 * 1024)
+#define MIN_SPLIT_RING_SIZE (256U * 1024)
+
+/* Poll timeout of the handoff thread, bounding how long tracer_stop() waits for it */
+#define HANDOFF_POLL_MS 50
+/* ... and while spilled records wait for the consumer to make room for them */
+#define HANDOFF_REFILL_MS 10
+
+/* Default tracer_opts.spill_bytes */
+#define SPILL_BYTES (1ULL << 30)
+
+/* Read size for the snapshot iterator's output */
+#define SNAPSHOT_READ_SIZE (1024 * 1024)
+
+/* Default tracer_opts.pressure_interval_ms */
+#define PRESSURE_INTERVAL_MS 1000
+
+/* Text held by tracer_intern_strings() before the table is dropped */
+#define MAX_STRING_TABLE_BYTES (64UL * 1024 * 1024)
+
 static struct env
 {
 	bool verbose;
-	bool debug_bpf; // Propagate to .rodata
 } env = {
 	.verbose = false,
-	.debug_bpf = false,
 };
 
-/* Find when the host system booted */
-static u64 get_system_boot_ns(void)
+static u64 clock_ns(clockid_t clock)
 {
-	struct timespec realtime, monotonic;
-	u64 realtime_ns, monotonic_ns;
+	struct timespec ts;
 
-	clock_gettime(CLOCK_REALTIME, &realtime);
-	clock_gettime(CLOCK_MONOTONIC, &monotonic);
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static u64 monotonic_ns(void)
+{
+	return clock_ns(CLOCK_MONOTONIC);
+}
 
-	realtime_ns = realtime.tv_sec * 1000000000ULL + realtime.tv_nsec;
-	monotonic_ns = monotonic.tv_sec * 1000000000ULL + monotonic.tv_nsec;
+/* Wall-clock time minus `clock`, i.e. when the host booted by the wall clock */
+static u64 wall_clock_offset_ns(clockid_t clock)
+{
+	// Read between two samples of `clock`, so the skew is at most half the gap
+	u64 before = clock_ns(clock);
+	u64 realtime = clock_ns(CLOCK_REALTIME);
+	u64 after = clock_ns(clock);
 
-	return realtime_ns - monotonic_ns;
+	return realtime - (before + (after - before) / 2);
 }
 
 static int libbpf_print_cb(enum libbpf_print_level lvl,
@@ -58,126 +105,1671 @@ static int libbpf_print_cb(enum libbpf_print_level lvl,
 	return vfprintf(stderr, fmt, args);
 }
 
+// Set by the legacy blocking entry points' signal handlers only
 static volatile bool exiting;
 
 static void sig_handler(int sig) { exiting = true; }
 
-// Ring‑buffer callback
-typedef void (*event_callback_t)(void *ctx, size_t bytes);
-
-struct lib_ctx
+struct tracer
 {
+	struct bootstrap_bpf *skel;
+	bool attached;
+	int epfd; // readable whenever the ring has records
+
+	/* Per-CPU / per-node rings, drained by their own threads (NULL = shared ring) */
+	struct ring_set *rings;
+	unsigned int nr_rings;
+	size_t ring_size;
+
+	/* Copying consumer (tracer_set_callback) */
+	struct ring_buffer *rb;
 	void *buffer;
 	size_t buf_sz;
 	size_t filled; // Running fill level
+	size_t pending; // Records currently in the buffer
+	u64 first_pending_ns; // When the oldest pending record was copied
+	bool batching;
+	struct batch_opts batch;
 	event_callback_t cb;
 	void *cb_ctx;
-	struct bootstrap_bpf *skel;
-	struct ring_buffer *rb;
+
+	/* Zero-copy consumer (tracer_set_view_callback) */
+	struct ring_view rv;
+	event_view_callback_t view_cb;
+	void *view_cb_ctx;
+	struct event_view views[MAX_VIEWS];
+	unsigned long ends[MAX_VIEWS];
+	unsigned int view_rings[MAX_VIEWS]; // ring_set queue of each view
+
+	/* Zero-copy consumer feeding a handoff (tracer_set_handoff), polled by its thread while attached */
+	struct handoff *handoff;
+
+	/* Records handle_event() dropped for another EVENT_LAYOUT_HASH */
+	u64 foreign_records;
+
+	/* tracer_intern_strings(), created on first use */
+	struct string_table *strings;
+
+	/* Snapshot of running processes at attach time (snapshot_existing) */
+	bool snapshot;
+
+	/* Clock of the record timestamps (tracer_opts.boot_clock), before the offset in .bss */
+	clockid_t clock;
+	u64 last_calibration_ns; // monotonic
+
+	/* tracer_opts.pin_path, owned; NULL = nothing pinned */
+	char *pin_path;
+
+	/* tracer_opts.spill_path, owned, and spill_bytes, for tracer_set_handoff() */
+	char *spill_path;
+	u64 spill_bytes;
+
+	/* Memory-pressure summaries, drained every interval by tracer_poll() */
+	u64 pressure_interval_ns; // 0 = memory events not loaded
+	u64 last_pressure_ns;     // monotonic
+
+	/* tracer_consumer_latency(), with profile_handlers */
+	bool profiling;
+	struct latency_hist timing[TRACER_TIMING_COUNT];
+
+	/* On-CPU stack sampling (tracer_opts.profile_hz), attached with the skeleton */
+	struct stack_profile *profile; // NULL = not sampling
+	unsigned int profile_hz;
 };
 
+// Adds the time since `start_ns` to a consumer stage's histogram
+static void add_timing(struct tracer *t, enum tracer_timing stage, u64 start_ns)
+{
+	u64 ns = monotonic_ns() - start_ns;
+	unsigned int b = ns ? 63 - __builtin_clzll(ns) : 0;
+
+	t->timing[stage].buckets[b < LATENCY_BUCKETS ? b : LATENCY_BUCKETS - 1]++;
+}
+
+// Hands the records accumulated so far to the consumer
+static void flush(struct tracer *t)
+{
+	if (t->filled)
+	{
+		u64 start = t->profiling ? monotonic_ns() : 0;
+
+		t->cb(t->cb_ctx, t->filled);
+		if (t->profiling)
+			add_timing(t, TRACER_TIMING_CALLBACK, start);
+	}
+	t->filled = 0;
+	t->pending = 0;
+}
+
+// Runs the zero-copy callback, timing it with profile_handlers
+static size_t deliver_views(struct tracer *t, const struct event_view *views, size_t n)
+{
+	u64 start = t->profiling ? monotonic_ns() : 0;
+	size_t done = t->view_cb(t->view_cb_ctx, views, n);
+
+	if (t->profiling)
+		add_timing(t, TRACER_TIMING_CALLBACK, start);
+	return done > n ? n : done;
+}
+
 // Copies from ringBuffer to external buffer and invokes callback
 static int handle_event(void *ctx, void *data, size_t data_sz)
 {
-	struct lib_ctx *lc = ctx;
-	struct event *e = data; // Cast data to our event struct
+	struct tracer *t = ctx;
+	const struct event_header *hdr = data;
+	u64 start = t->profiling ? monotonic_ns() : 0;
 
-	if (unlikely(data_sz != sizeof(struct event)))
+	// Records are framed: the header carries the length of the whole record
+	if (unlikely(data_sz < sizeof(*hdr) || hdr->len != data_sz ||
+				 data_sz > sizeof(struct event)))
+	{
+		fprintf(stderr, "C: malformed record (%zu bytes, header says %u)\n",
+				data_sz, data_sz >= sizeof(*hdr) ? hdr->len : 0);
+		return 0;
+	}
+	// e.g. from programs an older build left pinned: their payloads can't be read
+	if (unlikely(hdr->layout != EVENT_LAYOUT_HASH))
 	{
-		fprintf(stderr, "C: size mismatch (%zu!=%zu)\n",
-				data_sz, sizeof(struct event));
+		if (!t->foreign_records++)
+			fprintf(stderr, "C: dropping records of another layout (%#x, expected %#x)\n",
+					hdr->layout, EVENT_LAYOUT_HASH);
+		return 0;
+	}
+	if (unlikely(data_sz > t->buf_sz))
+	{
+		fprintf(stderr, "C: record larger than buffer (%zu>%zu)\n",
+				data_sz, t->buf_sz);
 		return 0;
 	}
 
-	// Flush if no room
-	if (lc->filled + data_sz > lc->buf_sz)
+	// Flush if no room (the callback is timed on its own)
+	if (t->filled + data_sz > t->buf_sz)
 	{
-		if (lc->filled)
-			lc->cb(lc->cb_ctx, lc->filled);
-		lc->filled = 0;
+		flush(t);
+		if (t->profiling)
+			start = monotonic_ns();
 	}
 
-	memcpy((char *)lc->buffer + lc->filled, data, data_sz);
-	lc->filled += data_sz;
+	if (!t->pending)
+		t->first_pending_ns = monotonic_ns();
+	memcpy((char *)t->buffer + t->filled, data, data_sz);
+	t->filled += data_sz;
+	t->pending++;
+	if (t->profiling)
+		add_timing(t, TRACER_TIMING_RECORD, start);
 
-	// Immediate flush
-	lc->cb(lc->cb_ctx, lc->filled);
-	lc->filled = 0;
+	// Without batching, or once the count threshold is hit, flush immediately
+	if (!t->batching ||
+		(t->batch.max_events && t->pending >= t->batch.max_events))
+		flush(t);
 
 	return 0;
 }
 
-// Public API
-int initialize(void *buffer, size_t byte_cnt,
-			   event_callback_t cb, void *cb_ctx)
+// Flushes at the end of a poll pass if the latency threshold has been hit,
+// and returns how long the next poll may wait without overshooting it
+static int flush_pass(struct tracer *t, int timeout_ms)
+{
+	u64 max_latency_ns, age_ns;
+
+	if (!t->pending)
+		return timeout_ms;
+
+	max_latency_ns = t->batch.max_latency_ms * 1000000ULL;
+	age_ns = monotonic_ns() - t->first_pending_ns;
+	if (age_ns >= max_latency_ns)
+	{
+		flush(t);
+		return timeout_ms;
+	}
+
+	u64 wait_ms = (max_latency_ns - age_ns + 999999) / 1000000;
+	return timeout_ms < 0 || wait_ms < (u64)timeout_ms ? (int)wait_ms : timeout_ms;
+}
+
+// Drops whichever consumer is configured, delivering anything still batched
+static void reset_consumer(struct tracer *t)
+{
+	// Its thread uses the ring view, so it goes first
+	handoff__free(t->handoff);
+	t->handoff = NULL;
+	if (t->cb)
+		flush(t);
+	ring_buffer__free(t->rb);
+	t->rb = NULL;
+	ring_view__close(&t->rv);
+	t->cb = NULL;
+	t->view_cb = NULL;
+}
+
+// Possible NUMA nodes, from a list like "0-3" (or 1 without NUMA)
+static int possible_nodes(void)
+{
+	char buf[128], *p;
+	FILE *f = fopen("/sys/devices/system/node/possible", "r");
+	int n = 1;
+
+	if (!f)
+		return 1;
+	if (fgets(buf, sizeof(buf), f))
+	{
+		p = buf + strcspn(buf, "\n");
+		while (p > buf && p[-1] >= '0' && p[-1] <= '9')
+			p--;
+		n = atoi(p) + 1;
+	}
+	fclose(f);
+	return n;
+}
+
+// Whether the running kernel has a helper, by its enum bpf_func_id name in
+// the kernel BTF. (Unlike tracepoint ones, helpers of tracing programs such
+// as iterators can't be probed by loading a test program.) The probes take
+// the kernel BTF from load_skeleton(), NULL if it couldn't be read.
+static bool kernel_has_helper(const struct btf *btf, const char *name)
+{
+	bool found = false;
+	int id;
+
+	if (!btf)
+		return false;
+	id = btf__find_by_name_kind(btf, "bpf_func_id", BTF_KIND_ENUM);
+	if (id > 0)
+	{
+		const struct btf_type *type = btf__type_by_id(btf, id);
+		const struct btf_enum *e = btf_enum(type);
+
+		for (int i = 0; i < btf_vlen(type) && !found; i++)
+			found = !strcmp(btf__name_by_offset(btf, e[i].name_off), name);
+	}
+	return found;
+}
+
+// Whether fentry/fexit programs can be attached to kernel function `func`.
+// That takes the function in the kernel BTF and trampoline support, which
+// arm64 only gained in 6.0, so a trivial fexit program is loaded and
+// attached to find out.
+static bool kernel_can_trampoline(const struct btf *btf, const char *func)
+{
+	const struct bpf_insn insns[] = {
+		{.code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_0, .imm = 0},
+		{.code = BPF_JMP | BPF_EXIT},
+	};
+	int id, prog_fd, link_fd;
+
+	if (!btf)
+		return false;
+	id = btf__find_by_name_kind(btf, func, BTF_KIND_FUNC);
+	if (id <= 0)
+		return false;
+
+	LIBBPF_OPTS(bpf_prog_load_opts, load_opts, .expected_attach_type = BPF_TRACE_FEXIT,
+				.attach_btf_id = id);
+	prog_fd = bpf_prog_load(BPF_PROG_TYPE_TRACING, NULL, "GPL", insns, sizeof(insns) / sizeof(insns[0]),
+							&load_opts);
+	if (prog_fd < 0)
+		return false;
+	link_fd = bpf_raw_tracepoint_open(NULL, prog_fd);
+	if (link_fd >= 0)
+		close(link_fd);
+	close(prog_fd);
+	return link_fd >= 0;
+}
+
+// Number of arguments of tracepoint `name`, from the prototype of its
+// btf_trace_<name> typedef; -1 if the kernel BTF doesn't have it
+static int tracepoint_nr_args(const struct btf *btf, const char *name)
+{
+	const struct btf_type *type;
+	char type_name[128];
+	int id, n = -1;
+
+	if (!btf)
+		return -1;
+	snprintf(type_name, sizeof(type_name), "btf_trace_%s", name);
+	id = btf__find_by_name_kind(btf, type_name, BTF_KIND_TYPEDEF);
+	if (id > 0 && (type = btf__type_by_id(btf, id)) && (type = btf__type_by_id(btf, type->type)) &&
+		btf_is_ptr(type) && (type = btf__type_by_id(btf, type->type)) && btf_is_func_proto(type))
+		n = btf_vlen(type) - 1; // the first is the tracepoint's own data
+	return n;
+}
+
+// Power of two at or below x
+static unsigned int round_down_pow2(unsigned int x)
+{
+	while (x & (x - 1))
+		x &= x - 1;
+	return x;
+}
+
+// Picks which programs to load and propagates runtime knobs into .rodata,
+// where the verifier treats them as constants and prunes disabled paths.
+// `btf` is the kernel's, for the probes.
+static int configure(struct tracer *t, const struct tracer_opts *opts, const struct btf *btf)
+{
+	struct bootstrap_bpf *skel = t->skel;
+	const unsigned int page_size = sysconf(_SC_PAGESIZE);
+	unsigned int mask = opts->event_mask ? opts->event_mask : ~0u;
+	const struct
+	{
+		struct bpf_program *prog;
+		unsigned int event_class;
+	} classes[] = {
+		{skel->progs.handle__SCHED__SCHED_PROCESS_EXEC, TRACER_EVENTS_PROCESS},
+		{skel->progs.handle__SCHED__SCHED_PROCESS_EXIT, TRACER_EVENTS_PROCESS},
+		{skel->progs.handle__SCHED__PROCESS_SUMMARY, TRACER_EVENTS_PROCESS},
+		{skel->progs.handle__mm_vmscan_direct_reclaim_begin, TRACER_EVENTS_MEMORY},
+		{skel->progs.handle__mm_vmscan_direct_reclaim_end, TRACER_EVENTS_MEMORY},
+		{skel->progs.handle__psi_memstall_enter, TRACER_EVENTS_MEMORY},
+		{skel->progs.handle__psi_memstall_leave, TRACER_EVENTS_MEMORY},
+		{skel->progs.handle__OOM__MARK_VICTIM, TRACER_EVENTS_MEMORY},
+		{skel->progs.handle__SYSCALL__SYS_ENTER_OPENAT, TRACER_EVENTS_FILES},
+		{skel->progs.handle__SYSCALL__OPENAT, TRACER_EVENTS_FILES},
+		{skel->progs.handle__SYSCALL__IO_SUMMARY, TRACER_EVENTS_IO},
+		{skel->progs.handle__sys_exit_read, TRACER_EVENTS_IO},
+		{skel->progs.handle__sys_exit_write, TRACER_EVENTS_IO},
+		{skel->progs.handle__sys_exit_openat, TRACER_EVENTS_IO},
+		{skel->progs.snapshot_tasks, TRACER_EVENTS_PROCESS},
+		{skel->progs.handle__SCHED__SCHED_STATS, TRACER_EVENTS_SCHED},
+		{skel->progs.handle__sched_wakeup, TRACER_EVENTS_SCHED},
+		{skel->progs.handle__sched_wakeup_new, TRACER_EVENTS_SCHED},
+		{skel->progs.handle__sched_switch, TRACER_EVENTS_SCHED},
+		{skel->progs.handle__BLOCK__BLOCK_IO_STATS, TRACER_EVENTS_BLOCK},
+		{skel->progs.handle__block_rq_insert, TRACER_EVENTS_BLOCK},
+		{skel->progs.handle__block_rq_issue, TRACER_EVENTS_BLOCK},
+		{skel->progs.handle__block_rq_complete, TRACER_EVENTS_BLOCK},
+	};
+
+	for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++)
+		if (!(mask & classes[i].event_class))
+			bpf_program__set_autoload(classes[i].prog, false);
+
+	// Summaries replace exit records (and exec records, which just feed them)
+	bpf_program__set_autoload(opts->process_summary ? skel->progs.handle__SCHED__SCHED_PROCESS_EXIT
+													: skel->progs.handle__SCHED__PROCESS_SUMMARY,
+							  false);
+
+	// Fork propagation is only needed to maintain the tracked set
+	if (!opts->filter_tracked)
+		bpf_program__set_autoload(skel->progs.handle__sched_process_fork, false);
+
+	// Opens are traced with one fexit on do_sys_openat2, which sees the
+	// filename and the resulting fd together, or else with the (costlier,
+	// fd-less) sys_enter_openat tracepoint
+	if (mask & TRACER_EVENTS_FILES)
+		bpf_program__set_autoload(kernel_can_trampoline(btf, "do_sys_openat2")
+									  ? skel->progs.handle__SYSCALL__SYS_ENTER_OPENAT
+									  : skel->progs.handle__SYSCALL__OPENAT,
+								  false);
+
+	// PSI memory stalls are only counted where both ends can be traced
+	if (mask & TRACER_EVENTS_MEMORY &&
+		!(kernel_can_trampoline(btf, "psi_memstall_enter") && kernel_can_trampoline(btf, "psi_memstall_leave")))
+	{
+		bpf_program__set_autoload(skel->progs.handle__psi_memstall_enter, false);
+		bpf_program__set_autoload(skel->progs.handle__psi_memstall_leave, false);
+	}
+	if (mask & TRACER_EVENTS_MEMORY)
+		t->pressure_interval_ns =
+			(opts->pressure_interval_ms ? opts->pressure_interval_ms : PRESSURE_INTERVAL_MS) * 1000000ULL;
+
+	// The snapshot iterator is run by tracer_attach() itself. Reading other
+	// processes' command lines needs bpf_copy_from_user_task (5.18+).
+	bool snapshot = opts->snapshot_existing;
+	bpf_program__set_autoattach(skel->progs.snapshot_tasks, false);
+	if (snapshot && !kernel_has_helper(btf, "BPF_FUNC_copy_from_user_task"))
+	{
+		fprintf(stderr, "C: no bpf_copy_from_user_task, not snapshotting running processes\n");
+		snapshot = false;
+	}
+	if (!snapshot)
+		bpf_program__set_autoload(skel->progs.snapshot_tasks, false);
+	t->snapshot = bpf_program__autoload(skel->progs.snapshot_tasks);
+
+	// Summing I/O counters in the kernel needs bpf_map_lookup_percpu_elem
+	// (5.19+). Without it, totals are only available via tracer_io_stats().
+	if (libbpf_probe_bpf_helper(BPF_PROG_TYPE_TRACEPOINT, BPF_FUNC_map_lookup_percpu_elem, NULL) <= 0)
+		bpf_program__set_autoload(skel->progs.handle__SYSCALL__IO_SUMMARY, false);
+
+	// Linux 5.11 dropped the request_queue argument of the request tracepoints
+	if (mask & TRACER_EVENTS_BLOCK)
+		skel->rodata->block_rq_has_queue = tracepoint_nr_args(btf, "block_rq_issue") == 2;
+
+	// The sampling program runs off perf events opened by tracer_attach()
+	bpf_program__set_autoattach(skel->progs.handle__profile_sample, false);
+	t->profile_hz = opts->profile_hz;
+	if (!t->profile_hz)
+	{
+		bpf_program__set_autoload(skel->progs.handle__profile_sample, false);
+		bpf_map__set_max_entries(skel->maps.stack_traces, 1);
+		bpf_map__set_max_entries(skel->maps.profile_counts, 1);
+	}
+
+	// The kernel wants a power-of-two multiple of the page size
+	if (opts->ring_size)
+	{
+		if (opts->ring_size & (opts->ring_size - 1) || opts->ring_size < page_size)
+		{
+			fprintf(stderr, "C: invalid ring size %u\n", opts->ring_size);
+			return -EINVAL;
+		}
+		bpf_map__set_max_entries(skel->maps.rb, opts->ring_size);
+	}
+
+	// Split rings share the default budget of the single one, within reason
+	switch (opts->ring_layout)
+	{
+	case RING_LAYOUT_SHARED:
+		break;
+	case RING_LAYOUT_PER_CPU:
+	case RING_LAYOUT_PER_NODE:
+		t->nr_rings = opts->ring_layout == RING_LAYOUT_PER_CPU ? libbpf_num_possible_cpus() : possible_nodes();
+		if ((int)t->nr_rings <= 0)
+			return -EINVAL;
+		t->ring_size = opts->ring_size ? opts->ring_size : round_down_pow2(SHARED_RING_SIZE / t->nr_rings);
+		if (t->ring_size < MIN_SPLIT_RING_SIZE)
+			t->ring_size = MIN_SPLIT_RING_SIZE;
+		if (t->ring_size < page_size)
+			t->ring_size = page_size;
+		bpf_map__set_max_entries(skel->maps.rings, t->nr_rings);
+		bpf_map__set_max_entries(skel->maps.ring_drops, t->nr_rings);
+		// Nothing is submitted to the shared ring any more
+		bpf_map__set_max_entries(skel->maps.rb, page_size);
+		break;
+	default:
+		fprintf(stderr, "C: invalid ring layout %u\n", opts->ring_layout);
+		return -EINVAL;
+	}
+	// The slot template of `rings` is a ring too, and its declared 4096 bytes
+	// aren't a page on 64 KiB-page kernels, which would fail the load even
+	// with the shared layout
+	bpf_map__set_max_entries(bpf_map__inner_map(skel->maps.rings), t->nr_rings ? t->ring_size : page_size);
+	// The split rings are created by the handle, and would go with it
+	if (opts->pin_path && t->nr_rings)
+	{
+		fprintf(stderr, "C: pinning needs the shared ring layout\n");
+		return -EINVAL;
+	}
+
+	skel->rodata->debug_enabled = opts->debug_bpf;
+	t->clock = CLOCK_MONOTONIC;
+	if (opts->boot_clock && kernel_has_helper(btf, "BPF_FUNC_ktime_get_boot_ns"))
+		t->clock = CLOCK_BOOTTIME;
+	else if (opts->boot_clock)
+		fprintf(stderr, "C: no bpf_ktime_get_boot_ns, stamping records with CLOCK_MONOTONIC\n");
+	skel->rodata->boot_clock = t->clock == CLOCK_BOOTTIME;
+	skel->bss->clock_offset_ns = wall_clock_offset_ns(t->clock);
+	t->last_calibration_ns = monotonic_ns();
+	skel->rodata->filter_tracked = opts->filter_tracked;
+	skel->rodata->nr_cpus = libbpf_num_possible_cpus();
+	skel->rodata->use_bpf_loop = kernel_has_helper(btf, "BPF_FUNC_loop");
+	// A watermark past what a ring holds is never reached: every wakeup
+	// would wait for the poll timeout, and syscalls be shed (at 3/4 full)
+	// first. So it is kept to a quarter of each ring.
+	const __u32 ring_bytes = t->nr_rings ? t->ring_size : bpf_map__max_entries(skel->maps.rb);
+	skel->rodata->wakeup_watermark = opts->wakeup_watermark;
+	if (skel->rodata->wakeup_watermark > ring_bytes / 4)
+		skel->rodata->wakeup_watermark = ring_bytes / 4;
+	if (opts->max_args)
+		skel->rodata->max_args = opts->max_args;
+	if (opts->max_str_len && opts->max_str_len < MAX_STR_LEN)
+		skel->rodata->max_str_len = opts->max_str_len;
+	if (opts->argv_bytes && opts->argv_bytes < MAX_ARGV_BYTES)
+		skel->rodata->argv_bytes = opts->argv_bytes;
+	if (opts->max_path_len && opts->max_path_len < MAX_PATH_LEN)
+		skel->rodata->max_path_len = opts->max_path_len;
+	skel->rodata->ring_layout = opts->ring_layout;
+	skel->rodata->process_summary = opts->process_summary;
+	skel->rodata->short_process_ns = opts->short_process_ms * 1000000ULL;
+	skel->rodata->page_size = page_size;
+	skel->rodata->dedup_filenames = opts->dedup_filenames;
+	skel->rodata->profile_handlers = opts->profile_handlers;
+	t->profiling = opts->profile_handlers;
+	return 0;
+}
+
+// An earlier build pinned `path` with another layout: libbpf would refuse
+// to reuse it, so it goes and loading pins a new map. Returns 0 when it is
+// reusable, gone or absent, or a negative errno.
+static int drop_stale_pin(const struct bpf_map *map, const char *path)
+{
+	struct bpf_map_info info = {};
+	__u32 len = sizeof(info);
+	int fd = bpf_obj_get(path);
+	int err = 0;
+
+	if (fd < 0)
+		return errno == ENOENT ? 0 : -errno;
+	if (bpf_map_get_info_by_fd(fd, &info, &len))
+		err = -errno;
+	else if (info.type != bpf_map__type(map) || info.key_size != bpf_map__key_size(map) ||
+			 info.value_size != bpf_map__value_size(map) ||
+			 info.max_entries != bpf_map__max_entries(map) || info.map_flags != bpf_map__map_flags(map))
+	{
+		fprintf(stderr, "C: replacing %s, pinned with another layout\n", path);
+		if (unlink(path) && errno != ENOENT)
+			err = -errno;
+	}
+	close(fd);
+	return err;
+}
+
+// Points the ring and the state that must outlive the handle at their pins
+// under t->pin_path. Loading then reuses what an earlier handle left there
+// and pins the rest.
+static int set_pin_paths(struct tracer *t)
 {
-	struct lib_ctx lc = {
-		.buffer = buffer,
-		.buf_sz = byte_cnt,
-		.filled = 0,
-		.cb = cb,
-		.cb_ctx = cb_ctx,
-		.skel = NULL,
-		.rb = NULL,
+	struct bootstrap_bpf *skel = t->skel;
+	struct bpf_map *maps[] = {
+		skel->maps.rb,
+		skel->maps.stats,
+		skel->maps.tracked_pids,
+		skel->maps.tracked_cgroups,
+		skel->maps.proc_idents,
+		skel->maps.io_counters,
+		skel->maps.exec_infos,
+		skel->maps.process_aggregates,
+		skel->maps.mem_pressure,
 	};
+	char path[PATH_MAX];
+
+	if (mkdir(t->pin_path, 0700) && errno != EEXIST)
+		return -errno;
+	for (size_t i = 0; i < sizeof(maps) / sizeof(maps[0]); i++)
+	{
+		int err;
+
+		snprintf(path, sizeof(path), "%s/%s", t->pin_path, bpf_map__name(maps[i]));
+		err = drop_stale_pin(maps[i], path);
+		if (!err)
+			err = bpf_map__set_pin_path(maps[i], path);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+// Removes the entries of `dir` whose names start with `prefix`
+static int unlink_pins(const char *dir, const char *prefix)
+{
+	char path[PATH_MAX];
+	struct dirent *d;
+	DIR *dp = opendir(dir);
+	int err = 0;
+
+	if (!dp)
+		return errno == ENOENT ? 0 : -errno;
+	while ((d = readdir(dp)))
+	{
+		if (d->d_name[0] == '.' || strncmp(d->d_name, prefix, strlen(prefix)))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, d->d_name);
+		if (unlink(path) && errno != ENOENT)
+			err = -errno;
+	}
+	closedir(dp);
+	return err;
+}
+
+int tracer_unpin(const char *pin_path)
+{
+	int err = unlink_pins(pin_path, "");
+
+	if (!err && rmdir(pin_path) && errno != ENOENT)
+		err = -errno;
+	return err;
+}
+
+// Pins the links of the programs just attached, replacing those of an
+// earlier handle. Those then detach (their process is gone), so the two
+// sets of programs overlap for a moment rather than leaving a gap.
+static int pin_links(struct tracer *t)
+{
+	const struct bpf_object_skeleton *s = t->skel->skeleton;
+	char path[PATH_MAX];
+	int err = unlink_pins(t->pin_path, "link_");
+
+	for (int i = 0; !err && i < s->prog_cnt; i++)
+	{
+		struct bpf_link *link = *s->progs[i].link;
+
+		if (!link)
+			continue;
+		snprintf(path, sizeof(path), "%s/link_%s", t->pin_path, s->progs[i].name);
+		err = bpf_link__pin(link, path);
+	}
+	return err;
+}
+
+// Opens, configures and loads the skeleton into t->skel
+static int load_skeleton(struct tracer *t, const struct tracer_opts *opts)
+{
+	struct btf *btf;
 	int err;
 
+	t->skel = bootstrap_bpf__open();
+	if (!t->skel)
+	{
+		fprintf(stderr, "C: failed to open skeleton\n");
+		return -errno;
+	}
+
+	// Parsed once for all of configure()'s probes: it takes megabytes
+	btf = btf__load_vmlinux_btf();
+	err = configure(t, opts, btf);
+	btf__free(btf);
+	if (!err && t->pin_path)
+		err = set_pin_paths(t);
+	if (err)
+		return err;
+
+	// Loading runs the verifier: the one-time cost of the handle
+	err = bootstrap_bpf__load(t->skel);
+	if (err)
+		fprintf(stderr, "C: load failed: %d\n", err);
+	return err;
+}
+
+struct tracer *tracer_open(const struct tracer_opts *opts)
+{
+	static const struct tracer_opts defaults;
+	struct epoll_event ev = {.events = EPOLLIN};
+	struct tracer *t;
+	int err;
+
+	if (!opts)
+		opts = &defaults;
+	env.verbose = opts->verbose;
 	libbpf_set_print(libbpf_print_cb);
-	signal(SIGINT, sig_handler);
-	signal(SIGTERM, sig_handler);
 
-	/* ----------------------------------------------------- */
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+	t->epfd = -1;
 
-	lc.skel = bootstrap_bpf__open();
-	if (!lc.skel)
+	if (opts->pin_path && !(t->pin_path = strdup(opts->pin_path)))
 	{
-		fprintf(stderr, "C: failed to open skeleton\n");
-		return 1;
+		err = -ENOMEM;
+		goto fail;
+	}
+	if (opts->spill_path && !(t->spill_path = strdup(opts->spill_path)))
+	{
+		err = -ENOMEM;
+		goto fail;
+	}
+	t->spill_bytes = opts->spill_bytes ? opts->spill_bytes : SPILL_BYTES;
+
+	err = load_skeleton(t, opts);
+	if (err)
+		goto fail;
+
+	// Split rings are created (and start draining) only now, as the outer
+	// map must exist to hold them
+	if (t->nr_rings)
+	{
+		t->rings = ring_set__new(bpf_map__fd(t->skel->maps.rings), t->nr_rings, t->ring_size,
+								 t->clock, t->skel->bss->clock_offset_ns);
+		if (!t->rings)
+		{
+			err = -errno;
+			fprintf(stderr, "C: ring set setup failed: %d\n", err);
+			goto fail;
+		}
+	}
+
+	if (t->profile_hz)
+	{
+		t->profile = stack_profile__new(bpf_map__fd(t->skel->maps.profile_counts),
+										bpf_map__fd(t->skel->maps.stack_traces));
+		if (!t->profile)
+		{
+			err = -errno;
+			fprintf(stderr, "C: stack profile setup failed: %d\n", err);
+			goto fail;
+		}
+	}
+
+	// The ring map fd itself becomes readable when records are committed;
+	// split rings signal through the set's wakeup fd instead
+	t->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (t->epfd < 0 ||
+		epoll_ctl(t->epfd, EPOLL_CTL_ADD,
+				  t->rings ? ring_set__wakeup_fd(t->rings) : bpf_map__fd(t->skel->maps.rb), &ev) < 0)
+	{
+		err = -errno;
+		fprintf(stderr, "C: epoll setup failed: %d\n", err);
+		goto fail;
+	}
+	return t;
+
+fail:
+	tracer_destroy(t);
+	errno = err < 0 ? -err : err;
+	return NULL;
+}
+
+int tracer_set_callback(struct tracer *t, void *buffer, size_t byte_count,
+						const struct batch_opts *batch,
+						event_callback_t cb, void *cb_ctx)
+{
+	reset_consumer(t);
+
+	// Split rings are drained by the set's threads and merged in tracer_poll()
+	if (!t->rings)
+	{
+		t->rb = ring_buffer__new(bpf_map__fd(t->skel->maps.rb), handle_event, t, NULL);
+		if (!t->rb)
+		{
+			fprintf(stderr, "C: ring-buffer create failed\n");
+			return -errno;
+		}
 	}
+	t->buffer = buffer;
+	t->buf_sz = byte_count;
+	t->filled = 0;
+	t->pending = 0;
+	t->batching = batch != NULL;
+	t->batch = batch ? *batch : (struct batch_opts){0};
+	t->cb = cb;
+	t->cb_ctx = cb_ctx;
+	return 0;
+}
 
-	// Propagate runtime knobs into .rodata
-	lc.skel->rodata->debug_enabled = env.debug_bpf;
-	lc.skel->rodata->system_boot_ns = get_system_boot_ns();
+int tracer_set_view_callback(struct tracer *t, event_view_callback_t cb, void *cb_ctx)
+{
+	int err;
 
-	err = bootstrap_bpf__load(lc.skel);
+	reset_consumer(t);
+
+	// With split rings, views point into the merged queues instead
+	err = t->rings ? 0 : ring_view__open(&t->rv, bpf_map__fd(t->skel->maps.rb),
+										 bpf_map__max_entries(t->skel->maps.rb));
 	if (err)
 	{
-		fprintf(stderr, "C: load failed: %d\n", err);
+		fprintf(stderr, "C: ring-buffer mmap failed: %d\n", err);
+		return err;
+	}
+	t->view_cb = cb;
+	t->view_cb_ctx = cb_ctx;
+	return 0;
+}
+
+static void *handoff_thread(void *arg);
+
+struct tracer_handoff *tracer_set_handoff(struct tracer *t, size_t size)
+{
+	struct handoff *h = handoff__new(size);
+	int err;
+
+	if (!h)
+		return NULL;
+	if (t->spill_path)
+	{
+		struct spill *s = spill__new(t->spill_path, t->spill_bytes);
+
+		if (!s)
+		{
+			err = errno;
+			handoff__free(h);
+			errno = err;
+			return NULL;
+		}
+		handoff__set_spill(h, s);
+	}
+	err = tracer_set_view_callback(t, handoff__push, h);
+	if (err)
+	{
+		handoff__free(h);
+		errno = -err;
+		return NULL;
+	}
+	t->handoff = h;
+	if (t->attached)
+	{
+		err = handoff__start(h, handoff_thread, t);
+		if (err)
+		{
+			reset_consumer(t);
+			errno = -err;
+			return NULL;
+		}
+	}
+	return handoff__ring(h);
+}
+
+// Hands the zero-copy consumer every view, waiting for it to take them all
+static void deliver_all_views(struct tracer *t, size_t n)
+{
+	for (size_t done = 0; done < n;)
+	{
+		size_t acked = deliver_views(t, t->views + done, n - done);
+
+		if (!acked)
+		{
+			struct timespec backoff = {0, ZERO_COPY_BACKOFF_NS};
+			nanosleep(&backoff, NULL);
+		}
+		done += acked;
+	}
+}
+
+// Delivers the complete records at the start of `buf` to the consumer, as
+// though they had come from the ring. Returns the bytes they span.
+static size_t deliver_records(struct tracer *t, char *buf, size_t size, int *count)
+{
+	size_t pos = 0, nviews = 0;
+	struct event_header hdr;
+
+	while (size - pos >= sizeof(hdr))
+	{
+		memcpy(&hdr, buf + pos, sizeof(hdr));
+		if (hdr.len < sizeof(hdr) || hdr.len > sizeof(struct event))
+		{
+			fprintf(stderr, "C: malformed record (%u bytes)\n", hdr.len);
+			pos = size;
+			break;
+		}
+		if (hdr.len > size - pos)
+			break;
+
+		if (t->view_cb)
+		{
+			t->views[nviews++] = (struct event_view){.data = buf + pos, .size = hdr.len};
+			if (nviews == MAX_VIEWS)
+			{
+				deliver_all_views(t, nviews);
+				nviews = 0;
+			}
+		}
+		else
+			handle_event(t, buf + pos, hdr.len);
+		pos += hdr.len;
+		(*count)++;
+	}
+	if (nviews)
+		deliver_all_views(t, nviews);
+	return pos;
+}
+
+// Runs the task iterator, whose output is a stream of snapshot records
+// (records may straddle reads), and delivers them. Returns their number.
+static int deliver_snapshot(struct tracer *t)
+{
+	struct bpf_link *link;
+	size_t filled = 0;
+	int fd, n = 0, err = 0;
+	char *buf;
+
+	if (!t->cb && !t->view_cb)
+		return 0;
+	buf = malloc(SNAPSHOT_READ_SIZE);
+	if (!buf)
+		return -ENOMEM;
+	link = bpf_program__attach_iter(t->skel->progs.snapshot_tasks, NULL);
+	if (!link)
+	{
+		err = -errno;
 		goto out;
 	}
-	err = bootstrap_bpf__attach(lc.skel);
+	fd = bpf_iter_create(bpf_link__fd(link));
+	if (fd < 0)
+	{
+		err = -errno;
+		goto out_link;
+	}
+
+	for (;;)
+	{
+		ssize_t got = read(fd, buf + filled, SNAPSHOT_READ_SIZE - filled);
+
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got < 0)
+		{
+			err = -errno;
+			break;
+		}
+		filled += got;
+		size_t used = deliver_records(t, buf, filled, &n);
+		memmove(buf, buf + used, filled - used);
+		filled -= used;
+		if (!got)
+			break;
+	}
+	if (t->cb)
+		flush(t);
+	close(fd);
+out_link:
+	bpf_link__destroy(link);
+out:
+	free(buf);
+	return err ? err : n;
+}
+
+int tracer_attach(struct tracer *t)
+{
+	int err;
+
+	if (t->attached)
+		return 0;
+	err = bootstrap_bpf__attach(t->skel);
 	if (err)
 	{
 		fprintf(stderr, "C: attach failed: %d\n", err);
-		goto out;
+		return err;
+	}
+	if (t->pin_path)
+	{
+		err = pin_links(t);
+		if (err)
+		{
+			fprintf(stderr, "C: pinning links failed: %d\n", err);
+			bootstrap_bpf__detach(t->skel);
+			return err;
+		}
+	}
+	// Perf events can't be pinned: a restarted handle resumes sampling here
+	if (t->profile)
+	{
+		err = stack_profile__attach(t->profile, t->skel->progs.handle__profile_sample, t->profile_hz);
+		if (err)
+		{
+			fprintf(stderr, "C: stack sampling failed: %d\n", err);
+			bootstrap_bpf__detach(t->skel);
+			return err;
+		}
 	}
+	t->attached = true;
+	t->last_pressure_ns = monotonic_ns();
 
-	lc.rb = ring_buffer__new(
-		bpf_map__fd(lc.skel->maps.rb),
-		handle_event, &lc, NULL);
-	if (!lc.rb)
+	// From here on the thread does all the polling, the snapshot included
+	if (t->handoff)
 	{
-		fprintf(stderr, "C: ring-buffer create failed\n");
-		err = -1;
-		goto out;
+		err = handoff__start(t->handoff, handoff_thread, t);
+		if (err)
+		{
+			fprintf(stderr, "C: handoff thread failed: %d\n", err);
+			if (t->profile)
+				stack_profile__detach(t->profile);
+			bootstrap_bpf__detach(t->skel);
+			t->attached = false;
+		}
+		return err;
+	}
+
+	// Taken after attaching, so a process is either in the snapshot or
+	// exec'd later (or both); a failure only costs the snapshot
+	if (t->snapshot)
+	{
+		int n = deliver_snapshot(t);
+		if (n < 0)
+			fprintf(stderr, "C: process snapshot failed: %d\n", n);
+	}
+	return 0;
+}
+
+// Drains the per-process memory-pressure counters accumulated since the last
+// drain into one EVENT__VMSCAN__MEMORY_PRESSURE record per process, and
+// delivers them like ring records. Returns their number.
+static int deliver_pressure(struct tracer *t, u64 now)
+{
+	const struct bpf_map *map = t->skel->maps.mem_pressure;
+	int ncpus = libbpf_num_possible_cpus();
+	struct mem_pressure *percpu;
+	struct __attribute__((packed))
+	{
+		struct event_header header;
+		struct vmscan__memory_pressure__payload payload;
+	} rec = {
+		.header = {
+			.event_type = EVENT__VMSCAN__MEMORY_PRESSURE,
+			.layout = EVENT_LAYOUT_HASH,
+			.len = sizeof(rec),
+			.timestamp_ns = clock_ns(t->clock) + t->skel->bss->clock_offset_ns,
+		},
+	};
+	u64 upid;
+	int n = 0, err = 0;
+
+	if (ncpus < 0)
+		return ncpus;
+	percpu = calloc(ncpus, sizeof(*percpu));
+	if (!percpu)
+		return -ENOMEM;
+
+	// As in tracer_drain_process_aggregates(): bounded, since handlers keep
+	// adding entries meanwhile
+	for (unsigned int i = 0; i < bpf_map__max_entries(map); i++)
+	{
+		if (bpf_map__get_next_key(map, NULL, &upid, sizeof(upid)))
+		{
+			if (errno != ENOENT)
+				err = -errno;
+			break;
+		}
+		if (bpf_map__lookup_and_delete_elem(map, &upid, sizeof(upid), percpu,
+											ncpus * sizeof(*percpu), 0))
+		{
+			if (errno == ENOENT)
+				continue;
+			err = -errno;
+			break;
+		}
+
+		memset(&rec.payload, 0, sizeof(rec.payload));
+		rec.payload.interval_ns = now - t->last_pressure_ns;
+		rec.header.upid = upid;
+		for (int cpu = 0; cpu < ncpus; cpu++)
+		{
+			const struct mem_pressure *p = &percpu[cpu];
+
+			// Only the CPU that created the entry has the ids
+			if (p->pid)
+			{
+				rec.header.pid = p->pid;
+				rec.header.ppid = p->ppid;
+				rec.header.uppid = p->uppid;
+			}
+			rec.payload.reclaim_count += p->counts.reclaim_count;
+			rec.payload.reclaim_ns += p->counts.reclaim_ns;
+			rec.payload.reclaimed_pages += p->counts.reclaimed_pages;
+			rec.payload.memstall_count += p->counts.memstall_count;
+			rec.payload.memstall_ns += p->counts.memstall_ns;
+		}
+		deliver_records(t, (char *)&rec, sizeof(rec), &n);
+	}
+	if (t->cb)
+		flush(t);
+	free(percpu);
+	return err ? err : n;
+}
+
+// Delivers memory-pressure summaries once their interval is over. Returns
+// the poll timeout capped to the time left until the next ones are due.
+static int poll_pressure(struct tracer *t, int timeout_ms)
+{
+	u64 now = monotonic_ns();
+
+	if (!t->pressure_interval_ns || !t->attached || (!t->cb && !t->view_cb))
+		return timeout_ms;
+	if (now - t->last_pressure_ns >= t->pressure_interval_ns)
+	{
+		int n = deliver_pressure(t, now);
+		if (n < 0)
+			fprintf(stderr, "C: memory pressure drain failed: %d\n", n);
+		t->last_pressure_ns = now;
+	}
+
+	u64 left_ms = (t->last_pressure_ns + t->pressure_interval_ns - now + 999999) / 1000000;
+	if (timeout_ms < 0 || (u64)timeout_ms > left_ms)
+		timeout_ms = left_ms;
+	return timeout_ms;
+}
+
+// The zero-copy consumer took none of the views it was offered, being stuck
+// or holding back: the poll ends, after a pause (cut to the poll's timeout)
+// so that callers polling in a loop don't spin on the same views
+static void view_backoff(int timeout_ms)
+{
+	struct timespec backoff = {0, ZERO_COPY_BACKOFF_NS};
+
+	if (!timeout_ms)
+		return;
+	if (timeout_ms > 0 && timeout_ms * 1000000ULL < ZERO_COPY_BACKOFF_NS)
+		backoff.tv_nsec = timeout_ms * 1000000L;
+	nanosleep(&backoff, NULL);
+}
+
+// Delivers whatever views are available; returns how many were acknowledged
+static int poll_views(struct tracer *t, int timeout_ms)
+{
+	struct epoll_event ev;
+	size_t n, done;
+
+	n = ring_view__peek(&t->rv, t->views, t->ends, MAX_VIEWS);
+	if (!n && timeout_ms != 0)
+	{
+		if (epoll_wait(t->epfd, &ev, 1, timeout_ms) < 0)
+			return errno == EINTR ? 0 : -errno;
+		n = ring_view__peek(&t->rv, t->views, t->ends, MAX_VIEWS);
+	}
+	if (!n)
+		return 0;
+
+	done = deliver_views(t, t->views, n);
+	if (done)
+		ring_view__ack(&t->rv, t->ends[done - 1]);
+	else
+		view_backoff(timeout_ms);
+	return done;
+}
+
+// Merges the split rings' queues and delivers the result to either consumer
+static int poll_rings(struct tracer *t, int timeout_ms)
+{
+	const int backoff_ms = timeout_ms;
+	unsigned long long wait_ns;
+	struct epoll_event ev;
+	size_t n, done = 0;
+
+	if (!t->cb && !t->view_cb)
+		return -EINVAL;
+
+	for (;;)
+	{
+		u64 start = t->profiling ? monotonic_ns() : 0;
+
+		n = ring_set__peek(t->rings, t->views, t->view_rings, t->ends, MAX_VIEWS, &wait_ns);
+		if (t->profiling && n)
+			add_timing(t, TRACER_TIMING_MERGE, start);
+		if (!n && !done && timeout_ms != 0)
+		{
+			// Sleep until a queue is refilled, or at most until records held
+			// back by the merge slack (or a pending batch) come due
+			int wait_ms = t->cb ? flush_pass(t, timeout_ms) : timeout_ms;
+			if (wait_ns && (wait_ms < 0 || wait_ns / 1000000 < (unsigned long long)wait_ms))
+				wait_ms = (wait_ns + 999999) / 1000000;
+			if (epoll_wait(t->epfd, &ev, 1, wait_ms) < 0 && errno != EINTR)
+				return -errno;
+			ring_set__clear_wakeup(t->rings);
+			timeout_ms = 0;
+			continue;
+		}
+		if (!n)
+			break;
+
+		size_t acked = n;
+		if (t->view_cb)
+			acked = deliver_views(t, t->views, n);
+		else
+		{
+			for (size_t i = 0; i < n; i++)
+				handle_event(t, (void *)t->views[i].data, t->views[i].size);
+		}
+		ring_set__ack(t->rings, t->view_rings, t->ends, acked);
+		done += acked;
+
+		// Like ring_buffer__poll(), the copying consumer drains everything
+		// available; views are handed out one batch per call
+		if (t->view_cb && !acked)
+			view_backoff(backoff_ms);
+		if (t->view_cb || n < MAX_VIEWS)
+			break;
 	}
+	if (t->cb)
+		flush_pass(t, 0);
+	return done;
+}
+
+// Follows adjustments of the wall clock (NTP, PTP) by re-measuring its offset
+// to the record clock now and then. Records stamped in the kernel pick the new
+// offset up at once.
+static void recalibrate(struct tracer *t)
+{
+	u64 now = monotonic_ns();
+	u64 offset;
+
+	if (now - t->last_calibration_ns < RECALIBRATION_INTERVAL_NS)
+		return;
+	offset = wall_clock_offset_ns(t->clock);
+	t->skel->bss->clock_offset_ns = offset;
+	if (t->rings)
+		ring_set__set_clock_offset(t->rings, offset);
+	t->last_calibration_ns = now;
+}
+
+static int poll_once(struct tracer *t, int timeout_ms)
+{
+	int err;
 
-	/* ----------------------------------------------------- */
+	recalibrate(t);
+	timeout_ms = poll_pressure(t, timeout_ms);
+	if (t->rings)
+		return poll_rings(t, timeout_ms);
+	if (t->view_cb)
+		return poll_views(t, timeout_ms);
+	if (!t->rb)
+		return -EINVAL;
 
-	while (!exiting)
+	// Never sleep past the batch latency bound
+	err = ring_buffer__poll(t->rb, flush_pass(t, timeout_ms));
+	if (err == -EINTR)
+		err = 0;
+	if (err < 0)
 	{
-		err = ring_buffer__poll(lc.rb, 200 /* timeout, ms */);
-		if (err == -EINTR)
-			err = 0;
+		fprintf(stderr, "C: poll error %d\n", err);
+		return err;
+	}
+	// Records submitted without a wakeup never make the fd readable
+	if (err == 0)
+		err = ring_buffer__consume(t->rb);
+	if (err < 0)
+		return err;
+	flush_pass(t, 0);
+	return err;
+}
+
+int tracer_poll(struct tracer *t, int timeout_ms)
+{
+	if (t->handoff)
+		return -EBUSY;
+	return poll_once(t, timeout_ms);
+}
+
+// Polls on behalf of the handoff consumer from tracer_attach() to tracer_stop()
+static void *handoff_thread(void *arg)
+{
+	struct tracer *t = arg;
+
+	if (t->snapshot)
+	{
+		int n = deliver_snapshot(t);
+		if (n < 0)
+			fprintf(stderr, "C: process snapshot failed: %d\n", n);
+	}
+	while (!handoff__stopping(t->handoff))
+	{
+		// Spilled records go back into the ring as soon as there is room
+		int timeout_ms = handoff__refill(t->handoff) ? HANDOFF_POLL_MS : HANDOFF_REFILL_MS;
+		int err = poll_once(t, timeout_ms);
 		if (err < 0)
 		{
-			fprintf(stderr, "C: poll error %d\n", err);
+			fprintf(stderr, "C: handoff poll failed: %d\n", err);
 			break;
 		}
 	}
+	return NULL;
+}
 
+int tracer_track_pid(struct tracer *t, unsigned int pid)
+{
+	__u32 key = pid;
+
+	if (bpf_map__update_elem(t->skel->maps.tracked_pids, &key, sizeof(key), &key, sizeof(key), BPF_ANY))
+		return -errno;
+	return 0;
+}
+
+int tracer_untrack_pid(struct tracer *t, unsigned int pid)
+{
+	__u32 key = pid;
+
+	if (bpf_map__delete_elem(t->skel->maps.tracked_pids, &key, sizeof(key), 0) && errno != ENOENT)
+		return -errno;
+	return 0;
+}
+
+int tracer_track_cgroup(struct tracer *t, unsigned long long cgroup_id)
+{
+	__u64 key = cgroup_id;
+	__u8 one = 1;
+
+	if (bpf_map__update_elem(t->skel->maps.tracked_cgroups, &key, sizeof(key), &one, sizeof(one), BPF_ANY))
+		return -errno;
+	return 0;
+}
+
+// Inverse of enum event_slot, for callers that only know the event type
+static const enum event_type slot_types[EVENT_SLOT_COUNT] = {
+#define SLOT_TYPE(name, value, payload, extent, label) [SLOT__##name] = EVENT__##name,
+	EVENT_HANDLED(SLOT_TYPE)
+#undef SLOT_TYPE
+};
+
+static __u32 slot_of(unsigned int event_type)
+{
+	__u32 slot;
+
+	for (slot = 0; slot < EVENT_SLOT_COUNT; slot++)
+		if (slot_types[slot] == event_type)
+			break;
+	return slot;
+}
+
+int tracer_event_stats(const struct tracer *t, unsigned int event_type, struct event_stats *out)
+{
+	int ncpus = libbpf_num_possible_cpus();
+	struct event_stats *percpu;
+	__u32 slot = slot_of(event_type);
+	int err = 0;
+
+	if (slot == EVENT_SLOT_COUNT)
+		return -ENOENT;
+	if (ncpus < 0)
+		return ncpus;
+
+	// Per-CPU values come back as one (8-byte aligned) value per possible CPU
+	percpu = calloc(ncpus, sizeof(*percpu));
+	if (!percpu)
+		return -ENOMEM;
+	if (bpf_map__lookup_elem(t->skel->maps.stats, &slot, sizeof(slot),
+							 percpu, ncpus * sizeof(*percpu), 0))
+	{
+		err = -errno;
+		goto out;
+	}
+
+	memset(out, 0, sizeof(*out));
+	for (int cpu = 0; cpu < ncpus; cpu++)
+	{
+		out->seen += percpu[cpu].seen;
+		out->emitted += percpu[cpu].emitted;
+		out->dropped += percpu[cpu].dropped;
+		out->shed += percpu[cpu].shed;
+	}
+out:
+	free(percpu);
+	return err;
+}
+
+int tracer_spill_stats(const struct tracer *t, struct spill_stats *out)
+{
+	if (!t->handoff || !handoff__spill(t->handoff))
+		return -ENOENT;
+	spill__stats(handoff__spill(t->handoff), out);
+	return 0;
+}
+
+int tracer_handler_latency(struct tracer *t, unsigned int event_type, struct latency_hist *out,
+						   bool reset)
+{
+	int ncpus = libbpf_num_possible_cpus();
+	struct latency_hist *percpu;
+	__u32 slot = slot_of(event_type);
+	int err = 0;
+
+	if (slot == EVENT_SLOT_COUNT)
+		return -ENOENT;
+	if (!t->profiling)
+		return -EOPNOTSUPP;
+	if (ncpus < 0)
+		return ncpus;
+
+	percpu = calloc(ncpus, sizeof(*percpu));
+	if (!percpu)
+		return -ENOMEM;
+	if (bpf_map__lookup_elem(t->skel->maps.handler_latency, &slot, sizeof(slot),
+							 percpu, ncpus * sizeof(*percpu), 0))
+	{
+		err = -errno;
+		goto out;
+	}
+
+	memset(out, 0, sizeof(*out));
+	for (int cpu = 0; cpu < ncpus; cpu++)
+		for (int b = 0; b < LATENCY_BUCKETS; b++)
+			out->buckets[b] += percpu[cpu].buckets[b];
+
+	if (reset)
+	{
+		memset(percpu, 0, ncpus * sizeof(*percpu));
+		if (bpf_map__update_elem(t->skel->maps.handler_latency, &slot, sizeof(slot),
+								 percpu, ncpus * sizeof(*percpu), 0))
+			err = -errno;
+	}
 out:
-	ring_buffer__free(lc.rb);
-	bootstrap_bpf__destroy(lc.skel);
-	return err < 0 ? -err : 0;
-}
\ No newline at end of file
+	free(percpu);
+	return err;
+}
+
+int tracer_consumer_latency(struct tracer *t, unsigned int timing, struct latency_hist *out,
+							bool reset)
+{
+	if (timing >= TRACER_TIMING_COUNT)
+		return -ENOENT;
+	if (!t->profiling)
+		return -EOPNOTSUPP;
+
+	*out = t->timing[timing];
+	if (reset)
+		memset(&t->timing[timing], 0, sizeof(t->timing[timing]));
+	return 0;
+}
+
+int tracer_io_stats(const struct tracer *t, unsigned long long upid, struct syscall__io_summary__payload *out)
+{
+	int ncpus = libbpf_num_possible_cpus();
+	struct syscall__io_summary__payload *percpu;
+	__u64 key = upid;
+	int err = 0;
+
+	if (ncpus < 0)
+		return ncpus;
+	percpu = calloc(ncpus, sizeof(*percpu));
+	if (!percpu)
+		return -ENOMEM;
+	if (bpf_map__lookup_elem(t->skel->maps.io_counters, &key, sizeof(key),
+							 percpu, ncpus * sizeof(*percpu), 0))
+	{
+		err = -errno;
+		goto out;
+	}
+
+	memset(out, 0, sizeof(*out));
+	for (int cpu = 0; cpu < ncpus; cpu++)
+	{
+		out->read_calls += percpu[cpu].read_calls;
+		out->read_bytes += percpu[cpu].read_bytes;
+		out->write_calls += percpu[cpu].write_calls;
+		out->write_bytes += percpu[cpu].write_bytes;
+		out->openat_calls += percpu[cpu].openat_calls;
+		out->openat_failures += percpu[cpu].openat_failures;
+	}
+out:
+	free(percpu);
+	return err;
+}
+
+int tracer_profile_read(struct tracer *t, unsigned long long upid, profile_stack_callback_t cb, void *cb_ctx)
+{
+	if (!t->profile)
+		return -EOPNOTSUPP;
+	return stack_profile__read(t->profile, upid, cb, cb_ctx);
+}
+
+int tracer_drain_process_aggregates(struct tracer *t, process_aggregate_callback_t cb, void *cb_ctx)
+{
+	const struct bpf_map *map = t->skel->maps.process_aggregates;
+	int ncpus = libbpf_num_possible_cpus();
+	struct process_aggregate *percpu, sum;
+	struct process_aggregate_key key;
+	int n = 0, err = 0;
+
+	if (ncpus < 0)
+		return ncpus;
+	percpu = calloc(ncpus, sizeof(*percpu));
+	if (!percpu)
+		return -ENOMEM;
+
+	// Always take the first key: deleting makes iterating from it restart
+	// anyway. Bounded, as exits keep adding entries meanwhile.
+	for (unsigned int i = 0; i < bpf_map__max_entries(map); i++)
+	{
+		if (bpf_map__get_next_key(map, NULL, &key, sizeof(key)))
+		{
+			if (errno != ENOENT)
+				err = -errno;
+			break;
+		}
+		if (bpf_map__lookup_and_delete_elem(map, &key, sizeof(key), percpu,
+											ncpus * sizeof(*percpu), 0))
+		{
+			if (errno == ENOENT)
+				continue; // evicted meanwhile
+			err = -errno;
+			break;
+		}
+
+		memset(&sum, 0, sizeof(sum));
+		for (int cpu = 0; cpu < ncpus; cpu++)
+		{
+			sum.count += percpu[cpu].count;
+			sum.failures += percpu[cpu].failures;
+			sum.runtime_ns += percpu[cpu].runtime_ns;
+			sum.cpu_ns += percpu[cpu].cpu_ns;
+			if (percpu[cpu].max_rss_kb > sum.max_rss_kb)
+				sum.max_rss_kb = percpu[cpu].max_rss_kb;
+		}
+		cb(cb_ctx, key.comm, &sum);
+		n++;
+	}
+	free(percpu);
+	return err ? err : n;
+}
+
+// Interns one string, hashing it here
+static u32 intern_str(struct tracer *t, const char *s, size_t len, size_t *added)
+{
+	bool is_new;
+	u32 id = string_table__intern(t->strings, s, len, string_hash(s, len), &is_new);
+
+	if (is_new)
+		(*added)++;
+	return id;
+}
+
+int tracer_intern_strings(struct tracer *t, const void *record, size_t size,
+						  unsigned int *ids, size_t max_ids, size_t *added)
+{
+	const struct event *e = record;
+	const char *p, *end = (const char *)record + size;
+	size_t n = 0, new_ids = 0;
+	u32 argc;
+
+	if (size < sizeof(e->header) || e->header.len != size || size > sizeof(*e) ||
+		e->header.layout != EVENT_LAYOUT_HASH)
+		return -EINVAL;
+	if (!t->strings)
+	{
+		t->strings = string_table__new();
+		if (!t->strings)
+			return -ENOMEM;
+	}
+	else if (string_table__bytes(t->strings) > MAX_STRING_TABLE_BYTES)
+	{
+		// Every hash the kernel skips sending now has to be sent again
+		string_table__clear(t->strings);
+		t->skel->bss->filename_generation++;
+	}
+
+	switch (e->header.event_type)
+	{
+	case EVENT__SCHED__SCHED_PROCESS_EXEC:
+	case EVENT__SCHED__PROCESS_SNAPSHOT: // in the exec layout
+		p = e->sched__sched_process_exec__payload.argv;
+		argc = e->sched__sched_process_exec__payload.argc;
+		for (; n < argc && p < end; n++)
+		{
+			size_t len = strnlen(p, end - p);
+
+			if (n < max_ids)
+				ids[n] = intern_str(t, p, len, &new_ids);
+			p += len + 1;
+		}
+		break;
+	case EVENT__SCHED__PROCESS_SUMMARY:
+		p = e->sched__process_summary__payload.filename;
+		if (p >= end)
+			break;
+		if (max_ids)
+			ids[0] = intern_str(t, p, strnlen(p, end - p), &new_ids);
+		n = 1;
+		break;
+	case EVENT__SYSCALL__SYS_ENTER_OPENAT:
+	case EVENT__SYSCALL__OPENAT:
+		p = e->syscall__sys_enter_openat__payload.filename;
+		if (p >= end)
+			break;
+		if (max_ids)
+		{
+			u64 hash = e->syscall__sys_enter_openat__payload.filename_hash;
+
+			if (e->syscall__sys_enter_openat__payload.filename_flags & OPENAT_FILENAME_REPEATED)
+			{
+				ids[0] = string_table__find(t->strings, hash);
+			}
+			else
+			{
+				// The kernel hashed it already when deduplicating
+				size_t len = strnlen(p, end - p);
+				bool is_new;
+
+				if (!hash)
+					hash = string_hash(p, len);
+				ids[0] = string_table__intern(t->strings, p, len, hash, &is_new);
+				new_ids += is_new;
+			}
+		}
+		n = 1;
+		break;
+	default:
+		break; // no strings
+	}
+
+	if (added)
+		*added = new_ids;
+	return n;
+}
+
+const char *tracer_string(const struct tracer *t, unsigned int id, size_t *len)
+{
+	return t->strings ? string_table__get(t->strings, id, len) : NULL;
+}
+
+unsigned long long tracer_system_boot_ns(const struct tracer *t)
+{
+	return t->skel->bss->clock_offset_ns;
+}
+
+int tracer_epoll_fd(const struct tracer *t)
+{
+	return t->epfd;
+}
+
+// Stops delivery and detaches. Pinned links survive the detach unless
+// `unpin`, and keep the programs running for the next handle.
+static void detach(struct tracer *t, bool unpin)
+{
+	if (t->handoff)
+		handoff__stop(t->handoff);
+	if (t->attached && unpin && t->pin_path)
+		unlink_pins(t->pin_path, "link_");
+	if (t->attached && t->profile)
+		stack_profile__detach(t->profile);
+	if (t->attached)
+		bootstrap_bpf__detach(t->skel);
+	t->attached = false;
+	if (t->cb)
+		flush(t);
+}
+
+void tracer_stop(struct tracer *t)
+{
+	detach(t, true);
+}
+
+void tracer_destroy(struct tracer *t)
+{
+	if (!t)
+		return;
+	detach(t, false);
+	reset_consumer(t);
+	ring_set__free(t->rings);
+	stack_profile__free(t->profile);
+	string_table__free(t->strings);
+	if (t->epfd >= 0)
+		close(t->epfd);
+	bootstrap_bpf__destroy(t->skel);
+	free(t->pin_path);
+	free(t->spill_path);
+	free(t);
+}
+
+/* -------------------------------------------------------------------------- */
+/* Legacy blocking entry points                                               */
+/* -------------------------------------------------------------------------- */
+
+// Attaches and polls until SIGINT/SIGTERM or an error, then tears down
+static int run_until_signal(struct tracer *t, int err)
+{
+	if (!err)
+	{
+		signal(SIGINT, sig_handler);
+		signal(SIGTERM, sig_handler);
+		err = tracer_attach(t);
+	}
+	while (!err && !exiting)
+	{
+		int n = tracer_poll(t, POLL_TIMEOUT_MS);
+		if (n < 0)
+			err = n;
+	}
+	tracer_destroy(t);
+	return err < 0 ? -err : err;
+}
+
+int initialize(void *buffer, size_t byte_cnt,
+			   event_callback_t cb, void *cb_ctx)
+{
+	return initialize_batched(buffer, byte_cnt, NULL, cb, cb_ctx);
+}
+
+int initialize_batched(void *buffer, size_t byte_cnt,
+					   const struct batch_opts *batch,
+					   event_callback_t cb, void *cb_ctx)
+{
+	struct tracer *t = tracer_open(NULL);
+
+	if (!t)
+		return errno ? errno : 1;
+	return run_until_signal(t, tracer_set_callback(t, buffer, byte_cnt, batch, cb, cb_ctx));
+}
+
+int initialize_zero_copy(event_view_callback_t cb, void *cb_ctx)
+{
+	struct tracer *t = tracer_open(NULL);
+
+	if (!t)
+		return errno ? errno : 1;
+	return run_until_signal(t, tracer_set_view_callback(t, cb, cb_ctx));
+}
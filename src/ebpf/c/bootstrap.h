@@ -3,35 +3,84 @@
 #define BOOTSTRAP_H
 
 #define TASK_COMM_LEN 16
-#define MAX_ARR_LEN 16
 #define MAX_STR_LEN 128
+// Bytes of arguments kept per exec, at most. The staging scratch holds a
+// whole struct event, and per-CPU map values are limited to 32 KiB.
+#define MAX_ARGV_BYTES (28 * 1024)
+#define ARGV_CHUNK 4096    // bytes copied per read of the argument area
+#define MAX_PATH_LEN 4096  // bytes kept per openat filename (PATH_MAX)
 
 typedef unsigned long long u64;
 typedef unsigned int u32;
+typedef unsigned short u16;
+
+#include "event_schema.h"
 
 enum event_type
 {
-    EVENT__SCHED__SCHED_PROCESS_EXEC = 0,
-    EVENT__SCHED__SCHED_PROCESS_EXIT = 1,
-    EVENT__SCHED__PSI_MEMSTALL_ENTER = 16,
+#define EVENT_TYPE_ENUM(name, value, payload, extent, label) EVENT__##name = value,
+    EVENT_SCHEMA(EVENT_TYPE_ENUM)
+#undef EVENT_TYPE_ENUM
+};
 
-    EVENT__SYSCALL__SYS_ENTER_OPENAT = 1024,
-    EVENT__SYSCALL__SYS_EXIT_OPENAT = 1025,
-    EVENT__SYSCALL__SYS_ENTER_READ = 1026,
-    EVENT__SYSCALL__SYS_EXIT_READ = 1027,
-    EVENT__SYSCALL__SYS_ENTER_WRITE = 1028,
-    EVENT__SYSCALL__SYS_EXIT_WRITE = 1029,
+/* Dense index of each event type into the stats map */
+enum event_slot
+{
+#define EVENT_SLOT_ENUM(name, value, payload, extent, label) SLOT__##name,
+    EVENT_HANDLED(EVENT_SLOT_ENUM)
+#undef EVENT_SLOT_ENUM
+    EVENT_SLOT_COUNT
+};
 
-    EVENT__VMSCAN__MM_VMSCAN_DIRECT_RECLAIM_BEGIN = 2048,
+/* Which ring a handler submits to (tracer_opts.ring_layout) */
+enum ring_layout
+{
+    RING_LAYOUT_SHARED = 0,   // the single `rb` ring, for every CPU
+    RING_LAYOUT_PER_CPU = 1,  // `rings[cpu]`
+    RING_LAYOUT_PER_NODE = 2, // `rings[numa node]`
+};
 
-    EVENT__OOM__MARK_VICTIM = 3072
+/* Per-event-type delivery counters, kept per CPU by the BPF program */
+struct event_stats
+{
+    u64 seen;    // handler invocations that passed the pid/thread filters
+    u64 emitted; // records committed to the ring
+    u64 dropped; // records lost because the ring was full
+    u64 shed;    // low-priority records skipped to protect the ring
 };
 
+/* Counters of a handoff's on-disk overflow (tracer_opts.spill_path) */
+struct spill_stats
+{
+    u64 spilled;      // records written to disk while the handoff ring was full
+    u64 replayed;     // records moved back into the ring since
+    u64 dropped;      // records lost because the disk budget was used up too
+    u64 queued_bytes; // bytes on disk still to be replayed
+};
+
+#define EXEC_ARGV_TRUNCATED 1 // arguments were left out, past tracer_opts.argv_bytes or max_args
+
 struct sched__sched_process_exec__payload
 {
     char comm[TASK_COMM_LEN];
     u32 argc;
-    char argv[MAX_ARR_LEN][MAX_STR_LEN];
+    u32 argv_len;               // bytes of argv actually used
+    u32 flags;                  // EXEC_*
+    u32 reserved;
+    u64 start_ns;               // fork time of the process; same clock as timestamp_ns
+    char argv[MAX_ARGV_BYTES]; // argc NUL-terminated strings, back to back
+};
+
+/*
+ * Run-time histogram of one handler (tracer_opts.profile_handlers) or
+ * consumer stage: bucket i counts runs of [2^i, 2^(i+1)) ns, bucket 0 also
+ * those under a nanosecond, and the last bucket everything longer.
+ */
+#define LATENCY_BUCKETS 32
+
+struct latency_hist
+{
+    u64 buckets[LATENCY_BUCKETS];
 };
 
 struct sched__sched_process_exit__payload
@@ -39,12 +88,108 @@ struct sched__sched_process_exit__payload
     int status; // the status (see exit(3))
 };
 
+#define PROCESS_SUMMARY_EXECED 1 // start_ns and filename come from an exec seen by the tracer
+
+/* Whole lifetime of a process, sent at exit instead of separate exec/exit records */
+struct sched__process_summary__payload
+{
+    u64 start_ns;    // exec (or, without PROCESS_SUMMARY_EXECED, fork) time; same clock as timestamp_ns
+    u64 cpu_ns;      // on-CPU time of all threads that have exited so far, leader included
+    u64 utime_ns;    // ...split into user and system time (tick-sampled)
+    u64 stime_ns;
+    u64 max_rss_kb;  // peak resident set size of the process
+    int status;      // as in sched__sched_process_exit__payload
+    u32 flags;       // PROCESS_SUMMARY_*
+    char comm[TASK_COMM_LEN];
+    char filename[MAX_STR_LEN]; // binary exec'd; last, so the record can stop at the NUL
+};
+
+/*
+ * Scheduling of a process's threads over its lifetime, aggregated in the
+ * kernel from sched_wakeup/sched_switch and sent at exit, next to the exit
+ * (or summary) record. A thread waits on the run queue from its wakeup, or
+ * from being preempted, until it is switched in.
+ */
+struct sched__sched_stats__payload
+{
+    u64 oncpu_ns;                   // time the threads ran
+    u64 runq_ns;                    // time they were runnable, waiting for a CPU
+    u64 preemptions;                // switches out while still runnable (involuntary)
+    u64 reserved;
+    struct latency_hist runq_delay; // each wait for a CPU
+    struct latency_hist oncpu;      // each stretch on a CPU
+};
+
+/*
+ * Block device I/O of a process over its lifetime, aggregated in the kernel
+ * from block_rq_issue/block_rq_complete and sent at exit, next to the exit
+ * (or summary) record. Only requests the process itself queued or issued
+ * count: page-cache hits never reach the device, and writeback is issued by
+ * kernel threads.
+ */
+struct block__block_io_stats__payload
+{
+    u64 read_bytes;
+    u64 write_bytes;
+    u64 reads;    // read requests completed
+    u64 writes;   // write requests completed
+    u64 read_ns;  // device time of the reads, issue to completion
+    u64 write_ns; // device time of the writes
+    u64 errors;   // requests completed with an error
+    u64 reserved;
+    struct latency_hist read_latency;  // each read request, issue to completion
+    struct latency_hist write_latency; // each write request
+};
+
+/*
+ * Processes shorter than tracer_opts.short_process_ms are folded into these
+ * per-comm totals instead of being sent (see tracer_drain_process_aggregates())
+ */
+struct process_aggregate_key
+{
+    char comm[TASK_COMM_LEN];
+};
+
+struct process_aggregate
+{
+    u64 count;
+    u64 failures; // non-zero exit status
+    u64 runtime_ns;
+    u64 cpu_ns;
+    u64 max_rss_kb; // largest of any one process
+};
+
+/*
+ * With tracer_opts.dedup_filenames, a filename the kernel sent recently is
+ * replaced by its hash alone; the consumer resolves it from the earlier
+ * record (see tracer_intern_strings()).
+ */
+#define OPENAT_FILENAME_REPEATED 1 // `filename` is empty: look it up by `filename_hash`
+
+/*
+ * A successful EVENT__SYSCALL__OPENAT describes the file that was opened,
+ * read from the new fd's struct file in the kernel, so consumers need not
+ * stat the path (which races with the process exiting or the file moving).
+ */
+#define OPENAT_FILE_INFO 2         // dev, ino and size are set
+#define OPENAT_FILENAME_RESOLVED 4 // `filename` is the file's absolute path (as the process sees it), not the argument
+
+/* 64-bit FNV-1a over the string's bytes, without the NUL; 0 is never produced */
+#define STRING_HASH_OFFSET 0xcbf29ce484222325ULL
+#define STRING_HASH_PRIME 0x100000001b3ULL
+
 struct syscall__sys_enter_openat__payload
 {
     int dfd;
-    char filename[MAX_STR_LEN];
     int flags;
     int mode;
+    u32 filename_flags; // OPENAT_*
+    u64 filename_hash;  // string_hash() of the filename with dedup_filenames, else 0
+    int ret;            // EVENT__SYSCALL__OPENAT: the new fd, or -errno; else 0
+    u32 dev;            // OPENAT_FILE_INFO: device of the file system, kernel encoding (major << 20 | minor)
+    u64 ino;            // ...inode number
+    u64 size;           // ...i_size when opened
+    char filename[MAX_PATH_LEN]; // last, so the record can stop at the NUL
 };
 
 struct syscall__sys_exit_openat__payload
@@ -64,6 +209,17 @@ struct syscall__sys_enter_write__payload
     size_t count;
 };
 
+/* read/write/openat are aggregated in the kernel rather than sent per call */
+struct syscall__io_summary__payload
+{
+    u64 read_calls;
+    u64 read_bytes; // bytes actually transferred, i.e. sum of positive returns
+    u64 write_calls;
+    u64 write_bytes;
+    u64 openat_calls;
+    u64 openat_failures;
+};
+
 struct vmscan__mm_vmscan_direct_reclaim_begin__payload
 {
     int order; // allocation order that triggered reclaim
@@ -74,34 +230,124 @@ struct sched__psi_memstall_enter__payload
     int type; /* 0 = some, 1 = full, etc. */
 };
 
+/*
+ * Memory pressure a process felt over one interval (tracer_opts.pressure_interval_ms),
+ * sent only for processes that felt any
+ */
+struct vmscan__memory_pressure__payload
+{
+    u64 interval_ns;     // length of the interval, which ends at timestamp_ns
+    u64 reclaim_count;   // direct reclaims completed
+    u64 reclaim_ns;      // time spent in them
+    u64 reclaimed_pages; // pages they freed
+    u64 memstall_count;  // PSI memory stalls left (not counted without BPF trampolines)
+    u64 memstall_ns;     // time spent stalled
+};
+
+/* Running counters of one process, per CPU, in the mem_pressure map (keyed by upid) */
+struct mem_pressure
+{
+    u32 pid;
+    u32 ppid;
+    u64 uppid;
+    struct vmscan__memory_pressure__payload counts; // interval_ns unused
+};
+
 struct oom__mark_victim__payload
 {
     // No additional fields required for this payload
 };
 
-struct event
+/* Payload of the types that only have a handler, never a record */
+struct event__no_payload
 {
-    /* common fields */
-    enum event_type event_type;
+};
+
+/*
+ * On-CPU stack samples (tracer_opts.profile_hz) are counted in the kernel,
+ * in a hash of these keys, with the stacks themselves in a stack-trace map
+ */
+#define PROFILE_MAX_DEPTH 127 // frames per stack (the kernel's default perf_event_max_stack)
+
+struct profile_key
+{
+    u64 upid;
+    u32 pid;
+    int user_stack;   // stack-trace map id, or a negative errno (e.g. none in a kernel thread)
+    int kernel_stack;
+    u32 reserved;
+};
+
+/* Common header prefixed to every ring buffer record */
+struct event_header
+{
+    u16 event_type; // enum event_type
+    u16 layout;     // EVENT_LAYOUT_HASH of the producer
+    u32 len; // total record length in bytes, header included
     u64 timestamp_ns;
     u32 pid;
     u32 ppid;
     u64 upid;
     u64 uppid;
+} __attribute__((packed));
+
+/*
+ * Records are variable-length: a header followed by only the bytes of its
+ * payload, so `header.len` may be far smaller than sizeof(struct event).
+ * Consumers must walk a buffer of records by `header.len`.
+ */
+struct event
+{
+    struct event_header header;
 
     /* variant payload */
     union
     {
         struct sched__sched_process_exec__payload sched__sched_process_exec__payload;
         struct sched__sched_process_exit__payload sched__sched_process_exit__payload;
+        struct sched__process_summary__payload sched__process_summary__payload;
+        struct sched__sched_stats__payload sched__sched_stats__payload;
+        struct block__block_io_stats__payload block__block_io_stats__payload;
         struct syscall__sys_enter_openat__payload syscall__sys_enter_openat__payload;
         struct syscall__sys_exit_openat__payload syscall__sys_exit_openat__payload;
         struct syscall__sys_enter_read__payload syscall__sys_enter_read__payload;
         struct syscall__sys_enter_write__payload syscall__sys_enter_write__payload;
+        struct syscall__io_summary__payload syscall__io_summary__payload;
         struct vmscan__mm_vmscan_direct_reclaim_begin__payload vmscan__mm_vmscan_direct_reclaim_begin__payload;
         struct sched__psi_memstall_enter__payload sched__psi_memstall_enter__payload;
+        struct vmscan__memory_pressure__payload vmscan__memory_pressure__payload;
         struct oom__mark_victim__payload oom__mark_victim__payload;
     };
 } __attribute__((packed));
 
+#ifdef __cplusplus
+#define EVENT_STATIC_ASSERT static_assert
+#else
+#define EVENT_STATIC_ASSERT _Static_assert
+#endif
+
+// Every type fits the header's field, and every payload the staging struct
+#define EVENT_LAYOUT_CHECK(name, value, payload, extent, label)                                   \
+    EVENT_STATIC_ASSERT((value) <= 0xffff, "event type " #name " out of range");                 \
+    EVENT_STATIC_ASSERT((extent(payload)) <= sizeof(struct payload), "extent of " #name);         \
+    EVENT_STATIC_ASSERT(sizeof(struct event) >= sizeof(struct event_header) + sizeof(struct payload), \
+                        #payload " does not fit struct event");
+EVENT_SCHEMA(EVENT_LAYOUT_CHECK)
+#undef EVENT_LAYOUT_CHECK
+
+/*
+ * 16-bit digest of the record layout: the header size, each type's value
+ * and payload extent, and EVENT_SCHEMA_REVISION. Producers stamp it into
+ * every header, and consumers drop records with another one, e.g. from a
+ * program an older build left pinned (tracer_opts.pin_path) or in an
+ * old capture file. A constant expression, the same in BPF, C and C++.
+ */
+#define EVENT_LAYOUT_TERM(name, value, payload, extent, label) \
+    +((((u32)(value) + 1u) * 0x9e3779b1u) ^ ((u32)(extent(payload)) + 0x7f4a7c15u)) * 0x85ebca6bu
+#define EVENT_LAYOUT_SUM                                                                     \
+    (0u EVENT_SCHEMA(EVENT_LAYOUT_TERM) + (u32)sizeof(struct event_header) * 0xc2b2ae35u + \
+     (u32)EVENT_SCHEMA_REVISION * 0x27d4eb2fu)
+// Never 0, which is what the header of builds before it carried
+#define EVENT_LAYOUT_HASH ((u16)((EVENT_LAYOUT_SUM ^ (EVENT_LAYOUT_SUM >> 16)) % 0xffffu + 1))
+
 #endif /* BOOTSTRAP_H */
\ No newline at end of file
@@ -1,6 +1,7 @@
 #ifndef __BOOTSTRAP_API_H
 #define __BOOTSTRAP_API_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 /**
@@ -11,6 +12,493 @@
  */
 typedef void (*event_callback_t)(void *context, size_t filled_bytes);
 
+/**
+ * Delivery batching thresholds.
+ *
+ * Records accumulate in the caller's buffer across a whole ring buffer
+ * poll pass, and the callback only fires when the buffer is full or one
+ * of these thresholds is hit.
+ */
+struct batch_opts
+{
+    size_t max_events;           /* flush once this many records are pending; 0 = no limit */
+    unsigned int max_latency_ms; /* flush once the oldest pending record is this old; 0 = at the end of every poll pass */
+};
+
+/**
+ * A record exposed in place, straight from the kernel ring buffer.
+ * `data` points at a framed record (see struct event_header in bootstrap.h).
+ */
+struct event_view
+{
+    const void *data;
+    size_t size;
+};
+
+/**
+ * Callback function type for zero-copy consumption.
+ *
+ * The views point into the mmap'd ring and remain valid, with their ring
+ * space held, until acknowledged. Acknowledgement is the return value.
+ *
+ * @param context User-provided context pointer
+ * @param views Records available, in ring order
+ * @param count Number of views
+ * @return Number of leading views consumed; the rest are presented again on
+ *         the next call. 0 ends the poll: tracer_poll() pauses 10 ms (or
+ *         its timeout, if shorter; not at all with 0) and returns 0, so a
+ *         consumer that holds back isn't offered the same views in a spin.
+ */
+typedef size_t (*event_view_callback_t)(void *context, const struct event_view *views, size_t count);
+
+/**
+ * Shared-memory handoff to a consumer thread (tracer_set_handoff()).
+ *
+ * A single-producer/single-consumer ring of record slots. A library thread
+ * polls the tracer and copies records in; the consumer drains them from its
+ * own thread without locks or calls into the library:
+ *
+ *   1. Load `head` with acquire ordering.
+ *   2. Walk the slots from `tail` up to it. A slot at `data + (pos & (size - 1))`
+ *      starts with a u32 record length and holds the record TRACER_HANDOFF_HDR
+ *      bytes in. It spans TRACER_HANDOFF_HDR + length bytes, rounded up to
+ *      TRACER_HANDOFF_ALIGN. A length of TRACER_HANDOFF_WRAP marks the unused
+ *      end of the ring instead: continue at the next multiple of `size`.
+ *   3. Store the new `tail` (sequentially consistent), releasing the slots.
+ *
+ * Positions only grow. Each side writes only its own, and each sits on its
+ * own cache line, as do slots, so producer and consumer never write to a
+ * shared line.
+ */
+#define TRACER_HANDOFF_HDR 8
+#define TRACER_HANDOFF_ALIGN 64
+#define TRACER_HANDOFF_WRAP 0xFFFFFFFFu
+
+struct tracer_handoff
+{
+    unsigned long long head __attribute__((aligned(64))); /* bytes published; written by the producer */
+    unsigned long long tail __attribute__((aligned(64))); /* bytes released; written by the consumer */
+    unsigned char *data __attribute__((aligned(64)));
+    unsigned long long size; /* bytes of `data`, a power of two */
+    int wakeup_fd;           /* see tracer_handoff_wait() */
+};
+
+/* -------------------------------------------------------------------------- */
+/* Handle-based lifecycle                                                     */
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Opaque tracer handle. Not thread-safe: drive each handle from one thread
+ * at a time. The library never installs signal handlers on its behalf, and
+ * only starts threads of its own for split rings (tracer_opts.ring_layout)
+ * and handoffs (tracer_set_handoff()).
+ */
+struct tracer;
+
+/**
+ * Event classes for tracer_opts.event_mask. Programs of unselected classes
+ * are neither loaded nor attached.
+ */
+enum tracer_event_class
+{
+    TRACER_EVENTS_PROCESS = 1 << 0, /* exec and exit */
+    TRACER_EVENTS_MEMORY = 1 << 1,  /* OOM kills, and direct reclaim and PSI memory stalls as
+                                       periodic per-process totals */
+    TRACER_EVENTS_FILES = 1 << 2,   /* a record per open: EVENT__SYSCALL__OPENAT with the result
+                                       fd where fexit works, else EVENT__SYSCALL__SYS_ENTER_OPENAT */
+    TRACER_EVENTS_IO = 1 << 3,      /* per-process read/write/openat totals */
+    TRACER_EVENTS_SCHED = 1 << 4,   /* per-process run-queue delay and on-CPU time histograms,
+                                       sent at exit (EVENT__SCHED__SCHED_STATS) */
+    TRACER_EVENTS_BLOCK = 1 << 5,   /* per-process block device bytes, requests and latency
+                                       histograms, sent at exit (EVENT__BLOCK__BLOCK_IO_STATS) */
+};
+
+/**
+ * Load-time options. A NULL pointer selects the defaults (all zero).
+ */
+struct tracer_opts
+{
+    bool verbose;        /* forward libbpf debug logs to stderr */
+    bool debug_bpf;      /* enable bpf_printk() output in the BPF program */
+    bool filter_tracked; /* only emit events for processes added with tracer_track_pid() /
+                            tracer_track_cgroup(), and their descendants */
+    unsigned int wakeup_watermark; /* 0 = wake the consumer for every record. Otherwise records are
+                                      submitted without a wakeup until this many bytes are waiting
+                                      (exits and OOM kills still wake it at once), so the poll
+                                      timeout bounds delivery latency. At most a quarter of a
+                                      ring (of each, with split rings): larger ones are lowered. */
+    unsigned int ring_size;        /* ring buffer bytes: a power of two, at least a page; 0 = 8 MiB
+                                      (with split rings: bytes per ring; 0 = 8 MiB shared among
+                                      them, but at least 256 KiB each) */
+    unsigned int event_mask;       /* TRACER_EVENTS_* classes to load; 0 = all */
+    unsigned int max_args;         /* argv entries sent per exec (`argc`); the bytes of later
+                                      ones are left out of the record, and it sets
+                                      EXEC_ARGV_TRUNCATED. 0 = all that fit in `argv_bytes` */
+    unsigned int max_str_len;      /* bytes kept per exec filename in process summaries, up to
+                                      MAX_STR_LEN; 0 = MAX_STR_LEN */
+    unsigned int ring_layout;      /* enum ring_layout (bootstrap.h). Split rings (per CPU or per
+                                      NUMA node) avoid contention on one ring's lock; each is
+                                      drained by its own thread, and tracer_poll() merges them
+                                      back into timestamp order. 0 = one shared ring. */
+    bool process_summary;          /* instead of exec and exit records, send one
+                                      EVENT__SCHED__PROCESS_SUMMARY per process at exit */
+    unsigned int short_process_ms; /* with process_summary: fold processes that ran for less than
+                                      this into per-comm totals instead of sending them (see
+                                      tracer_drain_process_aggregates()); 0 = send all */
+    bool dedup_filenames;          /* send an openat filename seen in the last few thousand opens as
+                                      its hash alone (OPENAT_FILENAME_REPEATED); consumers resolve
+                                      it with tracer_intern_strings() */
+    unsigned int argv_bytes;       /* bytes of command line kept per exec, up to MAX_ARGV_BYTES;
+                                      0 = MAX_ARGV_BYTES. Longer ones end on the last argument
+                                      that fits whole (none if the first doesn't) and set
+                                      EXEC_ARGV_TRUNCATED. */
+    unsigned int max_path_len;     /* bytes kept per openat filename, up to MAX_PATH_LEN;
+                                      0 = MAX_PATH_LEN */
+    bool profile_handlers;         /* time every BPF handler run, and the library's own record
+                                      handling and consumer callbacks, into log2 histograms
+                                      (tracer_handler_latency(), tracer_consumer_latency()) */
+    bool snapshot_existing;        /* have tracer_attach() deliver an EVENT__SCHED__PROCESS_SNAPSHOT
+                                      record per process already running (Linux 5.18+; skipped
+                                      with a warning on older kernels) */
+    unsigned int pressure_interval_ms; /* how often tracer_poll() sends the direct reclaim and
+                                          memory stall totals of each process, as
+                                          EVENT__VMSCAN__MEMORY_PRESSURE records; 0 = 1000 */
+    const char *pin_path;          /* bpffs directory (e.g. "/sys/fs/bpf/tracer") to pin the ring,
+                                      the tracking and accounting maps, and the links under, so
+                                      the programs keep running and filling the ring after the
+                                      handle is destroyed, and a handle opened later with the same
+                                      path resumes from them; a pinned map whose layout differs is
+                                      replaced. While its programs take over, both sets write to
+                                      the ring, so exec and exit records are duplicated. Needs the
+                                      shared ring layout. NULL = nothing pinned. See
+                                      tracer_unpin(). */
+    bool boot_clock;               /* take timestamps with bpf_ktime_get_boot_ns() (Linux 5.8+),
+                                      which unlike the default CLOCK_MONOTONIC keeps counting
+                                      while the host is suspended; falls back with a warning */
+    unsigned int profile_hz;       /* sample the on-CPU stacks of tracked processes this many
+                                      times a second per CPU, for tracer_profile_read();
+                                      0 = no profiling. Needs perf events (CAP_PERFMON) */
+    const char *spill_path;        /* directory where a handoff (tracer_set_handoff()) keeps the
+                                      records its ring has no room for, until the consumer
+                                      catches up. Must be on disk: tmpfs and ramfs are refused.
+                                      NULL = the handoff waits for room instead */
+    unsigned long long spill_bytes; /* disk `spill_path` may take, in 16 MiB segments (at least
+                                       one); past it records are dropped and counted (see
+                                       tracer_spill_stats()). 0 = 1 GiB */
+};
+
+/**
+ * Open and load the BPF program. Verification happens here, once per
+ * handle; nothing is attached yet.
+ *
+ * @param opts Load-time options, or NULL for defaults
+ * @return New handle, or NULL with errno set
+ */
+struct tracer *tracer_open(const struct tracer_opts *opts);
+
+/**
+ * Deliver events by copying them into a caller buffer (see initialize_batched()).
+ * Replaces any previously configured consumer.
+ *
+ * @return 0 on success, negative errno on error
+ */
+int tracer_set_callback(struct tracer *tracer, void *buffer, size_t byte_count,
+                        const struct batch_opts *batch, event_callback_t callback, void *callback_ctx);
+
+/**
+ * Deliver events in place (see initialize_zero_copy()).
+ * Replaces any previously configured consumer.
+ *
+ * @return 0 on success, negative errno on error
+ */
+int tracer_set_view_callback(struct tracer *tracer, event_view_callback_t callback, void *callback_ctx);
+
+/**
+ * Deliver events through a struct tracer_handoff of `size` bytes (a power
+ * of two, at least 1 MiB), filled by a thread the library starts here and
+ * stops when the consumer is replaced or the handle destroyed. That thread
+ * does all the polling: don't call tracer_poll() meanwhile (it returns
+ * -EBUSY). The process snapshot of tracer_attach() is delivered by it too.
+ * Replaces any previously configured consumer.
+ *
+ * When the ring is full, the thread waits for the consumer, and the kernel
+ * ring absorbs the backlog (see tracer_event_stats() for what it then drops).
+ * With tracer_opts.spill_path it doesn't wait: records queue on disk as they
+ * came, and go back into the ring, before newer ones, as room is released.
+ * The ring's size then bounds the memory taken by records in flight.
+ *
+ * @return The ring, owned by the handle, or NULL with errno set
+ */
+struct tracer_handoff *tracer_set_handoff(struct tracer *tracer, size_t size);
+
+/**
+ * Wait until the handoff has unreleased records, for the consumer.
+ *
+ * @param timeout_ms As for poll(2)
+ * @return 1 if records are waiting, 0 on timeout, negative errno on error
+ */
+int tracer_handoff_wait(struct tracer_handoff *handoff, int timeout_ms);
+
+/**
+ * Attach the BPF programs to their tracepoints. Events start flowing.
+ * May be called again after tracer_stop() without reloading the program.
+ *
+ * With `snapshot_existing`, the consumer (which must be configured first)
+ * then receives one EVENT__SCHED__PROCESS_SNAPSHOT record per running
+ * process, from a single pass of a BPF task iterator, before this returns.
+ * Processes exec'd meanwhile may show up in both the snapshot and an exec
+ * record; their upid is the same in both.
+ *
+ * @return 0 on success, negative errno on error
+ */
+int tracer_attach(struct tracer *tracer);
+
+/**
+ * Deliver available events to the configured consumer, waiting up to
+ * `timeout_ms` for some to arrive (0 = don't wait, -1 = wait indefinitely).
+ * When batching, the wait is cut short so `max_latency_ms` still holds.
+ *
+ * @return Number of records delivered, or negative errno on error
+ */
+int tracer_poll(struct tracer *tracer, int timeout_ms);
+
+/**
+ * Add a process to the tracked set used when `filter_tracked` is on.
+ * Processes it forks or execs from then on are tracked as well; descendants
+ * already running are not. Entries are removed when the process exits.
+ * May be called before or after tracer_attach().
+ *
+ * @param pid Process (thread group) id
+ * @return 0 on success, negative errno on error
+ */
+int tracer_track_pid(struct tracer *tracer, unsigned int pid);
+
+/**
+ * Remove a process from the tracked set. Its descendants stay tracked.
+ *
+ * @return 0 on success (including when it was not tracked), negative errno on error
+ */
+int tracer_untrack_pid(struct tracer *tracer, unsigned int pid);
+
+/**
+ * Track every process in a cgroup v2 (by id, i.e. the inode number of its
+ * cgroupfs directory) when `filter_tracked` is on.
+ *
+ * @return 0 on success, negative errno on error
+ */
+int tracer_track_cgroup(struct tracer *tracer, unsigned long long cgroup_id);
+
+struct event_stats; /* bootstrap.h */
+
+/**
+ * Read the delivery counters of one event type, summed over all CPUs.
+ * Counters accumulate from tracer_open(). Unlike the other calls, this is
+ * safe to use from another thread while the handle is being polled.
+ *
+ * Low-priority (syscall) events are shed while the ring is nearly full or
+ * has recently overflowed, so that process lifecycle and OOM records are
+ * the last to be dropped.
+ *
+ * @param event_type An enum event_type value
+ * @param out Receives the counters
+ * @return 0 on success, -ENOENT for an unknown type, negative errno on error
+ */
+int tracer_event_stats(const struct tracer *tracer, unsigned int event_type, struct event_stats *out);
+
+struct spill_stats; /* bootstrap.h */
+
+/**
+ * Read the counters of the handoff's on-disk overflow (tracer_opts.spill_path).
+ * Like tracer_event_stats(), safe to call while the handoff is being filled.
+ *
+ * @param out Receives the counters
+ * @return 0 on success, -ENOENT without a handoff or spill_path
+ */
+int tracer_spill_stats(const struct tracer *tracer, struct spill_stats *out);
+
+struct syscall__io_summary__payload; /* bootstrap.h */
+
+/**
+ * Read the I/O totals (read/write bytes and calls, openat calls) of a live
+ * process, summed over all CPUs. The same totals are sent as an
+ * EVENT__SYSCALL__IO_SUMMARY record when the process exits, on kernels that
+ * can sum per-CPU maps in BPF (5.19+); on older ones this is the only way to
+ * get them. Like tracer_event_stats(), safe to call while polling.
+ *
+ * @param upid Unique process id, as in struct event_header
+ * @param out Receives the totals
+ * @return 0 on success, -ENOENT if the process has done no I/O (or has
+ *         exited), negative errno on error
+ */
+int tracer_io_stats(const struct tracer *tracer, unsigned long long upid,
+                    struct syscall__io_summary__payload *out);
+
+struct process_aggregate; /* bootstrap.h */
+
+/**
+ * Callback for tracer_drain_process_aggregates().
+ *
+ * @param comm Command name (TASK_COMM_LEN bytes, NUL-padded)
+ * @param aggregate Totals of the short processes of that name
+ */
+typedef void (*process_aggregate_callback_t)(void *context, const char *comm,
+                                             const struct process_aggregate *aggregate);
+
+/**
+ * Read and reset the per-comm totals of short processes (`short_process_ms`
+ * in summary mode), summed over all CPUs. Like tracer_event_stats(), safe
+ * to call while polling.
+ *
+ * @return Number of names reported, or negative errno on error
+ */
+int tracer_drain_process_aggregates(struct tracer *tracer, process_aggregate_callback_t callback,
+                                    void *callback_ctx);
+
+/**
+ * Callback for tracer_profile_read().
+ *
+ * @param stack Folded stack, outermost frame first, frames separated by ';'
+ *              and kernel frames suffixed "_[k]"
+ * @param count Samples taken in that stack
+ */
+typedef void (*profile_stack_callback_t)(void *context, const char *stack, unsigned long long count);
+
+/**
+ * Read, symbolize and reset the stacks sampled in one process (see
+ * tracer_opts.profile_hz), typically once its EVENT__SCHED__SCHED_PROCESS_EXIT
+ * record arrives. The output is in the folded format of flame graph tools.
+ * A library thread collects the samples of every process once a second, and
+ * user frames resolve through the mappings it last saw the process with.
+ * The counts taken since are drained first, and the mappings re-read if
+ * the process still has them, so one that lived less than a second (or
+ * mapped a library since) is symbolized too.
+ * Safe to call from another thread while polling.
+ *
+ * @param upid Unique process id, as in struct event_header
+ * @return Number of distinct stacks reported, -EOPNOTSUPP without
+ *         profile_hz, or negative errno on error
+ */
+int tracer_profile_read(struct tracer *tracer, unsigned long long upid, profile_stack_callback_t callback,
+                        void *callback_ctx);
+
+struct latency_hist; /* bootstrap.h */
+
+/**
+ * Read the run-time histogram of the BPF handler behind one event type,
+ * summed over all CPUs: every invocation, including those that filter the
+ * event out. EVENT__SYSCALL__SYS_EXIT_{READ,WRITE,OPENAT} select the I/O
+ * accounting handlers. Like tracer_event_stats(), safe to call while
+ * polling.
+ *
+ * @param event_type An enum event_type value
+ * @param out Receives the histogram
+ * @param reset Also zero it (runs finishing in between may be lost)
+ * @return 0 on success, -ENOENT for an unknown type, -EOPNOTSUPP without
+ *         `profile_handlers`, negative errno on error
+ */
+int tracer_handler_latency(struct tracer *tracer, unsigned int event_type, struct latency_hist *out,
+                           bool reset);
+
+/**
+ * Stages of delivery timed in user space with `profile_handlers`
+ */
+enum tracer_timing
+{
+    TRACER_TIMING_RECORD = 0,   /* checking and copying one record into the caller's buffer */
+    TRACER_TIMING_MERGE = 1,    /* one pass of the split rings' merge (a batch of records) */
+    TRACER_TIMING_CALLBACK = 2, /* one invocation of the consumer's callback */
+    TRACER_TIMING_COUNT,
+};
+
+/**
+ * Read the user-space counterpart of tracer_handler_latency(). Unlike it,
+ * must be called from the thread that polls the handle.
+ *
+ * @param timing An enum tracer_timing value
+ * @param reset Also zero the histogram
+ * @return 0 on success, -ENOENT for an unknown stage, -EOPNOTSUPP without
+ *         `profile_handlers`
+ */
+int tracer_consumer_latency(struct tracer *tracer, unsigned int timing, struct latency_hist *out,
+                            bool reset);
+
+/**
+ * Intern the strings of a record: the argv of an exec or process snapshot,
+ * or the filename of a process summary or openat. Each distinct string gets a stable id, and its
+ * text is kept once, however many records repeat it; consumers can key
+ * their own per-string state by id and skip decoding strings they have
+ * seen. Repeated openat filenames (`dedup_filenames`) resolve to the id of
+ * their first full record, or 0 if that record was never interned here.
+ *
+ * The table is dropped once it holds more than 64 MiB of text (ids are not
+ * reused); call this for every record from the start so that repeats can
+ * be resolved. Not safe to call while another thread polls the handle.
+ *
+ * @param record A framed record, as delivered to either consumer
+ * @param ids Receives up to `max_ids` ids, in record order
+ * @param added Receives how many of them were new, if not NULL
+ * @return Number of strings in the record (possibly more than `max_ids`),
+ *         or negative errno on error
+ */
+int tracer_intern_strings(struct tracer *tracer, const void *record, size_t size,
+                          unsigned int *ids, size_t max_ids, size_t *added);
+
+/**
+ * Text of an interned string, NUL-terminated, valid until the table is
+ * dropped.
+ *
+ * @param len Receives its length, if not NULL
+ * @return The text, or NULL for an unknown (or dropped) id
+ */
+const char *tracer_string(const struct tracer *tracer, unsigned int id, size_t *len);
+
+/**
+ * Wall-clock time of boot that record timestamps are relative to, i.e.
+ * `timestamp_ns` minus the kernel clock they were taken with (see
+ * tracer_opts.boot_clock). tracer_poll() re-measures it every minute, as the
+ * wall clock is adjusted. Recorded in capture files so their timestamps can
+ * be interpreted later.
+ */
+unsigned long long tracer_system_boot_ns(const struct tracer *tracer);
+
+/**
+ * File descriptor that becomes readable whenever events are available, for
+ * callers that integrate tracer_poll(tracer, 0) into their own event loop.
+ * With a `wakeup_watermark`, it only becomes readable past the watermark or
+ * for high-priority records, so such callers must also poll on a timer.
+ * Owned by the handle.
+ */
+int tracer_epoll_fd(const struct tracer *tracer);
+
+/**
+ * Detach the BPF programs and deliver any batched records. Records already
+ * in the ring can still be drained with tracer_poll(). With `pin_path`, the
+ * links are unpinned too: the programs stop for good.
+ */
+void tracer_stop(struct tracer *tracer);
+
+/**
+ * Stop the tracer (if running) and free the handle. Accepts NULL. With
+ * `pin_path`, pinned links are left in place, and the programs keep running
+ * until another handle takes over or tracer_unpin() is called.
+ */
+void tracer_destroy(struct tracer *tracer);
+
+/**
+ * Remove everything pinned under `pin_path` (tracer_opts.pin_path) and the
+ * directory itself, stopping programs left running by destroyed handles.
+ *
+ * @return 0 on success (also if nothing was pinned), negative errno on error
+ */
+int tracer_unpin(const char *pin_path);
+
+/* -------------------------------------------------------------------------- */
+/* Blocking entry points                                                      */
+/*                                                                            */
+/* These wrap the handle API: each call loads the program, then polls until   */
+/* SIGINT/SIGTERM (for which they install handlers) or an error.              */
+/* -------------------------------------------------------------------------- */
+
 /**
  * Initialize the kernel tracing and event processing.
  *
@@ -26,4 +514,31 @@ typedef void (*event_callback_t)(void *context, size_t filled_bytes);
  */
 int initialize(void *buffer, size_t byte_count, event_callback_t callback, void *callback_ctx);
 
-#endif /* __BOOTSTRAP_API_H */
\ No newline at end of file
+/**
+ * Like initialize(), but batches records in the buffer instead of invoking
+ * the callback once per event.
+ *
+ * @param buffer Pointer to a buffer where events will be written
+ * @param byte_count Size of the buffer in bytes
+ * @param batch Batching thresholds, or NULL to flush after every event
+ * @param callback Function to call when a batch is ready
+ * @param callback_ctx Context pointer to pass to the callback
+ * @return 0 on success, non-zero on error
+ */
+int initialize_batched(void *buffer, size_t byte_count, const struct batch_opts *batch,
+                       event_callback_t callback, void *callback_ctx);
+
+/**
+ * Initialize the kernel tracing and consume events without copying them.
+ *
+ * Same lifecycle as initialize(), but instead of copying each record into a
+ * caller buffer, the callback receives views of the records in place and
+ * acknowledges how far it has consumed.
+ *
+ * @param callback Function to call when records are available
+ * @param callback_ctx Context pointer to pass to the callback
+ * @return 0 on success, non-zero on error
+ */
+int initialize_zero_copy(event_view_callback_t callback, void *callback_ctx);
+
+#endif /* __BOOTSTRAP_API_H */
@@ -0,0 +1,470 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "capture.h"
+
+#define ZSTD_LEVEL 3 // fast, still well ahead of LZ4 on ratio
+
+struct capture_writer
+{
+	int fd;
+	enum capture_codec codec;
+	char *raw;	  // records of the block being filled
+	size_t raw_size;
+	char *packed; // compression output
+	size_t packed_cap;
+	struct capture_block_header block;
+};
+
+static u64 clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int write_all(int fd, const void *data, size_t size)
+{
+	const char *p = data;
+
+	while (size)
+	{
+		ssize_t n = write(fd, p, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -errno;
+		p += n;
+		size -= n;
+	}
+	return 0;
+}
+
+int capture_codec_supported(enum capture_codec codec)
+{
+	switch (codec)
+	{
+	case CAPTURE_CODEC_NONE:
+		return 1;
+#ifdef HAVE_LZ4
+	case CAPTURE_CODEC_LZ4:
+		return 1;
+#endif
+#ifdef HAVE_ZSTD
+	case CAPTURE_CODEC_ZSTD:
+		return 1;
+#endif
+	default:
+		return 0;
+	}
+}
+
+// Worst-case compressed size of a full block
+static size_t packed_bound(enum capture_codec codec)
+{
+	switch (codec)
+	{
+#ifdef HAVE_LZ4
+	case CAPTURE_CODEC_LZ4:
+		return LZ4_compressBound(CAPTURE_BLOCK_SIZE);
+#endif
+#ifdef HAVE_ZSTD
+	case CAPTURE_CODEC_ZSTD:
+		return ZSTD_compressBound(CAPTURE_BLOCK_SIZE);
+#endif
+	default:
+		return 0;
+	}
+}
+
+// Returns the compressed size, or 0 to store the block as is
+static size_t pack(struct capture_writer *w)
+{
+	switch (w->codec)
+	{
+#ifdef HAVE_LZ4
+	case CAPTURE_CODEC_LZ4:
+	{
+		int n = LZ4_compress_default(w->raw, w->packed, w->raw_size, w->packed_cap);
+		return n > 0 ? (size_t)n : 0;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	case CAPTURE_CODEC_ZSTD:
+	{
+		size_t n = ZSTD_compress(w->packed, w->packed_cap, w->raw, w->raw_size, ZSTD_LEVEL);
+		return ZSTD_isError(n) ? 0 : n;
+	}
+#endif
+	default:
+		return 0;
+	}
+}
+
+struct capture_writer *capture_writer__open(const char *path, enum capture_codec codec,
+											u64 system_boot_ns)
+{
+	struct capture_file_header hdr = {
+		.magic = CAPTURE_MAGIC,
+		.version = CAPTURE_VERSION,
+		.header_size = sizeof(hdr),
+		.system_boot_ns = system_boot_ns,
+		.created_ns = clock_ns(CLOCK_REALTIME),
+		.byte_order = CAPTURE_BYTE_ORDER,
+		.codec = codec,
+		.event_header_size = sizeof(struct event_header),
+		.event_max_size = sizeof(struct event),
+		.task_comm_len = TASK_COMM_LEN,
+		.max_argv_bytes = MAX_ARGV_BYTES,
+		.max_str_len = MAX_STR_LEN,
+		.event_layout = EVENT_LAYOUT_HASH,
+	};
+	struct capture_writer *w;
+	int err;
+
+	if (!capture_codec_supported(codec))
+	{
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+	w->codec = codec;
+	w->packed_cap = packed_bound(codec);
+	w->raw = malloc(CAPTURE_BLOCK_SIZE);
+	w->packed = w->packed_cap ? malloc(w->packed_cap) : NULL;
+	w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (!w->raw || (w->packed_cap && !w->packed) || w->fd < 0)
+	{
+		err = errno;
+		goto fail;
+	}
+
+	err = -write_all(w->fd, &hdr, sizeof(hdr));
+	if (err)
+		goto fail;
+	return w;
+
+fail:
+	if (w->fd >= 0)
+		close(w->fd);
+	free(w->packed);
+	free(w->raw);
+	free(w);
+	errno = err;
+	return NULL;
+}
+
+static int flush_block(struct capture_writer *w)
+{
+	size_t packed = 0;
+	int err;
+
+	if (!w->raw_size)
+		return 0;
+
+	// Incompressible blocks are stored raw rather than grown
+	if (w->codec != CAPTURE_CODEC_NONE)
+		packed = pack(w);
+	if (packed && packed < w->raw_size)
+	{
+		w->block.codec = w->codec;
+		w->block.stored_size = packed;
+	}
+	else
+	{
+		w->block.codec = CAPTURE_CODEC_NONE;
+		w->block.stored_size = w->raw_size;
+	}
+	w->block.raw_size = w->raw_size;
+
+	err = write_all(w->fd, &w->block, sizeof(w->block));
+	if (!err)
+		err = write_all(w->fd, w->block.codec == CAPTURE_CODEC_NONE ? w->raw : w->packed,
+						w->block.stored_size);
+
+	memset(&w->block, 0, sizeof(w->block));
+	w->raw_size = 0;
+	return err;
+}
+
+int capture_writer__append(struct capture_writer *w, const void *record, size_t size)
+{
+	struct event_header hdr;
+	int err;
+
+	if (size < sizeof(hdr) || size > CAPTURE_BLOCK_SIZE)
+		return -EINVAL;
+	if (w->raw_size + size > CAPTURE_BLOCK_SIZE)
+	{
+		err = flush_block(w);
+		if (err)
+			return err;
+	}
+
+	memcpy(&hdr, record, sizeof(hdr));
+	if (!w->block.records)
+		w->block.first_timestamp_ns = hdr.timestamp_ns;
+	w->block.last_timestamp_ns = hdr.timestamp_ns;
+	w->block.records++;
+
+	memcpy(w->raw + w->raw_size, record, size);
+	w->raw_size += size;
+	return 0;
+}
+
+int capture_writer__close(struct capture_writer *w)
+{
+	int err;
+
+	if (!w)
+		return 0;
+	err = flush_block(w);
+	if (close(w->fd) && !err)
+		err = -errno;
+	free(w->packed);
+	free(w->raw);
+	free(w);
+	return err;
+}
+
+/* -------------------------------------------------------------------------- */
+/* Replay                                                                     */
+/* -------------------------------------------------------------------------- */
+
+static int check_header(const struct capture_file_header *hdr, size_t file_size)
+{
+	if (file_size < sizeof(*hdr) || memcmp(hdr->magic, CAPTURE_MAGIC, sizeof(hdr->magic)))
+		return -EINVAL;
+	if (hdr->version != CAPTURE_VERSION || hdr->header_size < sizeof(*hdr) ||
+		hdr->header_size > file_size)
+		return -EINVAL;
+
+	// Records are replayed as raw structs, so their layout must match ours
+	if (hdr->byte_order != CAPTURE_BYTE_ORDER ||
+		hdr->event_header_size != sizeof(struct event_header) ||
+		hdr->event_max_size != sizeof(struct event) ||
+		hdr->task_comm_len != TASK_COMM_LEN ||
+		hdr->max_argv_bytes != MAX_ARGV_BYTES ||
+		hdr->max_str_len != MAX_STR_LEN ||
+		hdr->event_layout != EVENT_LAYOUT_HASH)
+		return -EPROTO;
+	return 0;
+}
+
+// Points *raw at the decoded records of a block
+static int unpack(const struct capture_block_header *block, const char *stored,
+				  char *scratch, const char **raw)
+{
+	switch (block->codec)
+	{
+	case CAPTURE_CODEC_NONE:
+		if (block->stored_size != block->raw_size)
+			return -EPROTO;
+		*raw = stored;
+		return 0;
+#ifdef HAVE_LZ4
+	case CAPTURE_CODEC_LZ4:
+		if (LZ4_decompress_safe(stored, scratch, block->stored_size, CAPTURE_BLOCK_SIZE) !=
+			(int)block->raw_size)
+			return -EPROTO;
+		*raw = scratch;
+		return 0;
+#endif
+#ifdef HAVE_ZSTD
+	case CAPTURE_CODEC_ZSTD:
+		if (ZSTD_decompress(scratch, CAPTURE_BLOCK_SIZE, stored, block->stored_size) !=
+			block->raw_size)
+			return -EPROTO;
+		*raw = scratch;
+		return 0;
+#endif
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+struct replay_state
+{
+	char *buffer;
+	size_t byte_count;
+	size_t filled;
+	event_callback_t cb;
+	void *cb_ctx;
+	double speed;
+	u64 start_ns;	  // monotonic time replay started
+	u64 first_ts;	  // timestamp of the first record in the file
+	bool have_first;
+};
+
+static void replay_flush(struct replay_state *s)
+{
+	if (s->filled)
+		s->cb(s->cb_ctx, s->filled);
+	s->filled = 0;
+}
+
+// Holds a record back until it is due at the requested speed
+static void pace(struct replay_state *s, u64 timestamp_ns)
+{
+	struct timespec ts;
+	u64 due;
+
+	if (!s->have_first)
+	{
+		s->first_ts = timestamp_ns;
+		s->have_first = true;
+	}
+	if (s->speed <= 0 || timestamp_ns <= s->first_ts)
+		return;
+
+	due = s->start_ns + (u64)((timestamp_ns - s->first_ts) / s->speed);
+	if (due <= clock_ns(CLOCK_MONOTONIC))
+		return;
+
+	// Deliver what is already due before sleeping
+	replay_flush(s);
+	ts.tv_sec = due / 1000000000ULL;
+	ts.tv_nsec = due % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+static long replay_block(struct replay_state *s, const char *raw, size_t size)
+{
+	struct event_header hdr;
+	size_t pos = 0;
+	long n = 0;
+
+	while (pos + sizeof(hdr) <= size)
+	{
+		memcpy(&hdr, raw + pos, sizeof(hdr));
+		if (hdr.len < sizeof(hdr) || hdr.len > size - pos || hdr.layout != EVENT_LAYOUT_HASH)
+			return -EPROTO;
+		if (hdr.len > s->byte_count)
+			return -ENOBUFS;
+
+		pace(s, hdr.timestamp_ns);
+		if (s->filled + hdr.len > s->byte_count)
+			replay_flush(s);
+		memcpy(s->buffer + s->filled, raw + pos, hdr.len);
+		s->filled += hdr.len;
+		pos += hdr.len;
+		n++;
+	}
+	replay_flush(s);
+	return n;
+}
+
+long capture_replay(const char *path, void *buffer, size_t byte_count,
+					const struct capture_replay_opts *opts, event_callback_t callback,
+					void *callback_ctx, u64 *system_boot_ns)
+{
+	struct replay_state s = {
+		.buffer = buffer,
+		.byte_count = byte_count,
+		.cb = callback,
+		.cb_ctx = callback_ctx,
+		.speed = opts ? opts->speed : 0,
+	};
+	const struct capture_file_header *hdr;
+	char *scratch = NULL;
+	struct stat st;
+	size_t off;
+	long total = 0;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	if (fstat(fd, &st))
+	{
+		total = -errno;
+		close(fd);
+		return total;
+	}
+	if ((size_t)st.st_size < sizeof(*hdr))
+	{
+		close(fd);
+		return -EINVAL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -errno;
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	hdr = map;
+	total = check_header(hdr, st.st_size);
+	if (total)
+		goto out;
+	if (system_boot_ns)
+		*system_boot_ns = hdr->system_boot_ns;
+
+	s.start_ns = clock_ns(CLOCK_MONOTONIC);
+	for (off = hdr->header_size; off + sizeof(struct capture_block_header) <= (size_t)st.st_size;)
+	{
+		struct capture_block_header block;
+		const char *raw;
+		long n;
+		int err;
+
+		memcpy(&block, (const char *)map + off, sizeof(block));
+		off += sizeof(block);
+		if (block.stored_size > st.st_size - off)
+			break; // truncated final block
+		if (block.raw_size > CAPTURE_BLOCK_SIZE)
+		{
+			total = -EPROTO;
+			goto out;
+		}
+
+		if (block.codec != CAPTURE_CODEC_NONE && !scratch)
+		{
+			scratch = malloc(CAPTURE_BLOCK_SIZE);
+			if (!scratch)
+			{
+				total = -ENOMEM;
+				goto out;
+			}
+		}
+		err = unpack(&block, (const char *)map + off, scratch, &raw);
+		if (err)
+		{
+			total = err;
+			goto out;
+		}
+
+		n = replay_block(&s, raw, block.raw_size);
+		if (n < 0)
+		{
+			total = n;
+			goto out;
+		}
+		total += n;
+		off += block.stored_size;
+	}
+
+out:
+	free(scratch);
+	munmap(map, st.st_size);
+	return total;
+}
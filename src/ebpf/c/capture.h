@@ -0,0 +1,96 @@
+#ifndef __CAPTURE_H
+#define __CAPTURE_H
+
+#include <stddef.h>
+
+#include "bootstrap.h"
+#include "bootstrap_api.h"
+
+/*
+ * Capture files: raw record streams saved for offline replay.
+ *
+ * Layout: one struct capture_file_header, then a sequence of blocks. Each
+ * block is a struct capture_block_header followed by `stored_size` bytes
+ * which, once decoded with the block's codec, hold `raw_size` bytes of
+ * framed records exactly as they came out of the ring (walk them by
+ * `header.len`). A file cut short by a crash replays up to its last
+ * complete block.
+ */
+#define CAPTURE_MAGIC "TRCAPv1"
+#define CAPTURE_VERSION 4 // of the file format; record layouts are checked by `event_layout`
+#define CAPTURE_BLOCK_SIZE (256 * 1024) // raw bytes per block, at most
+#define CAPTURE_BYTE_ORDER 0x01020304u  // as written by the capturing host
+
+enum capture_codec
+{
+	CAPTURE_CODEC_NONE = 0,
+	CAPTURE_CODEC_LZ4 = 1,  // only if built with HAVE_LZ4
+	CAPTURE_CODEC_ZSTD = 2, // only if built with HAVE_ZSTD
+};
+
+struct capture_file_header
+{
+	char magic[8];
+	u32 version;
+	u32 header_size; // sizeof(struct capture_file_header), for skipping newer fields
+	u64 system_boot_ns; // wall-clock boot time that record timestamps are relative to
+	u64 created_ns;
+	u32 byte_order;  // CAPTURE_BYTE_ORDER
+	u32 codec;       // preferred codec of the writer (blocks may fall back to NONE)
+	/* Layout of the records, so mismatched readers can refuse the file */
+	u32 event_header_size; // sizeof(struct event_header)
+	u32 event_max_size;    // sizeof(struct event)
+	u32 task_comm_len;
+	u32 max_argv_bytes;
+	u32 max_str_len;
+	u32 event_layout;      // EVENT_LAYOUT_HASH, also in every record's header
+};
+
+struct capture_block_header
+{
+	u32 codec;
+	u32 raw_size;
+	u32 stored_size;
+	u32 records;
+	u64 first_timestamp_ns;
+	u64 last_timestamp_ns;
+};
+
+/* Whether this build can write and read blocks of `codec` */
+int capture_codec_supported(enum capture_codec codec);
+
+struct capture_writer;
+
+/*
+ * Creates (truncating) a capture file. Returns NULL with errno set, e.g.
+ * EOPNOTSUPP for a codec this build lacks.
+ */
+struct capture_writer *capture_writer__open(const char *path, enum capture_codec codec,
+											u64 system_boot_ns);
+
+/* Appends one framed record. Returns 0 or a negative errno. */
+int capture_writer__append(struct capture_writer *w, const void *record, size_t size);
+
+/* Writes out the pending block and closes the file. Returns 0 or a negative errno. */
+int capture_writer__close(struct capture_writer *w);
+
+struct capture_replay_opts
+{
+	double speed; /* 1.0 = original pacing, 2.0 = twice as fast, 0 = as fast as possible */
+};
+
+/*
+ * Maps a capture file and delivers its records through the same interface
+ * as the live copying consumer: records are copied into `buffer` and
+ * `callback(callback_ctx, filled_bytes)` is invoked whenever it is full, a
+ * block ends, or (when paced) before sleeping until the next record is due.
+ *
+ * @param system_boot_ns Receives the file's system_boot_ns, if not NULL
+ * @return Number of records replayed, or a negative errno (-EPROTO for a
+ *         file whose record layout differs from this build's)
+ */
+long capture_replay(const char *path, void *buffer, size_t byte_count,
+					const struct capture_replay_opts *opts, event_callback_t callback,
+					void *callback_ctx, u64 *system_boot_ns);
+
+#endif /* __CAPTURE_H */
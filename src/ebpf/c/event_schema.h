@@ -0,0 +1,79 @@
+// event_schema.h
+#ifndef EVENT_SCHEMA_H
+#define EVENT_SCHEMA_H
+
+/*
+ * The one list of event types. Everything that depends on the set of types
+ * or on their record layouts is expanded from it: enum event_type and enum
+ * event_slot (bootstrap.h), the layout checks and EVENT_LAYOUT_HASH
+ * (bootstrap.h), the type-indexed decoder (event_visit.hpp) and the Rust
+ * constants and layout assertions (event_schema_rs.c, rs/types.rs).
+ *
+ * X(name, value, payload, extent, label)
+ *   name     EVENT__<name> and SLOT__<name>
+ *   value    the event type, (category << 10) | index
+ *   payload  struct of the record's payload, defined in bootstrap.h
+ *   extent   how many payload bytes every record of the type carries, at
+ *            least: PAYLOAD_WHOLE, PAYLOAD_NONE for types never sent (or
+ *            sent as a header alone), or PAYLOAD_UPTO_<member> for payloads
+ *            ending in a string the record stops short of
+ *   label    name of the type in logs and NDJSON output
+ *
+ * Layouts shared between types: PROCESS_SNAPSHOT (a process running at
+ * tracer_attach()) has the exec one, and OPENAT (an open and its result in
+ * one record) the sys_enter_openat one. The *_STATS and IO_SUMMARY types
+ * are sent at exit, PROCESS_SUMMARY instead of exec and exit records with
+ * tracer_opts.process_summary; CPU_SAMPLE only counts the sampling handler.
+ *
+ * EVENT_HANDLED are the types with a kernel handler of their own, in enum
+ * event_slot order, which indexes the stats and handler-latency maps:
+ * append new types at the end. EVENT_DERIVED are records other code builds
+ * (the snapshot iterator, the consumer's pressure intervals).
+ */
+#define EVENT_SCHEMA(X) EVENT_HANDLED(X) EVENT_DERIVED(X)
+
+#define EVENT_HANDLED(X)                                                                                    \
+    X(SCHED__SCHED_PROCESS_EXEC, 0, sched__sched_process_exec__payload, PAYLOAD_UPTO_ARGV, "process_exec")   \
+    X(SCHED__SCHED_PROCESS_EXIT, 1, sched__sched_process_exit__payload, PAYLOAD_WHOLE, "process_exit")       \
+    X(SCHED__PSI_MEMSTALL_ENTER, 16, sched__psi_memstall_enter__payload, PAYLOAD_NONE, "psi_memstall_enter") \
+    X(SYSCALL__SYS_ENTER_OPENAT, 1024, syscall__sys_enter_openat__payload, PAYLOAD_UPTO_FILENAME,            \
+      "sys_enter_openat")                                                                                    \
+    X(SYSCALL__SYS_EXIT_OPENAT, 1025, syscall__sys_exit_openat__payload, PAYLOAD_WHOLE, "sys_exit_openat")   \
+    X(SYSCALL__SYS_ENTER_READ, 1026, syscall__sys_enter_read__payload, PAYLOAD_NONE, "sys_enter_read")       \
+    X(SYSCALL__SYS_EXIT_READ, 1027, event__no_payload, PAYLOAD_NONE, "sys_exit_read")                        \
+    X(SYSCALL__SYS_ENTER_WRITE, 1028, syscall__sys_enter_write__payload, PAYLOAD_NONE, "sys_enter_write")    \
+    X(SYSCALL__SYS_EXIT_WRITE, 1029, event__no_payload, PAYLOAD_NONE, "sys_exit_write")                      \
+    X(SYSCALL__IO_SUMMARY, 1030, syscall__io_summary__payload, PAYLOAD_WHOLE, "io_summary")                  \
+    X(VMSCAN__MM_VMSCAN_DIRECT_RECLAIM_BEGIN, 2048, vmscan__mm_vmscan_direct_reclaim_begin__payload,         \
+      PAYLOAD_NONE, "direct_reclaim_begin")                                                                  \
+    X(OOM__MARK_VICTIM, 3072, oom__mark_victim__payload, PAYLOAD_NONE, "oom_mark_victim")                    \
+    X(SCHED__PROCESS_SUMMARY, 2, sched__process_summary__payload, PAYLOAD_UPTO_FILENAME, "process_summary")  \
+    X(SYSCALL__OPENAT, 1031, syscall__sys_enter_openat__payload, PAYLOAD_UPTO_FILENAME, "openat")            \
+    X(VMSCAN__MM_VMSCAN_DIRECT_RECLAIM_END, 2049, event__no_payload, PAYLOAD_NONE, "direct_reclaim_end")     \
+    X(SCHED__PSI_MEMSTALL_LEAVE, 17, event__no_payload, PAYLOAD_NONE, "psi_memstall_leave")                  \
+    X(SCHED__SCHED_STATS, 4, sched__sched_stats__payload, PAYLOAD_WHOLE, "sched_stats")                      \
+    X(SCHED__SCHED_WAKEUP, 18, event__no_payload, PAYLOAD_NONE, "sched_wakeup")                              \
+    X(SCHED__SCHED_SWITCH, 19, event__no_payload, PAYLOAD_NONE, "sched_switch")                              \
+    X(PROFILE__CPU_SAMPLE, 4096, event__no_payload, PAYLOAD_NONE, "cpu_sample")                              \
+    X(BLOCK__BLOCK_IO_STATS, 5120, block__block_io_stats__payload, PAYLOAD_WHOLE, "block_io_stats")          \
+    X(BLOCK__BLOCK_RQ_ISSUE, 5121, event__no_payload, PAYLOAD_NONE, "block_rq_issue")                        \
+    X(BLOCK__BLOCK_RQ_COMPLETE, 5122, event__no_payload, PAYLOAD_NONE, "block_rq_complete")                  \
+    X(BLOCK__BLOCK_RQ_INSERT, 5123, event__no_payload, PAYLOAD_NONE, "block_rq_insert")
+
+#define EVENT_DERIVED(X)                                                                                     \
+    X(SCHED__PROCESS_SNAPSHOT, 3, sched__sched_process_exec__payload, PAYLOAD_UPTO_ARGV, "process_snapshot") \
+    X(VMSCAN__MEMORY_PRESSURE, 2050, vmscan__memory_pressure__payload, PAYLOAD_WHOLE, "memory_pressure")
+
+/* Values of the extent column */
+#define PAYLOAD_WHOLE(payload) sizeof(struct payload)
+#define PAYLOAD_NONE(payload) 0
+#define PAYLOAD_UPTO_ARGV(payload) __builtin_offsetof(struct payload, argv)
+#define PAYLOAD_UPTO_FILENAME(payload) __builtin_offsetof(struct payload, filename)
+
+/*
+ * Bumped when a payload changes in a way its extent does not show (fields
+ * reordered or retyped at the same size), so that EVENT_LAYOUT_HASH changes
+ */
+#define EVENT_SCHEMA_REVISION 1
+
+#endif /* EVENT_SCHEMA_H */
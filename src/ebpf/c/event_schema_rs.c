@@ -0,0 +1,48 @@
+// event_schema_rs.c
+/*
+ * Prints the Rust side of EVENT_SCHEMA (included by rs/types.rs): the event
+ * type constants, the extent of every payload as the C compiler lays it
+ * out, and EVENT_LAYOUT_HASH. The Rust mirrors of the payload structs
+ * assert their sizes against these at compile time. Built and run on the
+ * build host by the Makefile.
+ */
+#include <stddef.h>
+#include <stdio.h>
+
+#include "bootstrap.h"
+
+#define COUNT(name, value, payload, extent, label) +1
+
+int main(void)
+{
+	printf("// Generated from event_schema.h by event_schema_rs.c: do not edit\n\n");
+	printf("pub const EVENT_LAYOUT_HASH: u16 = %#x;\n", EVENT_LAYOUT_HASH);
+	printf("pub const EVENT_HEADER_LEN: usize = %zu;\n\n", sizeof(struct event_header));
+
+#define TYPE_CONST(name, value, payload, extent, label) \
+	printf("pub const EVENT__%s: u32 = %u;\n", #name, (unsigned int)(value));
+	EVENT_SCHEMA(TYPE_CONST)
+#undef TYPE_CONST
+
+	printf("\n// Payload bytes every record of the type carries, at least\n");
+#define EXTENT_CONST(name, value, payload, extent, label) \
+	printf("pub const PAYLOAD_EXTENT__%s: usize = %zu;\n", #name, (size_t)(extent(payload)));
+	EVENT_SCHEMA(EXTENT_CONST)
+#undef EXTENT_CONST
+
+	printf("\n// Every event type with a handler, in enum event_slot order\n");
+	printf("pub const EVENT_TYPES: [u32; %d] = [\n", 0 EVENT_HANDLED(COUNT));
+#define SLOT_ENTRY(name, value, payload, extent, label) printf("    EVENT__%s,\n", #name);
+	EVENT_HANDLED(SLOT_ENTRY)
+#undef SLOT_ENTRY
+	printf("];\n");
+
+	printf("\n// Label of every event type\n");
+	printf("pub const EVENT_LABELS: [(u32, &str); %d] = [\n", 0 EVENT_SCHEMA(COUNT));
+#define LABEL_ENTRY(name, value, payload, extent, label) printf("    (EVENT__%s, \"%s\"),\n", #name, label);
+	EVENT_SCHEMA(LABEL_ENTRY)
+#undef LABEL_ENTRY
+	printf("];\n");
+
+	return ferror(stdout) || fflush(stdout) ? 1 : 0;
+}
@@ -0,0 +1,168 @@
+// event_visit.hpp
+#ifndef EVENT_VISIT_HPP
+#define EVENT_VISIT_HPP
+
+/*
+ * Type-indexed decoding of framed records for C++ consumers, expanded from
+ * EVENT_SCHEMA. visit_event() calls the visitor with the record's type as a
+ * compile-time tag and its payload as the schema's struct, through a table
+ * built at compile time and indexed by type, so there is no switch over
+ * types to keep in step with the schema:
+ *
+ *   struct printer
+ *   {
+ *     template <event_type T>
+ *     void operator()(event_tag<T>, const event_header &h, const sched__sched_stats__payload &p);
+ *     template <event_type T, class P> // every other type
+ *     void operator()(event_tag<T>, const event_header &h, const P &p);
+ *   };
+ *   visit_event(*e, len, printer{});
+ *
+ * Types whose extent is PAYLOAD_NONE are passed an event__no_payload.
+ */
+
+#include <array>
+#include <cstddef>
+#include <type_traits>
+
+extern "C"
+{
+#include "bootstrap.h"
+}
+
+template <event_type T>
+using event_tag = std::integral_constant<event_type, T>;
+
+/* What EVENT_SCHEMA says about event type T */
+template <event_type T>
+struct event_traits;
+
+#define EVENT_TRAITS(n, v, p, e, l)                                                              \
+  template <>                                                                                    \
+  struct event_traits<EVENT__##n>                                                                \
+  {                                                                                              \
+    static constexpr size_t min_payload = e(p);                                                  \
+    using payload_type = std::conditional_t<min_payload == 0, struct event__no_payload, struct p>; \
+    static constexpr const char *label = l;                                                      \
+  };
+EVENT_SCHEMA(EVENT_TRAITS)
+#undef EVENT_TRAITS
+
+namespace event_detail
+{
+// Event types are (category << 10) | index; the table spans 32 per category
+constexpr unsigned int CATEGORY_SHIFT = 10;
+constexpr unsigned int TYPES_PER_CATEGORY = 32;
+
+constexpr unsigned int slot(unsigned int type)
+{
+  return (type >> CATEGORY_SHIFT) * TYPES_PER_CATEGORY + (type & ((1u << CATEGORY_SHIFT) - 1));
+}
+
+constexpr unsigned int types[] = {
+#define EVENT_VALUE(n, v, p, e, l) v,
+    EVENT_SCHEMA(EVENT_VALUE)
+#undef EVENT_VALUE
+};
+
+constexpr bool types_fit()
+{
+  for (unsigned int type : types)
+    if ((type & ((1u << CATEGORY_SHIFT) - 1)) >= TYPES_PER_CATEGORY)
+      return false;
+  return true;
+}
+static_assert(types_fit(), "an event index is past TYPES_PER_CATEGORY");
+
+constexpr unsigned int table_size()
+{
+  unsigned int n = 0;
+  for (unsigned int type : types)
+    n = slot(type) + 1 > n ? slot(type) + 1 : n;
+  return n;
+}
+
+// What every visitor needs about a slot: which type owns it, if any
+struct slot_info
+{
+  unsigned int type;
+  unsigned int min_len; // header and payload extent
+  const char *label;    // NULL = no type
+};
+
+struct schema_index
+{
+  std::array<slot_info, table_size()> slots{};
+
+  constexpr schema_index()
+  {
+#define EVENT_SLOT(n, v, p, e, l) \
+  slots[slot(v)] = {v, sizeof(event_header) + event_traits<EVENT__##n>::min_payload, l};
+    EVENT_SCHEMA(EVENT_SLOT)
+#undef EVENT_SLOT
+  }
+};
+
+inline constexpr schema_index schema{};
+
+template <event_type T, class V>
+void call(V &v, const event &e)
+{
+  using P = typename event_traits<T>::payload_type;
+  v(event_tag<T>{}, e.header,
+    *reinterpret_cast<const P *>(reinterpret_cast<const char *>(&e) + sizeof(event_header)));
+}
+
+template <class V>
+using thunk = void (*)(V &, const event &);
+
+template <class V>
+struct dispatch_table
+{
+  std::array<thunk<V>, table_size()> fns{};
+
+  constexpr dispatch_table()
+  {
+#define EVENT_THUNK(n, v, p, e, l) fns[slot(v)] = &call<EVENT__##n, V>;
+    EVENT_SCHEMA(EVENT_THUNK)
+#undef EVENT_THUNK
+  }
+};
+
+template <class V>
+inline constexpr dispatch_table<V> table{};
+} // namespace event_detail
+
+/* Label of an event type, or NULL for a type the schema does not have */
+constexpr const char *event_label(unsigned int type)
+{
+  const unsigned int s = event_detail::slot(type);
+
+  if (s >= event_detail::table_size() || event_detail::schema.slots[s].type != type)
+    return nullptr;
+  return event_detail::schema.slots[s].label;
+}
+
+/*
+ * Calls `v(event_tag<T>{}, e.header, payload)` for the record `e` of `len`
+ * bytes. Returns false without calling it for a type the schema does not
+ * have, a record shorter than its type's extent, or one stamped with
+ * another EVENT_LAYOUT_HASH.
+ */
+template <class V>
+bool visit_event(const event &e, size_t len, V &&v)
+{
+  using visitor = std::remove_reference_t<V>;
+  const unsigned int type = e.header.event_type;
+  const unsigned int s = event_detail::slot(type);
+
+  if (e.header.layout != EVENT_LAYOUT_HASH || s >= event_detail::table_size())
+    return false;
+  const auto &info = event_detail::schema.slots[s];
+  if (!info.label || info.type != type || len < info.min_len)
+    return false;
+  event_detail::table<visitor>.fns[s](v, e);
+  return true;
+}
+
+#endif /* EVENT_VISIT_HPP */
@@ -1,137 +1,728 @@
+#include <algorithm>
+#include <cerrno>
 #include <csignal>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <vector>
-#include "../../../vendor/nlohmann/json.hpp"
+#include <unistd.h>
 
 // C headers must stay in an extern "C" block to avoid name‑mangling
 extern "C"
 {
 #include "bootstrap.h"
 #include "bootstrap_api.h"
+#include "capture.h"
 }
+#include "event_visit.hpp"
 
 // ----------------------------------------------
 // Constants & Globals
 // ----------------------------------------------
-constexpr size_t BUFFER_SIZE = 1 * 1024 * 1024; // 1 MiB ring‑buffer
+constexpr size_t BUFFER_SIZE = 1 * 1024 * 1024; // 1 MiB ring‑buffer
+constexpr size_t OUTPUT_SIZE = 1 * 1024 * 1024; // NDJSON staged per write(2)
 static volatile sig_atomic_t exiting = 0;
 
 // ----------------------------------------------
-// Helper utilities
+// NDJSON writer
 // ----------------------------------------------
-static const char *event_type_to_string(event_type t)
+// Formats straight into one reusable buffer and hands it to write(2) in
+// large chunks: nothing is allocated per event. The output is byte-for-byte
+// what nlohmann::json::dump() produced before: keys in sorted order, no
+// whitespace, and the same string escapes.
+class ndjson_writer
 {
-  switch (t)
-  {
-  case EVENT__SCHED__SCHED_PROCESS_EXEC:
-    return "process_exec";
-  case EVENT__SCHED__SCHED_PROCESS_EXIT:
-    return "process_exit";
-  case EVENT__SYSCALL__SYS_ENTER_OPENAT:
-    return "sys_enter_openat";
-  case EVENT__SYSCALL__SYS_EXIT_OPENAT:
-    return "sys_exit_openat";
-  default:
-    return "unknown";
+public:
+  explicit ndjson_writer(int fd) : fd_(fd) {}
+  ~ndjson_writer()
+  {
+    flush();
+    std::free(buf_);
+  }
+
+  bool ok() const { return buf_ != nullptr; }
+
+  // Key prefixes and other fixed text, copied without a strlen()
+  template <size_t N>
+  void lit(const char (&s)[N])
+  {
+    raw(s, N - 1);
+  }
+
+  void raw(const char *s, size_t n)
+  {
+    reserve(n);
+    std::memcpy(buf_ + len_, s, n);
+    len_ += n;
+  }
+
+  void u64(uint64_t v)
+  {
+    static const char DIGITS[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char tmp[20];
+    char *p = tmp + sizeof(tmp);
+    while (v >= 100)
+    {
+      p -= 2;
+      std::memcpy(p, DIGITS + (v % 100) * 2, 2);
+      v /= 100;
+    }
+    if (v >= 10)
+    {
+      p -= 2;
+      std::memcpy(p, DIGITS + v * 2, 2);
+    }
+    else
+      *--p = char('0' + v);
+    raw(p, tmp + sizeof(tmp) - p);
+  }
+
+  void i64(int64_t v)
+  {
+    if (v < 0)
+    {
+      lit("-");
+      u64(0 - uint64_t(v));
+    }
+    else
+      u64(uint64_t(v));
+  }
+
+  // A quoted JSON string. Invalid UTF-8 becomes U+FFFD rather than aborting
+  // the logger (nlohmann's strict mode threw).
+  void str(const char *s, size_t n)
+  {
+    reserve(n * 6 + 2);
+    char *out = buf_ + len_;
+    *out++ = '"';
+    for (size_t i = 0; i < n;)
+    {
+      const unsigned char c = s[i];
+      if (c >= 0x80)
+      {
+        const size_t seq = utf8_sequence(reinterpret_cast<const unsigned char *>(s) + i, n - i);
+        if (seq)
+        {
+          std::memcpy(out, s + i, seq);
+          out += seq;
+          i += seq;
+        }
+        else
+        {
+          std::memcpy(out, "\xEF\xBF\xBD", 3);
+          out += 3;
+          i++;
+        }
+        continue;
+      }
+      switch (c)
+      {
+      case '"':
+        out = put2(out, '\\', '"');
+        break;
+      case '\\':
+        out = put2(out, '\\', '\\');
+        break;
+      case '\b':
+        out = put2(out, '\\', 'b');
+        break;
+      case '\f':
+        out = put2(out, '\\', 'f');
+        break;
+      case '\n':
+        out = put2(out, '\\', 'n');
+        break;
+      case '\r':
+        out = put2(out, '\\', 'r');
+        break;
+      case '\t':
+        out = put2(out, '\\', 't');
+        break;
+      default:
+        if (c < 0x20)
+        {
+          static const char HEX[] = "0123456789abcdef";
+          std::memcpy(out, "\\u00", 4);
+          out[4] = HEX[c >> 4];
+          out[5] = HEX[c & 0xF];
+          out += 6;
+        }
+        else
+          *out++ = char(c);
+      }
+      i++;
+    }
+    *out++ = '"';
+    len_ = out - buf_;
+  }
+
+  // Hands everything staged so far to the kernel
+  void flush()
+  {
+    size_t off = 0;
+    while (off < len_)
+    {
+      ssize_t n = ::write(fd_, buf_ + off, len_ - off);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+      {
+        std::perror("write");
+        break;
+      }
+      off += n;
+    }
+    len_ = 0;
+  }
+
+private:
+  static char *put2(char *out, char a, char b)
+  {
+    out[0] = a;
+    out[1] = b;
+    return out + 2;
+  }
+
+  // Length of the valid UTF-8 sequence starting at s, or 0 if invalid
+  static size_t utf8_sequence(const unsigned char *s, size_t avail)
+  {
+    size_t n;
+    unsigned char lo = 0x80, hi = 0xBF; // allowed range of the second byte
+    if (s[0] >= 0xC2 && s[0] <= 0xDF)
+      n = 2;
+    else if (s[0] >= 0xE0 && s[0] <= 0xEF)
+    {
+      n = 3;
+      if (s[0] == 0xE0)
+        lo = 0xA0;
+      else if (s[0] == 0xED)
+        hi = 0x9F;
+    }
+    else if (s[0] >= 0xF0 && s[0] <= 0xF4)
+    {
+      n = 4;
+      if (s[0] == 0xF0)
+        lo = 0x90;
+      else if (s[0] == 0xF4)
+        hi = 0x8F;
+    }
+    else
+      return 0;
+    if (avail < n || s[1] < lo || s[1] > hi)
+      return 0;
+    for (size_t i = 2; i < n; i++)
+      if ((s[i] & 0xC0) != 0x80)
+        return 0;
+    return n;
+  }
+
+  void reserve(size_t n)
+  {
+    if (len_ + n > OUTPUT_SIZE)
+      flush();
   }
+
+  int fd_;
+  char *buf_ = static_cast<char *>(std::malloc(OUTPUT_SIZE));
+  size_t len_ = 0;
+};
+
+// A log2 histogram as an array indexed by bucket, up to its last non-empty one
+static void write_hist(ndjson_writer &w, const latency_hist &h)
+{
+  int last = LATENCY_BUCKETS - 1;
+  while (last >= 0 && !h.buckets[last])
+    --last;
+  w.lit("[");
+  for (int b = 0; b <= last; ++b)
+  {
+    if (b)
+      w.lit(",");
+    w.u64(h.buckets[b]);
+  }
+  w.lit("]");
+}
+
+// Header fields that sort after the payload keys of most events
+static void write_header_tail(ndjson_writer &w, const event_header &h)
+{
+  w.lit(",\"pid\":");
+  w.u64(h.pid);
+  w.lit(",\"ppid\":");
+  w.u64(h.ppid);
+  w.lit(",\"timestamp_ns\":");
+  w.u64(h.timestamp_ns);
+  w.lit(",\"upid\":");
+  w.u64(h.upid);
+  w.lit(",\"uppid\":");
+  w.u64(h.uppid);
 }
 
-static void print_event_json(const event *e)
+// Writes one record as a JSON object, keys in sorted order as std::map-backed
+// nlohmann::json did. Overloads are picked by payload struct, so types that
+// share a layout share an overload; visit_event() calls the matching one.
+struct json_event_writer
 {
-  using json = nlohmann::json;
-  json j;
+  ndjson_writer &w;
 
-  // Common fields
-  j["event_type"] = event_type_to_string(e->event_type);
-  j["timestamp_ns"] = e->timestamp_ns;
-  j["pid"] = e->pid;
-  j["ppid"] = e->ppid;
-  j["upid"] = e->upid;
-  j["uppid"] = e->uppid;
+  template <event_type T>
+  void operator()(event_tag<T>, const event_header &h, const sched__sched_process_exec__payload &p)
+  {
+    w.lit("{\"argc\":");
+    w.u64(p.argc);
+    w.lit(",\"argv\":[");
+    // argv is packed as NUL-separated strings, argv_len bytes in total
+    size_t off = 0;
+    const size_t argv_len = std::min<size_t>(p.argv_len, sizeof(p.argv));
+    for (u32 i = 0; i < p.argc && off < argv_len; ++i)
+    {
+      size_t n = strnlen(p.argv + off, argv_len - off);
+      if (i)
+        w.lit(",");
+      w.str(p.argv + off, n);
+      off += n + 1;
+    }
+    w.lit("],\"comm\":");
+    w.str(p.comm, strnlen(p.comm, sizeof(p.comm)));
+    event_type_key(event_tag<T>{});
+    write_header_tail(w, h);
+  }
+
+  template <event_type T>
+  void operator()(event_tag<T>, const event_header &h, const sched__process_summary__payload &p)
+  {
+    // Its keys interleave with the header's
+    w.lit("{\"comm\":");
+    w.str(p.comm, strnlen(p.comm, sizeof(p.comm)));
+    w.lit(",\"cpu_ns\":");
+    w.u64(p.cpu_ns);
+    event_type_key(event_tag<T>{});
+    w.lit(",\"execed\":");
+    if (p.flags & PROCESS_SUMMARY_EXECED)
+      w.lit("true");
+    else
+      w.lit("false");
+    w.lit(",\"filename\":");
+    w.str(p.filename, strnlen(p.filename, sizeof(p.filename)));
+    w.lit(",\"max_rss_kb\":");
+    w.u64(p.max_rss_kb);
+    w.lit(",\"pid\":");
+    w.u64(h.pid);
+    w.lit(",\"ppid\":");
+    w.u64(h.ppid);
+    w.lit(",\"start_ns\":");
+    w.u64(p.start_ns);
+    w.lit(",\"status\":");
+    w.i64(p.status);
+    w.lit(",\"stime_ns\":");
+    w.u64(p.stime_ns);
+    w.lit(",\"timestamp_ns\":");
+    w.u64(h.timestamp_ns);
+    w.lit(",\"upid\":");
+    w.u64(h.upid);
+    w.lit(",\"uppid\":");
+    w.u64(h.uppid);
+    w.lit(",\"utime_ns\":");
+    w.u64(p.utime_ns);
+  }
+
+  template <event_type T>
+  void operator()(event_tag<T>, const event_header &h, const syscall__sys_enter_openat__payload &p)
+  {
+    const bool info = p.filename_flags & OPENAT_FILE_INFO;
+    w.lit("{\"dfd\":");
+    w.i64(p.dfd);
+    if (info)
+    {
+      w.lit(",\"dev\":");
+      w.u64(p.dev);
+    }
+    event_type_key(event_tag<T>{});
+    if constexpr (T == EVENT__SYSCALL__OPENAT) // plus the result
+    {
+      w.lit(",\"fd\":");
+      w.i64(p.ret);
+    }
+    w.lit(",\"filename\":");
+    w.str(p.filename, strnlen(p.filename, sizeof(p.filename)));
+    w.lit(",\"flags\":");
+    w.i64(p.flags);
+    if (info)
+    {
+      w.lit(",\"ino\":");
+      w.u64(p.ino);
+    }
+    w.lit(",\"mode\":");
+    w.i64(p.mode);
+    if (info)
+    {
+      w.lit(",\"size\":");
+      w.u64(p.size);
+    }
+    write_header_tail(w, h);
+  }
+
+  template <event_type T>
+  void operator()(event_tag<T>, const event_header &h, const syscall__sys_exit_openat__payload &p)
+  {
+    w.lit("{");
+    event_type_key(event_tag<T>{}, false);
+    w.lit(",\"fd\":");
+    w.i64(p.fd);
+    write_header_tail(w, h);
+  }
+
+  template <event_type T>
+  void operator()(event_tag<T>, const event_header &h, const vmscan__memory_pressure__payload &p)
+  {
+    // Its keys interleave with the header's
+    w.lit("{");
+    event_type_key(event_tag<T>{}, false);
+    w.lit(",\"interval_ns\":");
+    w.u64(p.interval_ns);
+    w.lit(",\"memstall_count\":");
+    w.u64(p.memstall_count);
+    w.lit(",\"memstall_ns\":");
+    w.u64(p.memstall_ns);
+    w.lit(",\"pid\":");
+    w.u64(h.pid);
+    w.lit(",\"ppid\":");
+    w.u64(h.ppid);
+    w.lit(",\"reclaim_count\":");
+    w.u64(p.reclaim_count);
+    w.lit(",\"reclaim_ns\":");
+    w.u64(p.reclaim_ns);
+    w.lit(",\"reclaimed_pages\":");
+    w.u64(p.reclaimed_pages);
+    w.lit(",\"timestamp_ns\":");
+    w.u64(h.timestamp_ns);
+    w.lit(",\"upid\":");
+    w.u64(h.upid);
+    w.lit(",\"uppid\":");
+    w.u64(h.uppid);
+  }
 
-  // Variant payload
-  switch (e->event_type)
+  template <event_type T>
+  void operator()(event_tag<T>, const event_header &h, const syscall__io_summary__payload &p)
   {
-  case EVENT__SCHED__SCHED_PROCESS_EXEC:
+    // Its keys interleave with the header's
+    w.lit("{");
+    event_type_key(event_tag<T>{}, false);
+    w.lit(",\"openat_calls\":");
+    w.u64(p.openat_calls);
+    w.lit(",\"openat_failures\":");
+    w.u64(p.openat_failures);
+    w.lit(",\"pid\":");
+    w.u64(h.pid);
+    w.lit(",\"ppid\":");
+    w.u64(h.ppid);
+    w.lit(",\"read_bytes\":");
+    w.u64(p.read_bytes);
+    w.lit(",\"read_calls\":");
+    w.u64(p.read_calls);
+    w.lit(",\"timestamp_ns\":");
+    w.u64(h.timestamp_ns);
+    w.lit(",\"upid\":");
+    w.u64(h.upid);
+    w.lit(",\"uppid\":");
+    w.u64(h.uppid);
+    w.lit(",\"write_bytes\":");
+    w.u64(p.write_bytes);
+    w.lit(",\"write_calls\":");
+    w.u64(p.write_calls);
+  }
+
+  template <event_type T>
+  void operator()(event_tag<T>, const event_header &h, const sched__sched_stats__payload &p)
   {
-    const auto &p = e->sched__sched_process_exec__payload;
-    j["comm"] = p.comm;
-    j["argc"] = p.argc;
-    std::vector<std::string> argv;
-    for (int i = 0; i < p.argc && i < MAX_ARR_LEN; ++i)
-      argv.emplace_back(p.argv[i]);
-    j["argv"] = argv;
-    break;
+    // Its keys interleave with the header's too
+    w.lit("{");
+    event_type_key(event_tag<T>{}, false);
+    w.lit(",\"oncpu\":");
+    write_hist(w, p.oncpu);
+    w.lit(",\"oncpu_ns\":");
+    w.u64(p.oncpu_ns);
+    w.lit(",\"pid\":");
+    w.u64(h.pid);
+    w.lit(",\"ppid\":");
+    w.u64(h.ppid);
+    w.lit(",\"preemptions\":");
+    w.u64(p.preemptions);
+    w.lit(",\"runq_delay\":");
+    write_hist(w, p.runq_delay);
+    w.lit(",\"runq_ns\":");
+    w.u64(p.runq_ns);
+    w.lit(",\"timestamp_ns\":");
+    w.u64(h.timestamp_ns);
+    w.lit(",\"upid\":");
+    w.u64(h.upid);
+    w.lit(",\"uppid\":");
+    w.u64(h.uppid);
   }
-  case EVENT__SYSCALL__SYS_ENTER_OPENAT:
+
+  template <event_type T>
+  void operator()(event_tag<T>, const event_header &h, const block__block_io_stats__payload &p)
   {
-    const auto &p = e->syscall__sys_enter_openat__payload;
-    j["dfd"] = p.dfd;
-    j["filename"] = p.filename;
-    j["flags"] = p.flags;
-    j["mode"] = p.mode;
-    break;
+    // Its keys interleave with the header's too
+    w.lit("{\"errors\":");
+    w.u64(p.errors);
+    event_type_key(event_tag<T>{});
+    w.lit(",\"pid\":");
+    w.u64(h.pid);
+    w.lit(",\"ppid\":");
+    w.u64(h.ppid);
+    w.lit(",\"read_bytes\":");
+    w.u64(p.read_bytes);
+    w.lit(",\"read_latency\":");
+    write_hist(w, p.read_latency);
+    w.lit(",\"read_ns\":");
+    w.u64(p.read_ns);
+    w.lit(",\"reads\":");
+    w.u64(p.reads);
+    w.lit(",\"timestamp_ns\":");
+    w.u64(h.timestamp_ns);
+    w.lit(",\"upid\":");
+    w.u64(h.upid);
+    w.lit(",\"uppid\":");
+    w.u64(h.uppid);
+    w.lit(",\"write_bytes\":");
+    w.u64(p.write_bytes);
+    w.lit(",\"write_latency\":");
+    write_hist(w, p.write_latency);
+    w.lit(",\"write_ns\":");
+    w.u64(p.write_ns);
+    w.lit(",\"writes\":");
+    w.u64(p.writes);
   }
-  case EVENT__SYSCALL__SYS_EXIT_OPENAT:
+
+  // Every other type: nothing extra to add
+  template <event_type T, class P>
+  void operator()(event_tag<T>, const event_header &h, const P &)
   {
-    const auto &p = e->syscall__sys_exit_openat__payload;
-    j["fd"] = p.fd;
-    break;
+    w.lit("{");
+    event_type_key(event_tag<T>{}, false);
+    write_header_tail(w, h);
   }
-  default:
-    break; // nothing extra to add
+
+  // The "event_type" key, from the schema's label of T
+  template <event_type T>
+  void event_type_key(event_tag<T>, bool comma = true)
+  {
+    constexpr const char *label = event_traits<T>::label;
+    if (comma)
+      w.lit(",");
+    w.lit("\"event_type\":\"");
+    w.raw(label, std::strlen(label));
+    w.lit("\"");
   }
+};
 
-  std::cout << j.dump() << '\n';
+static void write_event_json(ndjson_writer &w, const event *e, size_t len)
+{
+  if (!visit_event(*e, len, json_event_writer{w}))
+  {
+    // A type this build does not know (or a record cut short)
+    w.lit("{\"event_type\":\"unknown\"");
+    write_header_tail(w, e->header);
+  }
+  w.lit("}\n");
 }
 
 // ----------------------------------------------
 // Ring‑buffer consumer callback
 // ----------------------------------------------
+struct logger_ctx
+{
+  char *buffer;
+  ndjson_writer *out;
+  capture_writer *capture; // records go to a capture file instead of stdout
+  int error;
+};
+
 static void process_events(void *ctx, size_t bytes)
 {
-  auto *buffer = static_cast<char *>(ctx);
+  auto *lc = static_cast<logger_ctx *>(ctx);
   size_t pos = 0;
 
-  while (pos + sizeof(event) <= bytes)
+  // Records are variable-length; step by the length in each header
+  while (pos + sizeof(event_header) <= bytes)
   {
-    const auto *ev = reinterpret_cast<const event *>(buffer + pos);
-    print_event_json(ev);
-    pos += sizeof(event);
+    const auto *ev = reinterpret_cast<const event *>(lc->buffer + pos);
+    const size_t len = ev->header.len;
+    if (len < sizeof(event_header) || pos + len > bytes)
+    {
+      std::fprintf(stderr, "[warn] malformed record at offset %zu\n", pos);
+      break;
+    }
+    if (!lc->capture)
+      write_event_json(*lc->out, ev, len);
+    else if (!lc->error)
+      lc->error = capture_writer__append(lc->capture, ev, len);
+    pos += len;
   }
 
   if (pos < bytes)
     std::fprintf(stderr, "[warn] %zu trailing bytes\n", bytes - pos);
+
+  // One write per poll pass (or per full output buffer)
+  lc->out->flush();
 }
 
 static void sig_handler(int) { exiting = 1; }
 
+// ----------------------------------------------
+// Command line
+// ----------------------------------------------
+struct options
+{
+  const char *capture_path = nullptr; // --capture FILE
+  capture_codec codec = CAPTURE_CODEC_NONE;
+  const char *replay_path = nullptr; // --replay FILE
+  double speed = 1.0;
+};
+
+static void usage(const char *prog)
+{
+  std::fprintf(stderr,
+               "usage: %s                                  log live events as NDJSON\n"
+               "       %s --capture FILE [--codec none|lz4|zstd]  record live events\n"
+               "       %s --replay FILE [--speed X]          log a capture as NDJSON\n"
+               "                                            (X = 0 for maximum speed)\n",
+               prog, prog, prog);
+}
+
+static bool parse_args(int argc, char **argv, options &o)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    const bool has_value = i + 1 < argc;
+    if (!std::strcmp(argv[i], "--capture") && has_value)
+      o.capture_path = argv[++i];
+    else if (!std::strcmp(argv[i], "--replay") && has_value)
+      o.replay_path = argv[++i];
+    else if (!std::strcmp(argv[i], "--speed") && has_value)
+      o.speed = std::strtod(argv[++i], nullptr);
+    else if (!std::strcmp(argv[i], "--codec") && has_value)
+    {
+      const char *c = argv[++i];
+      if (!std::strcmp(c, "none"))
+        o.codec = CAPTURE_CODEC_NONE;
+      else if (!std::strcmp(c, "lz4"))
+        o.codec = CAPTURE_CODEC_LZ4;
+      else if (!std::strcmp(c, "zstd"))
+        o.codec = CAPTURE_CODEC_ZSTD;
+      else
+        return false;
+    }
+    else
+      return false;
+  }
+  return !(o.capture_path && o.replay_path);
+}
+
+// Offline: feed a capture through the same callback as live events
+static int replay(const options &o, logger_ctx &lc)
+{
+  const capture_replay_opts ropts{o.speed};
+  long n = capture_replay(o.replay_path, lc.buffer, BUFFER_SIZE, &ropts, process_events, &lc,
+                          nullptr);
+  lc.out->flush();
+  if (n < 0)
+  {
+    std::fprintf(stderr, "replay of %s failed: %s\n", o.replay_path, std::strerror(-n));
+    return EXIT_FAILURE;
+  }
+  std::fprintf(stderr, "Replayed %ld records\n", n);
+  return EXIT_SUCCESS;
+}
+
 // ----------------------------------------------
 // main()
 // ----------------------------------------------
-int main()
+int main(int argc, char **argv)
 {
+  options o;
+  if (!parse_args(argc, argv, o))
+  {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
   // Allocate a user‑space buffer that the bootstrap.c helper will fill
   void *buf = std::malloc(BUFFER_SIZE);
-  if (!buf)
+  ndjson_writer out(STDOUT_FILENO);
+  if (!buf || !out.ok())
   {
     std::perror("malloc");
+    std::free(buf);
     return EXIT_FAILURE;
   }
+  logger_ctx lc{static_cast<char *>(buf), &out, nullptr, 0};
+
+  if (o.replay_path)
+  {
+    int rc = replay(o, lc);
+    std::free(buf);
+    return rc;
+  }
 
   std::signal(SIGINT, sig_handler);
   std::signal(SIGTERM, sig_handler);
 
-  std::cout << "Starting eBPF event logger – press Ctrl+C to stop...\n";
+  tracer *t = tracer_open(nullptr);
+  if (!t)
+  {
+    std::perror("tracer_open");
+    std::free(buf);
+    return EXIT_FAILURE;
+  }
+
+  if (o.capture_path)
+  {
+    lc.capture = capture_writer__open(o.capture_path, o.codec, tracer_system_boot_ns(t));
+    if (!lc.capture)
+    {
+      std::fprintf(stderr, "cannot create %s: %s\n", o.capture_path, std::strerror(errno));
+      tracer_destroy(t);
+      std::free(buf);
+      return EXIT_FAILURE;
+    }
+  }
+
+  // Zeroed thresholds: one callback per poll pass rather than per event
+  const batch_opts batch{};
+  int err = tracer_set_callback(t, buf, BUFFER_SIZE, &batch, process_events, &lc);
+  if (!err)
+    err = tracer_attach(t);
 
-  int err = initialize(buf, BUFFER_SIZE, process_events, buf);
+  // Events bypass std::cout, so don't leave this sitting in its buffer
+  if (!err)
+    std::cout << "Starting eBPF event logger – press Ctrl+C to stop..." << std::endl;
+  while (!err && !exiting)
+  {
+    int n = tracer_poll(t, 200 /* timeout, ms */);
+    if (n < 0)
+      err = n;
+    else if (lc.error)
+      err = lc.error;
+  }
 
+  tracer_destroy(t);
+  if (lc.capture)
+  {
+    int cerr = capture_writer__close(lc.capture);
+    if (!err)
+      err = cerr ? cerr : lc.error;
+  }
+  out.flush();
   std::free(buf);
   if (err)
   {
-    std::fprintf(stderr, "initialize() failed: %d\n", err);
+    std::fprintf(stderr, "tracer failed: %d\n", err);
     return EXIT_FAILURE;
   }
   std::cout << "Exiting cleanly\n";
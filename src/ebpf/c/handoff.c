@@ -0,0 +1,253 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bootstrap.h"
+#include "handoff.h"
+#include "spill.h"
+
+#define HANDOFF_FULL_BACKOFF_NS (50ULL * 1000) /* consumer hasn't caught up */
+
+struct handoff
+{
+	struct tracer_handoff ring; // first, so it keeps its cache-line alignment
+	pthread_t thread;
+	bool started;
+	atomic_bool stop;
+	struct spill *spill; // where records go while the ring is full; NULL = wait for room
+};
+
+struct handoff *handoff__new(size_t size)
+{
+	struct handoff *h;
+	void *mem;
+	int err;
+
+	if (size < HANDOFF_MIN_SIZE || size & (size - 1))
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	err = posix_memalign(&mem, TRACER_HANDOFF_ALIGN, sizeof(*h));
+	if (err)
+	{
+		errno = err;
+		return NULL;
+	}
+	h = mem;
+	memset(h, 0, sizeof(*h));
+	h->ring.size = size;
+	h->ring.wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (h->ring.wakeup_fd < 0)
+		goto fail;
+	err = posix_memalign(&mem, TRACER_HANDOFF_ALIGN, size);
+	if (err)
+	{
+		errno = err;
+		goto fail;
+	}
+	h->ring.data = mem;
+	return h;
+
+fail:
+	err = errno;
+	handoff__free(h);
+	errno = err;
+	return NULL;
+}
+
+void handoff__free(struct handoff *h)
+{
+	if (!h)
+		return;
+	handoff__stop(h);
+	if (h->ring.wakeup_fd >= 0)
+		close(h->ring.wakeup_fd);
+	free(h->ring.data);
+	spill__free(h->spill);
+	free(h);
+}
+
+struct tracer_handoff *handoff__ring(struct handoff *h)
+{
+	return &h->ring;
+}
+
+int handoff__start(struct handoff *h, void *(*fn)(void *), void *arg)
+{
+	int err = pthread_create(&h->thread, NULL, fn, arg);
+
+	if (err)
+		return -err;
+	h->started = true;
+	return 0;
+}
+
+void handoff__stop(struct handoff *h)
+{
+	if (!h->started)
+		return;
+	atomic_store(&h->stop, true);
+	pthread_join(h->thread, NULL);
+	atomic_store(&h->stop, false);
+	h->started = false;
+}
+
+bool handoff__stopping(const struct handoff *h)
+{
+	return atomic_load_explicit(&h->stop, memory_order_relaxed);
+}
+
+// Publishes the slots up to `head`, `shown` being the previous head, and
+// wakes the consumer if it had drained everything before them. Pairs with
+// the tail store and head load around tracer_handoff_wait(): one of the two
+// sides sees the other.
+static void publish(struct tracer_handoff *r, unsigned long long shown, unsigned long long head)
+{
+	__atomic_store_n(&r->head, head, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) == shown)
+	{
+		uint64_t one = 1;
+
+		if (write(r->wakeup_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+			fprintf(stderr, "C: handoff wakeup failed: %d\n", -errno);
+	}
+}
+
+static size_t slot_span(u32 size)
+{
+	return (TRACER_HANDOFF_HDR + size + TRACER_HANDOFF_ALIGN - 1) & ~(size_t)(TRACER_HANDOFF_ALIGN - 1);
+}
+
+// Copies a record into the slot at `head` if the consumer has left room for
+// it. Returns the head past it, or `head` if there is no room.
+static unsigned long long put(struct tracer_handoff *r, unsigned long long head, const void *data, u32 size)
+{
+	const size_t span = slot_span(size);
+	size_t off = head & (r->size - 1);
+	size_t pad = r->size - off < span ? r->size - off : 0; // slots never wrap
+
+	if (head + pad + span - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) > r->size)
+		return head;
+	if (pad)
+	{
+		*(u32 *)(r->data + off) = TRACER_HANDOFF_WRAP;
+		head += pad;
+		off = 0;
+	}
+	*(u32 *)(r->data + off) = size;
+	memcpy(r->data + off + TRACER_HANDOFF_HDR, data, size);
+	return head + span;
+}
+
+// Moves spilled records into the ring, oldest first, while they fit
+static unsigned long long refill(struct handoff *h, unsigned long long head)
+{
+	const void *data;
+	u32 size;
+
+	while ((data = spill__front(h->spill, &size)))
+	{
+		unsigned long long next = put(&h->ring, head, data, size);
+
+		if (next == head)
+			break;
+		spill__pop(h->spill);
+		head = next;
+	}
+	return head;
+}
+
+size_t handoff__push(void *ctx, const struct event_view *views, size_t count)
+{
+	struct handoff *h = ctx;
+	struct tracer_handoff *r = &h->ring;
+	const struct timespec backoff = {0, HANDOFF_FULL_BACKOFF_NS};
+	unsigned long long shown = r->head, head = shown, next;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		// Records wait their turn behind the spilled ones
+		if (h->spill && !spill__empty(h->spill))
+		{
+			head = refill(h, head);
+			if (!spill__empty(h->spill))
+			{
+				spill__append(h->spill, views[i].data, views[i].size);
+				continue;
+			}
+		}
+
+		while ((next = put(r, head, views[i].data, views[i].size)) == head)
+		{
+			if (h->spill)
+			{
+				spill__append(h->spill, views[i].data, views[i].size);
+				break;
+			}
+			if (handoff__stopping(h))
+				return count;
+			// The consumer can only release what it has been shown
+			if (shown != head)
+			{
+				publish(r, shown, head);
+				shown = head;
+			}
+			nanosleep(&backoff, NULL);
+		}
+		head = next;
+	}
+	if (shown != head)
+		publish(r, shown, head);
+	return count;
+}
+
+bool handoff__refill(struct handoff *h)
+{
+	struct tracer_handoff *r = &h->ring;
+	unsigned long long head;
+
+	if (!h->spill || spill__empty(h->spill))
+		return true;
+	head = refill(h, r->head);
+	if (head != r->head)
+		publish(r, r->head, head);
+	return spill__empty(h->spill);
+}
+
+void handoff__set_spill(struct handoff *h, struct spill *s)
+{
+	spill__free(h->spill);
+	h->spill = s;
+}
+
+const struct spill *handoff__spill(const struct handoff *h)
+{
+	return h->spill;
+}
+
+int tracer_handoff_wait(struct tracer_handoff *r, int timeout_ms)
+{
+	struct pollfd pfd = {.fd = r->wakeup_fd, .events = POLLIN};
+	uint64_t wakeups;
+	int n;
+
+	// Clear before checking, so a push after the check still wakes the poll
+	if (read(r->wakeup_fd, &wakeups, sizeof(wakeups)) < 0 && errno != EAGAIN)
+		return -errno;
+	if (__atomic_load_n(&r->head, __ATOMIC_SEQ_CST) != __atomic_load_n(&r->tail, __ATOMIC_RELAXED))
+		return 1;
+	n = poll(&pfd, 1, timeout_ms);
+	if (n < 0)
+		return errno == EINTR ? 0 : -errno;
+	return n > 0;
+}
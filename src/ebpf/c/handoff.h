@@ -0,0 +1,63 @@
+#ifndef __HANDOFF_H
+#define __HANDOFF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bootstrap_api.h"
+
+/*
+ * Producer side of a struct tracer_handoff (bootstrap_api.h): the ring, and
+ * the thread that fills it.
+ */
+struct handoff;
+
+#define HANDOFF_MIN_SIZE (1024 * 1024)
+
+/* `size` is a power of two of at least HANDOFF_MIN_SIZE. Returns NULL with errno set. */
+struct handoff *handoff__new(size_t size);
+
+/* Stops the thread, if running, then frees the ring. Accepts NULL. */
+void handoff__free(struct handoff *h);
+
+/* What the consumer sees */
+struct tracer_handoff *handoff__ring(struct handoff *h);
+
+/*
+ * Runs `fn(arg)` on the producer thread, which should return once
+ * handoff__stopping(). Returns 0 or a negative errno.
+ */
+int handoff__start(struct handoff *h, void *(*fn)(void *), void *arg);
+
+/* Asks the producer thread to return and joins it. No-op if not running. */
+void handoff__stop(struct handoff *h);
+
+bool handoff__stopping(const struct handoff *h);
+
+/*
+ * event_view_callback_t (ctx = the handoff): copies the records into the
+ * ring. When it is full, they go to the spill if there is one, and
+ * otherwise it waits for room while the consumer catches up; once
+ * stopping, the records that don't fit are discarded.
+ */
+size_t handoff__push(void *ctx, const struct event_view *views, size_t count);
+
+struct spill; /* spill.h */
+
+/*
+ * Have records that don't fit in the ring queue in `s` (owned from here
+ * on) instead of waiting for room, to be moved back in order as the
+ * consumer catches up. Call before handoff__start().
+ */
+void handoff__set_spill(struct handoff *h, struct spill *s);
+
+/* The spill, or NULL */
+const struct spill *handoff__spill(const struct handoff *h);
+
+/*
+ * From the producer thread: moves what fits of the spill into the ring.
+ * Returns whether the spill is empty (or there is none).
+ */
+bool handoff__refill(struct handoff *h);
+
+#endif /* __HANDOFF_H */
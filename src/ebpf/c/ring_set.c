@@ -0,0 +1,417 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "ring_set.h"
+
+#define RING_THREAD_POLL_MS 100 /* how often consumer threads check for shutdown */
+#define QUEUE_FULL_BACKOFF_NS (50ULL * 1000) /* merging thread hasn't caught up */
+#define QUEUE_HDR 8 /* u32 record length, padded so records stay 8-aligned */
+#define QUEUE_WRAP 0xFFFFFFFFu /* length marking the unused tail of the queue */
+#define CACHE_LINE 64
+
+// One kernel ring, its consumer thread and the queue between that thread
+// (producer) and the merging thread (consumer)
+struct ring_consumer
+{
+	struct ring_set *set;
+	unsigned int idx;
+	int map_fd;
+	struct ring_buffer *rb;
+	pthread_t thread;
+	bool started;
+
+	char *data;
+	size_t mask; // queue size - 1 (a power of two)
+
+	// Queue positions grow without bound; each side writes only its own
+	_Alignas(CACHE_LINE) atomic_ulong head; // written by the consumer thread
+	_Alignas(CACHE_LINE) atomic_ulong tail; // written by the merging thread
+
+	// Merging thread only: position and timestamp of the next unmerged record
+	_Alignas(CACHE_LINE) unsigned long cursor;
+	u64 head_ts;
+};
+
+struct ring_set
+{
+	unsigned int count;
+	struct ring_consumer *c;
+	unsigned int *heap; // queues with an unmerged record, by head_ts
+	size_t heap_len;
+	atomic_bool stop;
+	int efd;
+	clockid_t clock;
+	u64 clock_offset_ns;
+};
+
+static u64 clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* -------------------------------------------------------------------------- */
+/* Consumer threads                                                           */
+/* -------------------------------------------------------------------------- */
+
+// ring_buffer sample callback: copies one record into the queue, waiting for
+// room if the merging thread has fallen behind (the kernel ring then absorbs
+// the backlog, and sheds or drops once it is full)
+static int queue_push(void *ctx, void *data, size_t len)
+{
+	struct ring_consumer *c = ctx;
+	const size_t size = c->mask + 1;
+	const size_t span = QUEUE_HDR + ((len + 7) & ~7UL);
+	const struct timespec backoff = {0, QUEUE_FULL_BACKOFF_NS};
+	unsigned long start = atomic_load_explicit(&c->head, memory_order_relaxed);
+	unsigned long head = start;
+	size_t off = head & c->mask;
+	size_t pad = size - off < span ? size - off : 0; // records never wrap
+
+	while (head + pad + span - atomic_load(&c->tail) > size)
+	{
+		if (atomic_load_explicit(&c->set->stop, memory_order_relaxed))
+			return -ECANCELED;
+		nanosleep(&backoff, NULL);
+	}
+
+	if (pad)
+	{
+		*(u32 *)(c->data + off) = QUEUE_WRAP;
+		head += pad;
+		off = 0;
+	}
+	*(u32 *)(c->data + off) = len;
+	memcpy(c->data + off + QUEUE_HDR, data, len);
+	atomic_store(&c->head, head + span);
+
+	// Wake the merging thread if it had drained this queue. Pairs with the
+	// tail store in ring_set__ack(): one of the two sides sees the other.
+	if (atomic_load(&c->tail) == start)
+	{
+		uint64_t one = 1;
+
+		if (write(c->set->efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+			return -errno;
+	}
+	return 0;
+}
+
+static void *consume_ring(void *arg)
+{
+	struct ring_consumer *c = arg;
+
+	while (!atomic_load_explicit(&c->set->stop, memory_order_relaxed))
+	{
+		int n = ring_buffer__poll(c->rb, RING_THREAD_POLL_MS);
+		// Records submitted without a wakeup never make the fd readable
+		if (n == 0)
+			n = ring_buffer__consume(c->rb);
+		if (n < 0 && n != -EINTR && n != -ECANCELED)
+		{
+			fprintf(stderr, "C: ring %u poll error %d\n", c->idx, n);
+			break;
+		}
+	}
+	return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+/* Lifecycle                                                                  */
+/* -------------------------------------------------------------------------- */
+
+struct ring_set *ring_set__new(int outer_fd, unsigned int count, size_t ring_size,
+							   clockid_t clock, unsigned long long clock_offset_ns)
+{
+	struct ring_set *s;
+	void *mem;
+	int err;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+	s->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	s->clock = clock;
+	s->clock_offset_ns = clock_offset_ns;
+	s->heap = calloc(count, sizeof(*s->heap));
+	if (s->efd < 0 || !s->heap)
+	{
+		err = -errno;
+		goto fail;
+	}
+	// Queue positions are cache-line aligned, so the array must be too
+	err = -posix_memalign(&mem, CACHE_LINE, count * sizeof(*s->c));
+	if (err)
+		goto fail;
+	s->c = memset(mem, 0, count * sizeof(*s->c));
+	s->count = count;
+	for (unsigned int i = 0; i < count; i++)
+		s->c[i].map_fd = -1;
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		struct ring_consumer *c = &s->c[i];
+
+		c->set = s;
+		c->idx = i;
+		c->map_fd = bpf_map_create(BPF_MAP_TYPE_RINGBUF, "tracer_ring", 0, 0, ring_size, NULL);
+		if (c->map_fd < 0 || bpf_map_update_elem(outer_fd, &i, &c->map_fd, BPF_ANY))
+		{
+			err = -errno;
+			fprintf(stderr, "C: failed to create ring %u: %d\n", i, err);
+			goto fail;
+		}
+		// The queue holds as much again as the kernel ring
+		c->data = malloc(ring_size);
+		c->mask = ring_size - 1;
+		c->rb = ring_buffer__new(c->map_fd, queue_push, c, NULL);
+		if (!c->data || !c->rb)
+		{
+			err = -errno;
+			goto fail;
+		}
+	}
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		err = -pthread_create(&s->c[i].thread, NULL, consume_ring, &s->c[i]);
+		if (err)
+			goto fail;
+		s->c[i].started = true;
+	}
+	return s;
+
+fail:
+	ring_set__free(s);
+	errno = -err;
+	return NULL;
+}
+
+void ring_set__free(struct ring_set *s)
+{
+	if (!s)
+		return;
+	atomic_store(&s->stop, true);
+	for (unsigned int i = 0; i < s->count; i++)
+	{
+		struct ring_consumer *c = &s->c[i];
+
+		if (c->started)
+			pthread_join(c->thread, NULL);
+		ring_buffer__free(c->rb);
+		if (c->map_fd >= 0)
+			close(c->map_fd);
+		free(c->data);
+	}
+	if (s->efd >= 0)
+		close(s->efd);
+	free(s->c);
+	free(s->heap);
+	free(s);
+}
+
+int ring_set__wakeup_fd(const struct ring_set *s)
+{
+	return s->efd;
+}
+
+void ring_set__clear_wakeup(struct ring_set *s)
+{
+	uint64_t count;
+
+	if (read(s->efd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		fprintf(stderr, "C: wakeup read failed: %d\n", -errno);
+}
+
+/* -------------------------------------------------------------------------- */
+/* Merge                                                                      */
+/* -------------------------------------------------------------------------- */
+
+// The record at the queue's cursor, or NULL if the queue is drained
+static const struct event_header *queue_front(struct ring_consumer *c, u32 *len)
+{
+	for (;;)
+	{
+		if (c->cursor == atomic_load(&c->head))
+			return NULL;
+		*len = *(const u32 *)(c->data + (c->cursor & c->mask));
+		if (*len != QUEUE_WRAP)
+			return (const void *)(c->data + (c->cursor & c->mask) + QUEUE_HDR);
+		c->cursor = (c->cursor | c->mask) + 1;
+	}
+}
+
+// Latest timestamp this drained queue vouches for: it can't later receive a
+// record older than `now` minus the slack once its kernel ring is empty too.
+// The kernel ring is checked first: its consumer position only moves after
+// the record has been pushed, so a record in flight is seen in one or the
+// other. Returns 0 if a record has appeared after all.
+static u64 idle_bound(struct ring_consumer *c, u64 now, bool *refilled)
+{
+	u32 len;
+
+	*refilled = false;
+	if (ring__avail_data_size(ring_buffer__ring(c->rb, 0)))
+		return 0;
+	if (queue_front(c, &len))
+	{
+		*refilled = true;
+		return 0;
+	}
+	return now > RING_SET_SLACK_NS ? now - RING_SET_SLACK_NS : 0;
+}
+
+static bool heap_less(const struct ring_set *s, size_t a, size_t b)
+{
+	return s->c[s->heap[a]].head_ts < s->c[s->heap[b]].head_ts;
+}
+
+static void heap_swap(struct ring_set *s, size_t a, size_t b)
+{
+	unsigned int tmp = s->heap[a];
+
+	s->heap[a] = s->heap[b];
+	s->heap[b] = tmp;
+}
+
+static void heap_push(struct ring_set *s, unsigned int idx)
+{
+	size_t i = s->heap_len++;
+
+	s->heap[i] = idx;
+	while (i && heap_less(s, i, (i - 1) / 2))
+	{
+		heap_swap(s, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+// Restores the heap after the top's key grew (or the top was replaced)
+static void heap_sift_down(struct ring_set *s)
+{
+	size_t i = 0;
+
+	for (;;)
+	{
+		size_t l = 2 * i + 1, r = l + 1, min = i;
+
+		if (l < s->heap_len && heap_less(s, l, min))
+			min = l;
+		if (r < s->heap_len && heap_less(s, r, min))
+			min = r;
+		if (min == i)
+			return;
+		heap_swap(s, i, min);
+		i = min;
+	}
+}
+
+static void heap_pop(struct ring_set *s)
+{
+	s->heap[0] = s->heap[--s->heap_len];
+	heap_sift_down(s);
+}
+
+// Queues its front record into the heap, or lowers the release limit
+static void enqueue(struct ring_set *s, unsigned int idx, u64 now, u64 *limit)
+{
+	struct ring_consumer *c = &s->c[idx];
+	const struct event_header *rec;
+	bool refilled;
+	u32 len;
+	u64 bound;
+
+	rec = queue_front(c, &len);
+	if (!rec)
+	{
+		bound = idle_bound(c, now, &refilled);
+		if (!refilled)
+		{
+			if (bound < *limit)
+				*limit = bound;
+			return;
+		}
+		rec = queue_front(c, &len);
+	}
+	c->head_ts = rec->timestamp_ns;
+	heap_push(s, idx);
+}
+
+void ring_set__set_clock_offset(struct ring_set *s, unsigned long long clock_offset_ns)
+{
+	s->clock_offset_ns = clock_offset_ns;
+}
+
+size_t ring_set__peek(struct ring_set *s, struct event_view *views, unsigned int *rings,
+					  unsigned long *ends, size_t max, unsigned long long *wait_ns)
+{
+	const u64 now = clock_ns(s->clock) + s->clock_offset_ns;
+	u64 limit = UINT64_MAX; // records up to this timestamp are safe to release
+	size_t n = 0;
+
+	*wait_ns = 0;
+	s->heap_len = 0;
+	for (unsigned int i = 0; i < s->count; i++)
+	{
+		s->c[i].cursor = atomic_load_explicit(&s->c[i].tail, memory_order_relaxed);
+		enqueue(s, i, now, &limit);
+	}
+
+	while (n < max && s->heap_len)
+	{
+		unsigned int idx = s->heap[0];
+		struct ring_consumer *c = &s->c[idx];
+		const struct event_header *rec;
+		u32 len;
+
+		if (c->head_ts > limit)
+		{
+			// Held back by an idle ring's slack rather than a busy one
+			if (limit && limit >= now - RING_SET_SLACK_NS)
+				*wait_ns = c->head_ts - limit;
+			break;
+		}
+
+		rec = queue_front(c, &len);
+		views[n].data = rec;
+		views[n].size = len;
+		rings[n] = idx;
+		c->cursor += QUEUE_HDR + ((len + 7) & ~7UL);
+		ends[n++] = c->cursor;
+
+		rec = queue_front(c, &len);
+		if (rec)
+		{
+			c->head_ts = rec->timestamp_ns;
+			heap_sift_down(s);
+		}
+		else
+		{
+			heap_pop(s);
+			enqueue(s, idx, now, &limit);
+		}
+	}
+	return n;
+}
+
+void ring_set__ack(struct ring_set *s, const unsigned int *rings, const unsigned long *ends,
+				   size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		atomic_store(&s->c[rings[i]].tail, ends[i]);
+}
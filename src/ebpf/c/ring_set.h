@@ -0,0 +1,68 @@
+#ifndef __RING_SET_H
+#define __RING_SET_H
+
+#include <stddef.h>
+#include <time.h>
+
+#include "bootstrap.h"
+#include "bootstrap_api.h"
+
+/*
+ * Several kernel rings (one per CPU or per NUMA node) drained in parallel.
+ *
+ * Each ring has a consumer thread that copies its records into a private
+ * single-producer/single-consumer queue. The thread driving the tracer then
+ * merges the queue heads by `timestamp_ns`, so records come out in the order
+ * they were produced across all rings (an exec before its exit, even when
+ * the two ran on different CPUs).
+ *
+ * A record is only released once every other ring is known to hold nothing
+ * older: either its queue has a later record at its head, or both its queue
+ * and its kernel ring are empty. A handler reads its timestamp a little
+ * before it reserves ring space, so an empty ring only vouches for records
+ * older than RING_SET_SLACK_NS; that slack is the latency the merge adds.
+ */
+#define RING_SET_SLACK_NS (1ULL * 1000000) /* 1 ms */
+
+struct ring_set;
+
+/*
+ * Creates one kernel ring of `ring_size` bytes per slot of the `rings`
+ * ARRAY_OF_MAPS (`outer_fd`, `count` entries), inserts them, and starts
+ * their consumer threads.
+ *
+ * @param clock The clock records are stamped with before the offset
+ * @param clock_offset_ns Added to `clock` to get the clock of `timestamp_ns`
+ *        (i.e. the BPF program's clock_offset_ns)
+ * @return New set, or NULL with errno set
+ */
+struct ring_set *ring_set__new(int outer_fd, unsigned int count, size_t ring_size,
+							   clockid_t clock, unsigned long long clock_offset_ns);
+
+/* Follows a recalibration of the records' clock offset */
+void ring_set__set_clock_offset(struct ring_set *s, unsigned long long clock_offset_ns);
+
+/* Stops the consumer threads and releases the rings. Accepts NULL. */
+void ring_set__free(struct ring_set *s);
+
+/* Becomes readable when a queue goes from empty to non-empty */
+int ring_set__wakeup_fd(const struct ring_set *s);
+
+/* Resets the wakeup descriptor */
+void ring_set__clear_wakeup(struct ring_set *s);
+
+/*
+ * Fills up to `max` views with the oldest records that are safe to release,
+ * in timestamp order. `rings[i]` and `ends[i]` identify record i's queue and
+ * position for ring_set__ack(). When nothing more can be released yet but
+ * records are waiting on the slack, `*wait_ns` receives how long until the
+ * next one can be (0 otherwise). Returns the number of views filled.
+ */
+size_t ring_set__peek(struct ring_set *s, struct event_view *views, unsigned int *rings,
+					  unsigned long *ends, size_t max, unsigned long long *wait_ns);
+
+/* Releases the first `count` records returned by the last ring_set__peek() */
+void ring_set__ack(struct ring_set *s, const unsigned int *rings, const unsigned long *ends,
+				   size_t count);
+
+#endif /* __RING_SET_H */
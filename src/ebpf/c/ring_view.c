@@ -0,0 +1,94 @@
+#include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <linux/bpf.h>
+
+#include "ring_view.h"
+
+static size_t record_span(unsigned int len)
+{
+	// Strip the busy/discard bits, then round header + sample up to 8 bytes
+	len &= ~(BPF_RINGBUF_BUSY_BIT | BPF_RINGBUF_DISCARD_BIT);
+	return (len + BPF_RINGBUF_HDR_SZ + 7) & ~7UL;
+}
+
+int ring_view__open(struct ring_view *rv, int map_fd, size_t ring_size)
+{
+	void *tmp;
+
+	rv->map_fd = map_fd;
+	rv->page_size = sysconf(_SC_PAGESIZE);
+	rv->mask = ring_size - 1;
+
+	rv->consumer_pos = mmap(NULL, rv->page_size, PROT_READ | PROT_WRITE,
+							MAP_SHARED, map_fd, 0);
+	if (rv->consumer_pos == MAP_FAILED)
+	{
+		rv->consumer_pos = NULL;
+		return -errno;
+	}
+
+	// Producer page, then the data area mapped twice back to back
+	tmp = mmap(NULL, rv->page_size + 2 * ring_size, PROT_READ,
+			   MAP_SHARED, map_fd, rv->page_size);
+	if (tmp == MAP_FAILED)
+	{
+		int err = -errno;
+
+		munmap(rv->consumer_pos, rv->page_size);
+		rv->consumer_pos = NULL;
+		return err;
+	}
+	rv->producer_pos = tmp;
+	rv->data = (char *)tmp + rv->page_size;
+	return 0;
+}
+
+void ring_view__close(struct ring_view *rv)
+{
+	if (rv->consumer_pos)
+		munmap(rv->consumer_pos, rv->page_size);
+	if (rv->producer_pos)
+		munmap(rv->producer_pos, rv->page_size + 2 * (rv->mask + 1));
+	rv->consumer_pos = NULL;
+	rv->producer_pos = NULL;
+}
+
+size_t ring_view__peek(struct ring_view *rv, struct event_view *views,
+					   unsigned long *ends, size_t max)
+{
+	unsigned long cons_pos = __atomic_load_n(rv->consumer_pos, __ATOMIC_ACQUIRE);
+	unsigned long prod_pos = __atomic_load_n(rv->producer_pos, __ATOMIC_ACQUIRE);
+	size_t n = 0;
+
+	while (cons_pos < prod_pos && n < max)
+	{
+		unsigned int *len_ptr = (unsigned int *)((char *)rv->data + (cons_pos & rv->mask));
+		unsigned int len = __atomic_load_n(len_ptr, __ATOMIC_ACQUIRE);
+
+		// Still being written by a producer; records after it are not visible yet
+		if (len & BPF_RINGBUF_BUSY_BIT)
+			break;
+
+		cons_pos += record_span(len);
+		if (len & BPF_RINGBUF_DISCARD_BIT)
+		{
+			// Skip leading discarded records right away
+			if (n == 0)
+				ring_view__ack(rv, cons_pos);
+			continue;
+		}
+
+		views[n].data = (char *)len_ptr + BPF_RINGBUF_HDR_SZ;
+		views[n].size = len;
+		ends[n] = cons_pos;
+		n++;
+	}
+	return n;
+}
+
+void ring_view__ack(struct ring_view *rv, unsigned long pos)
+{
+	__atomic_store_n(rv->consumer_pos, pos, __ATOMIC_RELEASE);
+}
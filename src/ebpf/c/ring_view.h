@@ -0,0 +1,40 @@
+#ifndef __RING_VIEW_H
+#define __RING_VIEW_H
+
+#include <stddef.h>
+
+#include "bootstrap_api.h"
+
+/*
+ * Direct reader for a BPF_MAP_TYPE_RINGBUF map.
+ *
+ * libbpf's ring_buffer__poll() releases each record as soon as its callback
+ * returns, which forces a copy if the consumer wants to keep it. This reader
+ * maps the ring itself, so records can be handed out in place and only
+ * released once the consumer acknowledges them.
+ */
+struct ring_view
+{
+	int map_fd;
+	size_t page_size;
+	size_t mask;		  // data area size - 1 (a power of two)
+	unsigned long *consumer_pos; // writable page shared with the kernel
+	unsigned long *producer_pos; // read-only page shared with the kernel
+	void *data;			  // data area, mapped twice so records never wrap
+};
+
+int ring_view__open(struct ring_view *rv, int map_fd, size_t ring_size);
+void ring_view__close(struct ring_view *rv);
+
+/*
+ * Fills up to `max` views with committed records starting at the consumer
+ * position. `ends[i]` receives the ring position just past record i, for
+ * passing to ring_view__ack(). Returns the number of views filled.
+ */
+size_t ring_view__peek(struct ring_view *rv, struct event_view *views,
+					   unsigned long *ends, size_t max);
+
+/* Releases every record before `pos` back to the kernel */
+void ring_view__ack(struct ring_view *rv, unsigned long pos);
+
+#endif /* __RING_VIEW_H */
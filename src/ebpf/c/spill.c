@@ -0,0 +1,248 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+#include <linux/magic.h>
+
+#include "spill.h"
+
+#define SLOT_HDR 8 /* u32 record length, then padding */
+#define SLOT_ALIGN 8
+
+// Records [read, write) of one segment file. Only the segments being read
+// and written are mapped: the rest of the backlog is page cache alone.
+struct segment
+{
+	struct segment *next;
+	int fd;
+	unsigned char *map; // NULL while unmapped
+	size_t read;
+	size_t write;
+};
+
+struct spill
+{
+	char *dir;
+	size_t max_segments;
+	size_t nr_segments;
+	struct segment *head; // oldest, being read; NULL when empty
+	struct segment *tail; // newest, being written
+	struct spill_stats stats; // updated with atomics, for spill__stats()
+};
+
+static size_t slot_span(u32 size)
+{
+	return (SLOT_HDR + size + SLOT_ALIGN - 1) & ~(size_t)(SLOT_ALIGN - 1);
+}
+
+static void count(u64 *counter, u64 n)
+{
+	__atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+// An unlinked file under `dir`, or a negative errno
+static int open_unlinked(const char *dir)
+{
+	char path[PATH_MAX];
+	int fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+
+	if (fd >= 0)
+		return fd;
+	// Older kernels and some filesystems: a named file, unlinked at once
+	if (snprintf(path, sizeof(path), "%s/tracer-spill-XXXXXX", dir) >= (int)sizeof(path))
+		return -ENAMETOOLONG;
+	fd = mkostemp(path, O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	unlink(path);
+	return fd;
+}
+
+static int map_segment(struct segment *seg)
+{
+	void *map;
+
+	if (seg->map)
+		return 0;
+	map = mmap(NULL, SPILL_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, seg->fd, 0);
+	if (map == MAP_FAILED)
+		return -errno;
+	seg->map = map;
+	return 0;
+}
+
+static void unmap_segment(struct segment *seg)
+{
+	if (!seg->map)
+		return;
+	munmap(seg->map, SPILL_SEGMENT_SIZE);
+	seg->map = NULL;
+}
+
+static void free_segment(struct segment *seg)
+{
+	unmap_segment(seg);
+	close(seg->fd);
+	free(seg);
+}
+
+// Starts a new tail. Its blocks are allocated up front: a store into a hole
+// of a mapped file the disk has no room for raises SIGBUS.
+static int add_segment(struct spill *s)
+{
+	struct segment *seg;
+	int err;
+
+	if (s->nr_segments == s->max_segments)
+		return -ENOSPC;
+	seg = calloc(1, sizeof(*seg));
+	if (!seg)
+		return -ENOMEM;
+	seg->fd = open_unlinked(s->dir);
+	if (seg->fd < 0)
+	{
+		err = seg->fd;
+		free(seg);
+		return err;
+	}
+	err = posix_fallocate(seg->fd, 0, SPILL_SEGMENT_SIZE);
+	if (!err)
+		err = -map_segment(seg);
+	if (err)
+	{
+		free_segment(seg);
+		return -err;
+	}
+
+	if (s->tail)
+	{
+		s->tail->next = seg;
+		if (s->tail != s->head)
+			unmap_segment(s->tail);
+	}
+	else
+		s->head = seg;
+	s->tail = seg;
+	s->nr_segments++;
+	return 0;
+}
+
+struct spill *spill__new(const char *dir, size_t max_bytes)
+{
+	struct statfs fs;
+	struct spill *s;
+
+	if (access(dir, W_OK | X_OK) || statfs(dir, &fs))
+		return NULL;
+	// Pages of an in-memory filesystem can't be written back: spilling
+	// there would take as much memory as keeping the records
+	if (fs.f_type == TMPFS_MAGIC || fs.f_type == RAMFS_MAGIC)
+	{
+		fprintf(stderr, "C: not spilling to %s, which is in memory\n", dir);
+		errno = EINVAL;
+		return NULL;
+	}
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+	s->dir = strdup(dir);
+	if (!s->dir)
+	{
+		free(s);
+		errno = ENOMEM;
+		return NULL;
+	}
+	s->max_segments = max_bytes / SPILL_SEGMENT_SIZE ? max_bytes / SPILL_SEGMENT_SIZE : 1;
+	return s;
+}
+
+void spill__free(struct spill *s)
+{
+	if (!s)
+		return;
+	while (s->head)
+	{
+		struct segment *next = s->head->next;
+
+		free_segment(s->head);
+		s->head = next;
+	}
+	free(s->dir);
+	free(s);
+}
+
+int spill__append(struct spill *s, const void *data, u32 size)
+{
+	const size_t span = slot_span(size);
+	int err = 0;
+
+	if (span > SPILL_SEGMENT_SIZE)
+		err = -E2BIG;
+	else if (!s->tail || s->tail->write + span > SPILL_SEGMENT_SIZE)
+		err = add_segment(s);
+	if (err)
+	{
+		count(&s->stats.dropped, 1);
+		return err;
+	}
+
+	unsigned char *slot = s->tail->map + s->tail->write;
+	*(u32 *)slot = size;
+	memcpy(slot + SLOT_HDR, data, size);
+	s->tail->write += span;
+	count(&s->stats.spilled, 1);
+	count(&s->stats.queued_bytes, span);
+	return 0;
+}
+
+const void *spill__front(struct spill *s, u32 *size)
+{
+	struct segment *seg = s->head;
+
+	if (!seg || seg->read == seg->write)
+		return NULL;
+	// Unmapped since it was written, if the backlog outgrew it
+	if (map_segment(seg))
+		return NULL;
+	*size = *(const u32 *)(seg->map + seg->read);
+	return seg->map + seg->read + SLOT_HDR;
+}
+
+void spill__pop(struct spill *s)
+{
+	struct segment *seg = s->head;
+	const size_t span = slot_span(*(const u32 *)(seg->map + seg->read));
+
+	seg->read += span;
+	count(&s->stats.replayed, 1);
+	__atomic_fetch_sub(&s->stats.queued_bytes, span, __ATOMIC_RELAXED);
+	if (seg->read < seg->write)
+		return;
+
+	// Replayed: its disk space goes back, and the next one is read
+	s->head = seg->next;
+	if (s->tail == seg)
+		s->tail = NULL;
+	free_segment(seg);
+	s->nr_segments--;
+}
+
+bool spill__empty(const struct spill *s)
+{
+	return !s->head || s->head->read == s->head->write;
+}
+
+void spill__stats(const struct spill *s, struct spill_stats *out)
+{
+	out->spilled = __atomic_load_n(&s->stats.spilled, __ATOMIC_RELAXED);
+	out->replayed = __atomic_load_n(&s->stats.replayed, __ATOMIC_RELAXED);
+	out->dropped = __atomic_load_n(&s->stats.dropped, __ATOMIC_RELAXED);
+	out->queued_bytes = __atomic_load_n(&s->stats.queued_bytes, __ATOMIC_RELAXED);
+}
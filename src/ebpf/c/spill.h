@@ -0,0 +1,49 @@
+#ifndef __SPILL_H
+#define __SPILL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bootstrap.h"
+
+/*
+ * On-disk overflow of a handoff (tracer_opts.spill_path): a FIFO of raw
+ * records in append-only, memory-mapped segment files, so that a consumer
+ * that stalls costs page cache, which the kernel can write back and reclaim,
+ * rather than anonymous memory. Segments are unlinked files (O_TMPFILE where
+ * the filesystem has it), created as the backlog grows and released once
+ * replayed, so nothing is left behind by a crash. Driven from one thread;
+ * spill__stats() may be called from any.
+ */
+struct spill;
+
+#define SPILL_SEGMENT_SIZE (16UL * 1024 * 1024)
+
+/*
+ * Records are kept under `dir`, in at most `max_bytes` of it (rounded down
+ * to whole segments, but at least one). Returns NULL with errno set, to
+ * EINVAL if `dir` is on tmpfs or ramfs.
+ */
+struct spill *spill__new(const char *dir, size_t max_bytes);
+
+/* Drops whatever was not replayed. Accepts NULL. */
+void spill__free(struct spill *s);
+
+/*
+ * Queues a copy of a record behind the others. Returns 0, or -ENOSPC when
+ * the budget (or the disk) is full and -E2BIG for a record larger than a
+ * segment, having counted it as dropped.
+ */
+int spill__append(struct spill *s, const void *data, u32 size);
+
+/* Oldest record, valid until the next spill__pop(), or NULL if none */
+const void *spill__front(struct spill *s, u32 *size);
+
+/* Discards the oldest record, once replayed */
+void spill__pop(struct spill *s);
+
+bool spill__empty(const struct spill *s);
+
+void spill__stats(const struct spill *s, struct spill_stats *out);
+
+#endif /* __SPILL_H */
@@ -0,0 +1,847 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <gelf.h>
+
+#include "stack_profile.h"
+
+#define REFRESH_INTERVAL_NS (1000ULL * 1000000) /* how often counts are drained and mappings re-read */
+#define MAX_FRAME_LEN 256                        /* bytes kept of a symbol name */
+#define DRAIN_BATCH 1024                         /* profile_counts entries moved per syscall */
+#define MAX_HELD_SAMPLES 32768                   /* drained counts kept, as many as profile_counts holds */
+#define MIN_SAMPLE_SLOTS 64                      /* sample index slots per process; kept at most half full */
+
+struct symbol
+{
+	u64 addr;
+	u64 size;
+	char *name;
+};
+
+// Function symbols of one executable file, by address, with its loadable
+// segments to turn file offsets into those addresses. Files are identified
+// by device and inode, so the same binary seen through different mount
+// namespaces is loaded once. A refresh only opens the file, which keeps it
+// readable once the process (and its /proc/<pid>/root) is gone; the first
+// read that needs its symbols loads them. Kept for the life of the profile:
+// bounded by the distinct binaries and libraries that were sampled.
+struct elf_file
+{
+	u64 dev;
+	u64 ino;
+	int fd; // until the symbols are loaded
+	bool loaded;
+	struct symbol *syms;
+	size_t nr_syms;
+	GElf_Phdr *segs;
+	size_t nr_segs;
+};
+
+struct mapping
+{
+	u64 start;
+	u64 end;
+	u64 offset;
+	struct elf_file *file; // NULL if it couldn't be opened
+	char *name;                  // basename, for frames without a symbol
+};
+
+struct sample
+{
+	struct profile_key key;
+	u64 count;
+};
+
+// A sampled process: its counts drained from profile_counts so far, and
+// its executable mappings as of the last refresh
+struct process_maps
+{
+	u64 upid;
+	u32 pid;
+	bool exited;    // its /proc entry is gone: the mappings are final
+	u64 sampled_ns; // monotonic, when a drain last added to its samples
+	struct sample *samples;
+	size_t nr_samples;
+	size_t samples_cap;
+	u32 *slots;      // samples by key, open addressing: sample index + 1, 0 = empty
+	size_t nr_slots; // a power of two
+	struct mapping *maps;
+	size_t nr_maps;
+};
+
+struct stack_profile
+{
+	int counts_fd;
+	int stacks_fd;
+	struct bpf_link **links;
+	int nr_links;
+
+	pthread_t refresher;
+	bool refreshing;
+
+	pthread_mutex_t lock; // everything below
+	pthread_cond_t wake;  // the refresher, to stop
+	bool stopping;
+	struct process_maps *procs;
+	size_t nr_procs;
+	size_t nr_samples; // over all procs
+	struct elf_file **files;
+	size_t nr_files;
+	struct symbol *ksyms; // loaded on first use; none if /proc/kallsyms hides addresses
+	size_t nr_ksyms;
+	bool ksyms_loaded;
+};
+
+static u64 monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int symbol_cmp(const void *a, const void *b)
+{
+	const struct symbol *x = a, *y = b;
+
+	return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+static void free_symbols(struct symbol *syms, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		free(syms[i].name);
+	free(syms);
+}
+
+// Symbol covering `addr`: the last one at or below it, unless that has a
+// size and ends before `addr`
+static const struct symbol *find_symbol(const struct symbol *syms, size_t n, u64 addr)
+{
+	size_t lo = 0, hi = n;
+
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if (syms[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (!lo)
+		return NULL;
+	const struct symbol *s = &syms[lo - 1];
+	return s->size && addr >= s->addr + s->size ? NULL : s;
+}
+
+static int push_symbol(struct symbol **syms, size_t *n, size_t *cap, u64 addr, u64 size, const char *name)
+{
+	if (*n == *cap)
+	{
+		size_t new_cap = *cap ? *cap * 2 : 1024;
+		struct symbol *grown = realloc(*syms, new_cap * sizeof(**syms));
+		if (!grown)
+			return -ENOMEM;
+		*syms = grown;
+		*cap = new_cap;
+	}
+	char *copy = strndup(name, MAX_FRAME_LEN);
+	if (!copy)
+		return -ENOMEM;
+	(*syms)[(*n)++] = (struct symbol){.addr = addr, .size = size, .name = copy};
+	return 0;
+}
+
+static void load_kernel_symbols(struct stack_profile *p)
+{
+	size_t cap = 0;
+	char line[512];
+	FILE *f;
+
+	p->ksyms_loaded = true;
+	f = fopen("/proc/kallsyms", "re");
+	if (!f)
+		return;
+	while (fgets(line, sizeof(line), f))
+	{
+		unsigned long long addr;
+		char type, name[MAX_FRAME_LEN];
+
+		if (sscanf(line, "%llx %c %255s", &addr, &type, name) != 3)
+			continue;
+		if (!addr) // addresses hidden (kptr_restrict)
+			break;
+		if (type != 't' && type != 'T' && type != 'w' && type != 'W')
+			continue;
+		if (push_symbol(&p->ksyms, &p->nr_ksyms, &cap, addr, 0, name))
+			break;
+	}
+	fclose(f);
+	qsort(p->ksyms, p->nr_ksyms, sizeof(*p->ksyms), symbol_cmp);
+}
+
+static void clear_symbols(struct elf_file *file)
+{
+	free_symbols(file->syms, file->nr_syms);
+	free(file->segs);
+	file->syms = NULL;
+	file->segs = NULL;
+	file->nr_syms = file->nr_segs = 0;
+}
+
+static void free_elf_file(struct elf_file *file)
+{
+	if (!file)
+		return;
+	if (file->fd >= 0)
+		close(file->fd);
+	clear_symbols(file);
+	free(file);
+}
+
+// Reads the function symbols (.symtab, else .dynsym) and loadable segments
+// of `file`, once, then closes it. Leaves none if it isn't a readable ELF.
+static void load_symbols(struct elf_file *file)
+{
+	size_t cap = 0, nr_phdrs;
+	Elf_Scn *scn = NULL;
+	Elf *elf;
+	bool symtab = false;
+
+	if (file->loaded)
+		return;
+	file->loaded = true;
+	elf = elf_begin(file->fd, ELF_C_READ_MMAP, NULL);
+	if (!elf || elf_getphdrnum(elf, &nr_phdrs))
+		goto fail;
+
+	file->segs = calloc(nr_phdrs ? nr_phdrs : 1, sizeof(*file->segs));
+	if (!file->segs)
+		goto fail;
+	for (size_t i = 0; i < nr_phdrs; i++)
+	{
+		GElf_Phdr phdr;
+		if (gelf_getphdr(elf, i, &phdr) && phdr.p_type == PT_LOAD)
+			file->segs[file->nr_segs++] = phdr;
+	}
+
+	// A stripped binary only has .dynsym; one with .symtab has it all
+	for (int pass = 0; pass < 2 && !symtab; pass++)
+	{
+		scn = NULL;
+		while ((scn = elf_nextscn(elf, scn)))
+		{
+			GElf_Shdr shdr;
+			Elf_Data *data;
+
+			if (!gelf_getshdr(scn, &shdr) || shdr.sh_type != (pass ? SHT_DYNSYM : SHT_SYMTAB) ||
+				!shdr.sh_entsize || !(data = elf_getdata(scn, NULL)))
+				continue;
+			symtab = !pass;
+			for (size_t i = 0; i < shdr.sh_size / shdr.sh_entsize; i++)
+			{
+				GElf_Sym sym;
+				const char *name;
+
+				if (!gelf_getsym(data, i, &sym) || !sym.st_value ||
+					(GELF_ST_TYPE(sym.st_info) != STT_FUNC && GELF_ST_TYPE(sym.st_info) != STT_GNU_IFUNC))
+					continue;
+				name = elf_strptr(elf, shdr.sh_link, sym.st_name);
+				if (name && *name &&
+					push_symbol(&file->syms, &file->nr_syms, &cap, sym.st_value, sym.st_size, name))
+					goto fail;
+			}
+		}
+	}
+	qsort(file->syms, file->nr_syms, sizeof(*file->syms), symbol_cmp);
+	goto out;
+
+fail:
+	clear_symbols(file);
+out:
+	if (elf)
+		elf_end(elf);
+	close(file->fd);
+	file->fd = -1;
+}
+
+// A file mapped by process `pid`, opened through its root so that paths
+// inside containers resolve
+static struct elf_file *elf_file_of(struct stack_profile *p, u32 pid, const char *path, u64 dev, u64 ino)
+{
+	char root_path[PATH_MAX + 32];
+	struct elf_file *file, **grown;
+
+	for (size_t i = 0; i < p->nr_files; i++)
+		if (p->files[i]->dev == dev && p->files[i]->ino == ino)
+			return p->files[i];
+
+	file = calloc(1, sizeof(*file));
+	if (!file)
+		return NULL;
+	file->dev = dev;
+	file->ino = ino;
+	snprintf(root_path, sizeof(root_path), "/proc/%u/root%s", pid, path);
+	file->fd = open(root_path, O_RDONLY | O_CLOEXEC);
+	grown = file->fd >= 0 ? realloc(p->files, (p->nr_files + 1) * sizeof(*p->files)) : NULL;
+	if (!grown)
+	{
+		free_elf_file(file);
+		return NULL;
+	}
+	p->files = grown;
+	p->files[p->nr_files++] = file;
+	return file;
+}
+
+static void free_mappings(struct mapping *maps, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		free(maps[i].name);
+	free(maps);
+}
+
+// Re-reads the executable mappings of `proc`. Keeps the old ones if the
+// process has just gone.
+static void read_mappings(struct stack_profile *p, struct process_maps *proc)
+{
+	struct mapping *maps = NULL;
+	size_t n = 0, cap = 0;
+	char path[64], line[PATH_MAX + 128];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/%u/maps", proc->pid);
+	f = fopen(path, "re");
+	if (!f)
+	{
+		proc->exited = errno == ENOENT;
+		return;
+	}
+	while (fgets(line, sizeof(line), f))
+	{
+		unsigned long long start, end, offset, ino;
+		unsigned int major, minor;
+		char perms[5];
+		int name_at = 0;
+
+		if (sscanf(line, "%llx-%llx %4s %llx %x:%x %llu %n", &start, &end, perms, &offset, &major, &minor,
+				   &ino, &name_at) < 7 ||
+			perms[2] != 'x' || !name_at)
+			continue;
+		char *name = line + name_at;
+		name[strcspn(name, "\n")] = '\0';
+
+		if (n == cap)
+		{
+			size_t new_cap = cap ? cap * 2 : 64;
+			struct mapping *grown = realloc(maps, new_cap * sizeof(*maps));
+			if (!grown)
+				break;
+			maps = grown;
+			cap = new_cap;
+		}
+		const char *base = strrchr(name, '/');
+		struct mapping *m = &maps[n];
+		m->start = start;
+		m->end = end;
+		m->offset = offset;
+		m->file = name[0] == '/' ? elf_file_of(p, proc->pid, name, makedev(major, minor), ino) : NULL;
+		m->name = strdup(base ? base + 1 : (*name ? name : "[anon]"));
+		if (!m->name)
+			break;
+		n++;
+	}
+	fclose(f);
+	if (!n)
+	{
+		free(maps);
+		return;
+	}
+	free_mappings(proc->maps, proc->nr_maps);
+	proc->maps = maps;
+	proc->nr_maps = n;
+}
+
+static struct process_maps *find_process(struct stack_profile *p, u64 upid)
+{
+	for (size_t i = 0; i < p->nr_procs; i++)
+		if (p->procs[i].upid == upid)
+			return &p->procs[i];
+	return NULL;
+}
+
+static void drop_process(struct stack_profile *p, struct process_maps *proc)
+{
+	free_mappings(proc->maps, proc->nr_maps);
+	free(proc->samples);
+	free(proc->slots);
+	p->nr_samples -= proc->nr_samples;
+	*proc = p->procs[--p->nr_procs];
+}
+
+static int id_cmp(const void *a, const void *b)
+{
+	const int *x = a, *y = b;
+
+	return *x < *y ? -1 : *x > *y;
+}
+
+// Deletes the stacks of `proc` that no other process's samples refer to,
+// which would otherwise fill the map for good. A sample taken since the
+// last drain may still refer to one; that stack then folds as unknown.
+static void release_stacks(struct stack_profile *p, const struct process_maps *proc)
+{
+	int *ids = malloc(2 * proc->nr_samples * sizeof(*ids));
+	bool *shared;
+	size_t n = 0, unique = 0;
+
+	if (!ids)
+		return;
+	for (size_t i = 0; i < proc->nr_samples; i++)
+	{
+		if (proc->samples[i].key.user_stack >= 0)
+			ids[n++] = proc->samples[i].key.user_stack;
+		if (proc->samples[i].key.kernel_stack >= 0)
+			ids[n++] = proc->samples[i].key.kernel_stack;
+	}
+	qsort(ids, n, sizeof(*ids), id_cmp);
+	for (size_t i = 0; i < n; i++)
+		if (!unique || ids[unique - 1] != ids[i])
+			ids[unique++] = ids[i];
+
+	shared = calloc(unique ? unique : 1, sizeof(*shared));
+	if (!shared)
+		goto out;
+	for (size_t i = 0; i < p->nr_procs; i++)
+	{
+		if (&p->procs[i] == proc)
+			continue;
+		for (size_t j = 0; j < p->procs[i].nr_samples; j++)
+		{
+			const struct profile_key *key = &p->procs[i].samples[j].key;
+			const int *hit = bsearch(&key->user_stack, ids, unique, sizeof(*ids), id_cmp);
+
+			if (hit)
+				shared[hit - ids] = true;
+			hit = bsearch(&key->kernel_stack, ids, unique, sizeof(*ids), id_cmp);
+			if (hit)
+				shared[hit - ids] = true;
+		}
+	}
+	for (size_t i = 0; i < unique; i++)
+		if (!shared[i])
+			bpf_map_delete_elem(p->stacks_fd, &ids[i]);
+	free(shared);
+out:
+	free(ids);
+}
+
+static size_t sample_slot(const struct profile_key *key, size_t nr_slots)
+{
+	u64 h = ((u64)(u32)key->user_stack << 32 | (u32)key->kernel_stack) ^ key->pid;
+
+	h *= 0x9e3779b97f4a7c15ULL; // Fibonacci hashing: the high bits are the mixed ones
+	return (h >> 32) & (nr_slots - 1);
+}
+
+static int grow_sample_slots(struct process_maps *proc)
+{
+	size_t nr_slots = proc->nr_slots ? proc->nr_slots * 2 : MIN_SAMPLE_SLOTS;
+	u32 *slots = calloc(nr_slots, sizeof(*slots));
+
+	if (!slots)
+		return -ENOMEM;
+	for (size_t i = 0; i < proc->nr_samples; i++)
+	{
+		size_t j = sample_slot(&proc->samples[i].key, nr_slots);
+
+		while (slots[j])
+			j = (j + 1) & (nr_slots - 1);
+		slots[j] = i + 1;
+	}
+	free(proc->slots);
+	proc->slots = slots;
+	proc->nr_slots = nr_slots;
+	return 0;
+}
+
+// Adds a drained count to its process's samples
+static int add_sample(struct stack_profile *p, const struct profile_key *key, u64 count, u64 now)
+{
+	struct process_maps *proc = find_process(p, key->upid);
+	size_t j;
+
+	if (!proc)
+	{
+		struct process_maps *grown = realloc(p->procs, (p->nr_procs + 1) * sizeof(*p->procs));
+		if (!grown)
+			return -ENOMEM;
+		p->procs = grown;
+		proc = &p->procs[p->nr_procs++];
+		*proc = (struct process_maps){.upid = key->upid, .pid = key->pid};
+	}
+	proc->sampled_ns = now;
+	if (!proc->slots && grow_sample_slots(proc))
+		return -ENOMEM;
+
+	// Drained again after more samples of the same stacks
+	for (j = sample_slot(key, proc->nr_slots); proc->slots[j]; j = (j + 1) & (proc->nr_slots - 1))
+	{
+		struct sample *s = &proc->samples[proc->slots[j] - 1];
+		if (s->key.pid == key->pid && s->key.user_stack == key->user_stack &&
+			s->key.kernel_stack == key->kernel_stack)
+		{
+			s->count += count;
+			return 0;
+		}
+	}
+	// Always leave an empty slot, where probing stops, even if growing failed
+	if (proc->nr_samples + 1 >= proc->nr_slots)
+		return -ENOMEM;
+	if (proc->nr_samples == proc->samples_cap)
+	{
+		size_t cap = proc->samples_cap ? proc->samples_cap * 2 : 64;
+		struct sample *grown = realloc(proc->samples, cap * sizeof(*grown));
+		if (!grown)
+			return -ENOMEM;
+		proc->samples = grown;
+		proc->samples_cap = cap;
+	}
+	proc->samples[proc->nr_samples++] = (struct sample){.key = *key, .count = count};
+	proc->slots[j] = proc->nr_samples;
+	p->nr_samples++;
+	if (proc->nr_samples * 2 > proc->nr_slots)
+		grow_sample_slots(proc); // a failure only leaves the index fuller
+	return 0;
+}
+
+// Moves every count out of profile_counts into the samples of its process,
+// a batch of keys per syscall (a key per syscall before Linux 5.6). Then,
+// past MAX_HELD_SAMPLES, forgets the processes sampled longest ago, whose
+// exits were lost or never read.
+static void drain_counts(struct stack_profile *p)
+{
+	struct profile_key keys[DRAIN_BATCH];
+	u64 counts[DRAIN_BATCH];
+	u64 now = monotonic_ns();
+	u32 batch, next;
+	bool first = true, done = false;
+
+	while (!done)
+	{
+		u32 n = DRAIN_BATCH;
+
+		if (bpf_map_lookup_and_delete_batch(p->counts_fd, first ? NULL : &batch, &next, keys, counts, &n, NULL))
+		{
+			if (errno != ENOENT)
+				break;
+			done = true; // and `n` are the last ones
+		}
+		for (u32 i = 0; i < n; i++)
+			add_sample(p, &keys[i], counts[i], now);
+		batch = next;
+		first = false;
+	}
+	// Without batch operations. Bounded, since samples keep coming.
+	for (unsigned int i = 0; !done && i < MAX_HELD_SAMPLES; i++)
+	{
+		if (bpf_map_get_next_key(p->counts_fd, NULL, &keys[0]))
+			break;
+		if (!bpf_map_lookup_and_delete_elem(p->counts_fd, &keys[0], &counts[0]))
+			add_sample(p, &keys[0], counts[0], now);
+	}
+
+	while (p->nr_samples > MAX_HELD_SAMPLES)
+	{
+		struct process_maps *oldest = &p->procs[0];
+
+		for (size_t i = 1; i < p->nr_procs; i++)
+			if (p->procs[i].sampled_ns < oldest->sampled_ns)
+				oldest = &p->procs[i];
+		release_stacks(p, oldest);
+		drop_process(p, oldest);
+	}
+}
+
+struct stack_profile *stack_profile__new(int counts_fd, int stacks_fd)
+{
+	pthread_condattr_t attr;
+	struct stack_profile *p;
+
+	if (elf_version(EV_CURRENT) == EV_NONE)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return NULL;
+	p->counts_fd = counts_fd;
+	p->stacks_fd = stacks_fd;
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&p->wake, &attr);
+	pthread_condattr_destroy(&attr);
+	return p;
+}
+
+void stack_profile__free(struct stack_profile *p)
+{
+	if (!p)
+		return;
+	stack_profile__detach(p);
+	while (p->nr_procs)
+		drop_process(p, &p->procs[0]);
+	free(p->procs);
+	for (size_t i = 0; i < p->nr_files; i++)
+		free_elf_file(p->files[i]);
+	free(p->files);
+	free_symbols(p->ksyms, p->nr_ksyms);
+	pthread_cond_destroy(&p->wake);
+	pthread_mutex_destroy(&p->lock);
+	free(p);
+}
+
+// Drains the counts and snapshots the mappings of the sampled processes
+// once a second, off the polling thread, until detached
+static void *refresh_thread(void *arg)
+{
+	struct stack_profile *p = arg;
+
+	pthread_mutex_lock(&p->lock);
+	while (!p->stopping)
+	{
+		u64 due = monotonic_ns() + REFRESH_INTERVAL_NS;
+		struct timespec deadline = {due / 1000000000, due % 1000000000};
+
+		while (!p->stopping && pthread_cond_timedwait(&p->wake, &p->lock, &deadline) != ETIMEDOUT)
+			;
+		if (p->stopping)
+			break;
+		drain_counts(p);
+		for (size_t i = 0; i < p->nr_procs; i++)
+			if (!p->procs[i].exited)
+				read_mappings(p, &p->procs[i]);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+int stack_profile__attach(struct stack_profile *p, const struct bpf_program *prog, unsigned int hz)
+{
+	int ncpus = libbpf_num_possible_cpus();
+	int err = 0;
+
+	if (ncpus < 0)
+		return ncpus;
+	p->links = calloc(ncpus, sizeof(*p->links));
+	if (!p->links)
+		return -ENOMEM;
+	for (int cpu = 0; cpu < ncpus; cpu++)
+	{
+		struct perf_event_attr attr = {
+			.type = PERF_TYPE_SOFTWARE,
+			.size = sizeof(attr),
+			.config = PERF_COUNT_SW_CPU_CLOCK,
+			.sample_freq = hz,
+			.freq = 1,
+		};
+		int fd = syscall(__NR_perf_event_open, &attr, -1, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+		if (fd < 0)
+		{
+			if (errno == ENODEV) // possible but offline
+				continue;
+			err = -errno;
+			break;
+		}
+		// The link owns the perf event from here on
+		struct bpf_link *link = bpf_program__attach_perf_event(prog, fd);
+		if (!link)
+		{
+			err = -errno;
+			close(fd);
+			break;
+		}
+		p->links[p->nr_links++] = link;
+	}
+	if (!err)
+	{
+		p->stopping = false;
+		err = -pthread_create(&p->refresher, NULL, refresh_thread, p);
+		p->refreshing = !err;
+	}
+	if (err)
+		stack_profile__detach(p);
+	return err;
+}
+
+void stack_profile__detach(struct stack_profile *p)
+{
+	if (p->refreshing)
+	{
+		pthread_mutex_lock(&p->lock);
+		p->stopping = true;
+		pthread_cond_signal(&p->wake);
+		pthread_mutex_unlock(&p->lock);
+		pthread_join(p->refresher, NULL);
+		p->refreshing = false;
+	}
+	for (int i = 0; i < p->nr_links; i++)
+		bpf_link__destroy(p->links[i]);
+	free(p->links);
+	p->links = NULL;
+	p->nr_links = 0;
+}
+
+struct folded
+{
+	char *buf;
+	size_t len;
+	size_t cap;
+};
+
+static int append_frame(struct folded *f, const char *frame, size_t n, const char *suffix)
+{
+	size_t need = f->len + 1 + n + strlen(suffix) + 1;
+
+	if (need > f->cap)
+	{
+		size_t cap = f->cap ? f->cap : 4096;
+		while (cap < need)
+			cap *= 2;
+		char *grown = realloc(f->buf, cap);
+		if (!grown)
+			return -ENOMEM;
+		f->buf = grown;
+		f->cap = cap;
+	}
+	if (f->len)
+		f->buf[f->len++] = ';';
+	memcpy(f->buf + f->len, frame, n);
+	f->len += n;
+	f->len += sprintf(f->buf + f->len, "%s", suffix);
+	return 0;
+}
+
+// Name of user address `ip` of `proc`: its function, or else the file and
+// offset it falls in
+static int append_user_frame(struct folded *f, const struct process_maps *proc, u64 ip)
+{
+	char frame[MAX_FRAME_LEN + 32];
+
+	for (size_t i = 0; proc && i < proc->nr_maps; i++)
+	{
+		const struct mapping *m = &proc->maps[i];
+		if (ip < m->start || ip >= m->end)
+			continue;
+
+		u64 off = ip - m->start + m->offset;
+		if (m->file)
+			load_symbols(m->file);
+		for (size_t s = 0; m->file && s < m->file->nr_segs; s++)
+		{
+			const GElf_Phdr *seg = &m->file->segs[s];
+			if (off < seg->p_offset || off >= seg->p_offset + seg->p_filesz)
+				continue;
+			const struct symbol *sym =
+				find_symbol(m->file->syms, m->file->nr_syms, off - seg->p_offset + seg->p_vaddr);
+			if (sym)
+				return append_frame(f, sym->name, strlen(sym->name), "");
+			break;
+		}
+		int n = snprintf(frame, sizeof(frame), "%s+0x%llx", m->name, (unsigned long long)off);
+		return append_frame(f, frame, n < (int)sizeof(frame) ? n : (int)sizeof(frame) - 1, "");
+	}
+	return append_frame(f, "[unknown]", 9, "");
+}
+
+static int append_kernel_frame(struct folded *f, const struct stack_profile *p, u64 ip)
+{
+	const struct symbol *sym = find_symbol(p->ksyms, p->nr_ksyms, ip);
+
+	if (sym)
+		return append_frame(f, sym->name, strlen(sym->name), "_[k]");
+	return append_frame(f, "[unknown]", 9, "_[k]");
+}
+
+// Folds a user and a kernel stack into "outermost;...;innermost", the
+// kernel frames (suffixed "_[k]") above the user ones
+static int fold_stack(struct stack_profile *p, const struct process_maps *proc, const struct profile_key *key,
+					  struct folded *f)
+{
+	u64 ips[PROFILE_MAX_DEPTH];
+	int err = 0;
+
+	f->len = 0;
+	if (key->user_stack >= 0 && !bpf_map_lookup_elem(p->stacks_fd, &key->user_stack, ips))
+	{
+		int depth = 0;
+		while (depth < PROFILE_MAX_DEPTH && ips[depth])
+			depth++;
+		for (int i = depth - 1; i >= 0 && !err; i--)
+			err = append_user_frame(f, proc, ips[i]);
+	}
+	if (key->kernel_stack >= 0 && !bpf_map_lookup_elem(p->stacks_fd, &key->kernel_stack, ips))
+	{
+		int depth = 0;
+		while (depth < PROFILE_MAX_DEPTH && ips[depth])
+			depth++;
+		for (int i = depth - 1; i >= 0 && !err; i--)
+			err = append_kernel_frame(f, p, ips[i]);
+	}
+	if (!err && !f->len)
+		err = append_frame(f, "[unknown]", 9, "");
+	return err;
+}
+
+int stack_profile__read(struct stack_profile *p, u64 upid, profile_stack_callback_t cb, void *ctx)
+{
+	struct process_maps *proc;
+	struct folded f = {};
+	int n = 0, err = 0;
+
+	pthread_mutex_lock(&p->lock);
+	// The samples taken since the last refresh, of this and the other
+	// processes: all there are of one that lived less than a refresh
+	drain_counts(p);
+	proc = find_process(p, upid);
+	if (!proc)
+		goto out;
+	// Whatever it mapped since then, while it still has mappings
+	if (!proc->exited)
+		read_mappings(p, proc);
+	if (!p->ksyms_loaded)
+		load_kernel_symbols(p);
+
+	for (size_t i = 0; i < proc->nr_samples && !err; i++)
+	{
+		err = fold_stack(p, proc, &proc->samples[i].key, &f);
+		if (err)
+			break;
+		f.buf[f.len] = '\0';
+		cb(ctx, f.buf, proc->samples[i].count);
+		n++;
+	}
+	release_stacks(p, proc);
+	drop_process(p, proc);
+out:
+	pthread_mutex_unlock(&p->lock);
+	free(f.buf);
+	return err ? err : n;
+}
@@ -0,0 +1,50 @@
+#ifndef __STACK_PROFILE_H
+#define __STACK_PROFILE_H
+
+#include "bootstrap.h"
+#include "bootstrap_api.h"
+
+struct bpf_program;
+
+/*
+ * On-CPU stack sampling (tracer_opts.profile_hz): one CPU-clock perf event
+ * per CPU runs the sampling program, which counts stacks in the kernel, and
+ * the counts of a process are read and symbolized here once it is done.
+ *
+ * A process's stacks can only be symbolized from its mappings, which are
+ * gone by the time its exit record arrives. Hence a thread, started by
+ * __attach(), moves the counts out of the kernel into per-process samples
+ * (in batches) once a second, and snapshots /proc/<pid>/maps of every
+ * process with samples (opening the files of their executable mappings)
+ * while it still runs. Symbol tables are loaded from those files by the
+ * first read that needs them. Kernel frames resolve through /proc/kallsyms.
+ *
+ * All functions but __new() and __free() may be called from different
+ * threads.
+ */
+struct stack_profile;
+
+/*
+ * @param counts_fd The profile_counts map
+ * @param stacks_fd The stack_traces map
+ * @return New profile, or NULL with errno set
+ */
+struct stack_profile *stack_profile__new(int counts_fd, int stacks_fd);
+
+/* Detaches and frees. Accepts NULL. */
+void stack_profile__free(struct stack_profile *p);
+
+/*
+ * Opens a perf event sampling at `hz` on every online CPU, attaches `prog`
+ * to each and starts the refresh thread. Returns 0 or a negative errno
+ * (nothing stays attached).
+ */
+int stack_profile__attach(struct stack_profile *p, const struct bpf_program *prog, unsigned int hz);
+
+/* Closes the perf events and stops the refresh thread. Samples already counted can still be read. */
+void stack_profile__detach(struct stack_profile *p);
+
+/* See tracer_profile_read() */
+int stack_profile__read(struct stack_profile *p, u64 upid, profile_stack_callback_t cb, void *ctx);
+
+#endif /* __STACK_PROFILE_H */
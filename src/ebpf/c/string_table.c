@@ -0,0 +1,213 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "string_table.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024) /* text bytes per block, unless a string needs more */
+#define MIN_SLOTS 1024               /* hash index slots; kept at most half full */
+
+// Text is appended to fixed blocks, never moved, so pointers handed out by
+// string_table__get() stay valid as the table grows
+struct arena_block
+{
+	struct arena_block *next;
+	size_t size;
+	size_t used;
+	char text[];
+};
+
+struct entry
+{
+	u64 hash;
+	const char *text;
+	u32 len;
+};
+
+struct string_table
+{
+	struct entry *entries; // by id - first_id
+	size_t count;
+	size_t cap;
+	u32 first_id;
+
+	u32 *slots; // open addressing: entry index + 1, 0 = empty
+	size_t nr_slots; // a power of two
+
+	struct arena_block *blocks; // newest first
+	size_t bytes;
+};
+
+u64 string_hash(const char *s, size_t len)
+{
+	u64 hash = STRING_HASH_OFFSET;
+
+	for (size_t i = 0; i < len; i++)
+	{
+		hash ^= (unsigned char)s[i];
+		hash *= STRING_HASH_PRIME;
+	}
+	return hash ? hash : 1;
+}
+
+struct string_table *string_table__new(void)
+{
+	struct string_table *st = calloc(1, sizeof(*st));
+
+	if (!st)
+		return NULL;
+	st->first_id = 1;
+	st->nr_slots = MIN_SLOTS;
+	st->slots = calloc(st->nr_slots, sizeof(*st->slots));
+	if (!st->slots)
+	{
+		free(st);
+		errno = ENOMEM;
+		return NULL;
+	}
+	return st;
+}
+
+static void free_blocks(struct string_table *st)
+{
+	while (st->blocks)
+	{
+		struct arena_block *next = st->blocks->next;
+
+		free(st->blocks);
+		st->blocks = next;
+	}
+	st->bytes = 0;
+}
+
+void string_table__free(struct string_table *st)
+{
+	if (!st)
+		return;
+	free_blocks(st);
+	free(st->entries);
+	free(st->slots);
+	free(st);
+}
+
+// Copies `len` bytes plus a NUL into the arena
+static const char *store(struct string_table *st, const char *s, size_t len)
+{
+	struct arena_block *b = st->blocks;
+
+	if (!b || b->size - b->used < len + 1)
+	{
+		size_t size = len + 1 > ARENA_BLOCK_SIZE ? len + 1 : ARENA_BLOCK_SIZE;
+
+		b = malloc(sizeof(*b) + size);
+		if (!b)
+			return NULL;
+		b->size = size;
+		b->used = 0;
+		b->next = st->blocks;
+		st->blocks = b;
+	}
+
+	char *text = b->text + b->used;
+	memcpy(text, s, len);
+	text[len] = '\0';
+	b->used += len + 1;
+	st->bytes += len + 1;
+	return text;
+}
+
+static int grow_slots(struct string_table *st)
+{
+	size_t nr_slots = st->nr_slots * 2;
+	u32 *slots = calloc(nr_slots, sizeof(*slots));
+
+	if (!slots)
+		return -ENOMEM;
+	for (size_t i = 0; i < st->count; i++)
+	{
+		size_t j = st->entries[i].hash & (nr_slots - 1);
+
+		while (slots[j])
+			j = (j + 1) & (nr_slots - 1);
+		slots[j] = i + 1;
+	}
+	free(st->slots);
+	st->slots = slots;
+	st->nr_slots = nr_slots;
+	return 0;
+}
+
+u32 string_table__intern(struct string_table *st, const char *s, size_t len, u64 hash,
+						 bool *added)
+{
+	size_t j = hash & (st->nr_slots - 1);
+
+	if (added)
+		*added = false;
+	for (; st->slots[j]; j = (j + 1) & (st->nr_slots - 1))
+	{
+		const struct entry *e = &st->entries[st->slots[j] - 1];
+
+		if (e->hash == hash && e->len == len && !memcmp(e->text, s, len))
+			return st->first_id + st->slots[j] - 1;
+	}
+
+	// Always leave an empty slot, where probing stops, even if growing failed
+	if (st->count + 1 >= st->nr_slots)
+		return 0;
+	if (st->count == st->cap)
+	{
+		size_t cap = st->cap ? st->cap * 2 : MIN_SLOTS / 2;
+		struct entry *entries = realloc(st->entries, cap * sizeof(*entries));
+
+		if (!entries)
+			return 0;
+		st->entries = entries;
+		st->cap = cap;
+	}
+	const char *text = store(st, s, len);
+	if (!text)
+		return 0;
+
+	st->entries[st->count] = (struct entry){.hash = hash, .text = text, .len = len};
+	st->slots[j] = ++st->count;
+	if (st->count * 2 > st->nr_slots)
+		grow_slots(st); // a failure only leaves the index fuller
+	if (added)
+		*added = true;
+	return st->first_id + st->count - 1;
+}
+
+u32 string_table__find(const struct string_table *st, u64 hash)
+{
+	for (size_t j = hash & (st->nr_slots - 1); st->slots[j]; j = (j + 1) & (st->nr_slots - 1))
+	{
+		if (st->entries[st->slots[j] - 1].hash == hash)
+			return st->first_id + st->slots[j] - 1;
+	}
+	return 0;
+}
+
+const char *string_table__get(const struct string_table *st, u32 id, size_t *len)
+{
+	if (id < st->first_id || id - st->first_id >= st->count)
+		return NULL;
+
+	const struct entry *e = &st->entries[id - st->first_id];
+	if (len)
+		*len = e->len;
+	return e->text;
+}
+
+size_t string_table__bytes(const struct string_table *st)
+{
+	return st->bytes;
+}
+
+void string_table__clear(struct string_table *st)
+{
+	free_blocks(st);
+	memset(st->slots, 0, st->nr_slots * sizeof(*st->slots));
+	st->first_id += st->count;
+	st->count = 0;
+}
@@ -0,0 +1,51 @@
+#ifndef __STRING_TABLE_H
+#define __STRING_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bootstrap.h"
+
+/*
+ * Interned strings: each distinct byte string gets a stable id (never 0,
+ * never reused), and its text is kept once in an append-only arena. Strings
+ * are found by their string_hash(), so a hash computed once (possibly by the
+ * kernel, see OPENAT_FILENAME_REPEATED) is all a lookup needs.
+ */
+struct string_table;
+
+/* 64-bit FNV-1a, as computed by the BPF program (bootstrap.h) */
+u64 string_hash(const char *s, size_t len);
+
+/* Returns NULL with errno set */
+struct string_table *string_table__new(void);
+
+/* Accepts NULL */
+void string_table__free(struct string_table *st);
+
+/*
+ * Id of `s` (`len` bytes, no NUL needed), adding it if it is new.
+ *
+ * @param hash string_hash(s, len)
+ * @param added Set to whether the string was new, if not NULL
+ * @return Id, or 0 if out of memory
+ */
+u32 string_table__intern(struct string_table *st, const char *s, size_t len, u64 hash,
+						 bool *added);
+
+/* Id of the first string interned with `hash`, or 0 if there is none */
+u32 string_table__find(const struct string_table *st, u64 hash);
+
+/*
+ * NUL-terminated text of `id`, valid until string_table__clear(), or NULL
+ * for an unknown id
+ */
+const char *string_table__get(const struct string_table *st, u32 id, size_t *len);
+
+/* Bytes of text held, the measure its owner bounds the table by */
+size_t string_table__bytes(const struct string_table *st);
+
+/* Forgets every string. Their ids are not reused. */
+void string_table__clear(struct string_table *st);
+
+#endif /* __STRING_TABLE_H */
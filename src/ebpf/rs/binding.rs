@@ -1,166 +1,455 @@
 #[cfg(target_os = "linux")]
-pub use linux::start_processing_events;
+pub use linux::{event_stats, spill_stats, start_processing_events, unpin};
 #[cfg(not(target_os = "linux"))]
-pub use non_linux::start_processing_events;
+pub use non_linux::{event_stats, spill_stats, start_processing_events, unpin};
+
+/// Triggers the channel given to `start_processing_events` should hold.
+/// Past them, records wait undecoded in the handoff ring, then on disk.
+pub const TRIGGER_CHANNEL_CAPACITY: usize = 4096;
 
 #[cfg(target_os = "linux")]
 mod linux {
-    use crate::ebpf_trigger::Trigger;
+    use crate::ebpf_trigger::{CpuProfileTrigger, Trigger};
     use anyhow::Result;
-    use tokio::sync::mpsc::UnboundedSender;
+    use tokio::sync::mpsc::Sender;
 
     // Linux-specific imports
-    use crate::types::CEvent;
-    use std::ffi::c_void;
-    use std::sync::{mpsc as std_mpsc, Arc};
-    use std::time::Duration;
-
-    // Define the FFI interface to the C function - only on Linux
+    use crate::types::{
+        CEvent, EventStats, SpillStats, EVENT_TYPES, EVENT__SCHED__SCHED_PROCESS_EXIT,
+    };
+    use std::ffi::{c_char, c_void, CStr, CString};
+    use std::os::unix::ffi::OsStrExt;
+    use std::ptr::NonNull;
+    use std::sync::atomic::{AtomicU64, Ordering};
+    use std::sync::Mutex;
+    use std::time::{Duration, Instant};
+
+    // Define the FFI interface to the C functions - only on Linux
     #[link(name = "bootstrap", kind = "static")]
     extern "C" {
-        // Corresponds to the initialize function in bootstrap_api.h
-        fn initialize(
-            buffer: *mut c_void,
-            byte_count: usize,
-            callback: extern "C" fn(*mut c_void, usize) -> (),
+        // Handle-based lifecycle from bootstrap_api.h
+        fn tracer_open(opts: *const TracerOpts) -> *mut TracerHandle;
+        fn tracer_set_handoff(tracer: *mut TracerHandle, size: usize) -> *mut TracerHandoff;
+        fn tracer_handoff_wait(handoff: *mut TracerHandoff, timeout_ms: i32) -> i32;
+        fn tracer_attach(tracer: *mut TracerHandle) -> i32;
+        fn tracer_event_stats(
+            tracer: *const TracerHandle,
+            event_type: u32,
+            out: *mut EventStats,
+        ) -> i32;
+        fn tracer_spill_stats(tracer: *const TracerHandle, out: *mut SpillStats) -> i32;
+        fn tracer_profile_read(
+            tracer: *mut TracerHandle,
+            upid: u64,
+            callback: extern "C" fn(*mut c_void, *const c_char, u64),
             callback_ctx: *mut c_void,
         ) -> i32;
+        fn tracer_destroy(tracer: *mut TracerHandle);
+        fn tracer_unpin(pin_path: *const c_char) -> i32;
     }
 
-    // Constants - only needed on Linux
-    const BUFFER_SIZE: usize = 4096;
+    // Opaque struct tracer in bootstrap_api.h
+    #[repr(C)]
+    struct TracerHandle {
+        _private: [u8; 0],
+    }
 
-    // Define a struct to hold our context - only needed on Linux
-    struct ProcessingContext {
-        events_tx: std_mpsc::Sender<Vec<Trigger>>,
-        initialize_tx: std_mpsc::Sender<()>,
+    // struct tracer_opts in bootstrap_api.h
+    #[repr(C)]
+    #[derive(Default)]
+    struct TracerOpts {
+        verbose: bool,
+        debug_bpf: bool,
+        filter_tracked: bool,
+        wakeup_watermark: u32,
+        ring_size: u32,
+        event_mask: u32,
+        max_args: u32,
+        max_str_len: u32,
+        ring_layout: u32,
+        process_summary: bool,
+        short_process_ms: u32,
+        dedup_filenames: bool,
+        argv_bytes: u32,
+        max_path_len: u32,
+        profile_handlers: bool,
+        snapshot_existing: bool,
+        pressure_interval_ms: u32,
+        pin_path: Option<NonNull<c_char>>,
+        boot_clock: bool,
+        profile_hz: u32,
+        spill_path: Option<NonNull<c_char>>,
+        spill_bytes: u64,
     }
 
-    // Define a struct to hold our buffer and context - only needed on Linux
-    struct BufferContext {
-        buffer: Vec<u8>,
-        shared_context: Arc<ProcessingContext>,
+    // enum tracer_event_class in bootstrap_api.h
+    const TRACER_EVENTS_PROCESS: u32 = 1 << 0;
+    const TRACER_EVENTS_MEMORY: u32 = 1 << 1;
+    const TRACER_EVENTS_FILES: u32 = 1 << 2;
+
+    // The classes whose triggers the process watcher acts on. The I/O,
+    // scheduling and block classes hook every read/write, context switch
+    // and block request on the host, for triggers it only logs, so they
+    // are left out unless this is set in the environment to a mask of
+    // TRACER_EVENTS_* bits.
+    const EVENT_MASK_ENV: &str = "TRACER_EBPF_EVENT_MASK";
+    const EVENT_MASK: u32 = TRACER_EVENTS_PROCESS | TRACER_EVENTS_MEMORY | TRACER_EVENTS_FILES;
+
+    // enum ring_layout in bootstrap.h
+    const RING_LAYOUT_SHARED: u32 = 0;
+    const RING_LAYOUT_PER_CPU: u32 = 1;
+
+    // From this many CPUs on, producers contend enough on a single ring to
+    // make a ring (and a draining thread) per CPU worth it
+    const PER_CPU_RINGS_MIN_CPUS: usize = 64;
+
+    // Setting this in the environment keeps the programs and the ring pinned
+    // across daemon restarts (e.g. updates), so no event falls in between.
+    // Pinning needs the shared ring.
+    const PIN_ENV: &str = "TRACER_EBPF_PIN";
+    const PIN_PATH: &CStr = c"/sys/fs/bpf/tracer";
+
+    // Setting this to a rate (per second and CPU) samples the on-CPU stacks
+    // of every process, each sent as a CpuProfile trigger when it exits.
+    // Needs CAP_PERFMON (or CAP_SYS_ADMIN).
+    const PROFILE_HZ_ENV: &str = "TRACER_EBPF_PROFILE_HZ";
+
+    // struct tracer_handoff in bootstrap_api.h, whose positions each sit on
+    // their own cache line
+    #[repr(C, align(64))]
+    struct CacheLine(AtomicU64);
+
+    #[repr(C)]
+    struct TracerHandoff {
+        head: CacheLine, // written by the library's thread
+        tail: CacheLine, // written by us
+        data: *mut u8,
+        size: u64,
+        wakeup_fd: i32,
     }
 
-    pub fn start_processing_events(tx: UnboundedSender<Trigger>) -> Result<()> {
-        // Channel for sending events from the C callback to our Rust thread
-        let (events_tx, events_rx) = std_mpsc::channel::<Vec<Trigger>>();
+    // TRACER_HANDOFF_* in bootstrap_api.h
+    const HANDOFF_HDR: u64 = 8;
+    const HANDOFF_ALIGN: u64 = 64;
+    const HANDOFF_WRAP: u32 = 0xFFFF_FFFF;
+
+    // Bytes of undecoded records the library's thread can get ahead of this
+    // one by, in memory: the handoff ring's size. Setting this in the
+    // environment changes it, rounded down to a power of two of at least
+    // HANDOFF_MIN_SIZE.
+    const MEMORY_BUDGET_ENV: &str = "TRACER_EBPF_MEMORY_BUDGET";
+    const HANDOFF_SIZE: usize = 16 * 1024 * 1024;
+    const HANDOFF_MIN_SIZE: usize = 1024 * 1024; // HANDOFF_MIN_SIZE in handoff.h
+
+    // Past that, if this directory is set, records wait in files under it,
+    // in up to this many bytes of it, until the channel has room again;
+    // beyond those they are dropped. It must be on disk (tmpfs is refused,
+    // as spilling there would take memory all the same), so there is no
+    // default. Unset, or with a budget of 0, the library's thread waits
+    // instead, leaving the backlog to the kernel ring.
+    const SPILL_DIR_ENV: &str = "TRACER_EBPF_SPILL_DIR";
+    const SPILL_BUDGET_ENV: &str = "TRACER_EBPF_SPILL_BUDGET";
+    const SPILL_BUDGET: u64 = 1024 * 1024 * 1024;
+
+    // How long to wait for the receiving side to make room in a full channel
+    const FULL_CHANNEL_BACKOFF: Duration = Duration::from_millis(10);
+
+    // How long each wait may block, which bounds how quickly we notice the
+    // receiving side has gone away
+    const POLL_TIMEOUT_MS: i32 = 200;
+
+    // Only wake the polling thread early once this much is waiting in the
+    // ring (or for an exit/OOM); otherwise it collects every POLL_TIMEOUT_MS
+    const WAKEUP_WATERMARK: u32 = 1024 * 1024;
+
+    // How often the polling thread refreshes the stats snapshot
+    const STATS_INTERVAL: Duration = Duration::from_secs(1);
+
+    // Latest counters of the running tracer, per event type
+    static STATS: Mutex<Vec<(u32, EventStats)>> = Mutex::new(Vec::new());
+
+    // Latest counters of the running tracer's spill
+    static SPILL_STATS: Mutex<SpillStats> = Mutex::new(SpillStats {
+        spilled: 0,
+        replayed: 0,
+        dropped: 0,
+        queued_bytes: 0,
+    });
+
+    /// A loaded and attached tracer, whose handoff ring is drained into `tx`
+    struct Tracer {
+        handle: *mut TracerHandle,
+        // Owned by the handle; filled by the library's thread
+        handoff: *mut TracerHandoff,
+        tx: Sender<Trigger>,
+        profiling: bool,
+    }
 
-        // Channel for signaling when to call initialize again
-        let (initialize_tx, initialize_rx) = std_mpsc::channel::<()>();
+    // The handle is only ever driven from the one thread it is moved to, and
+    // the handoff only ever drained from it
+    unsafe impl Send for Tracer {}
+
+    impl Tracer {
+        /// Loads the BPF program once, sets up the handoff ring and attaches
+        fn open(tx: Sender<Trigger>) -> Result<Self> {
+            let cpus = std::thread::available_parallelism().map_or(1, |n| n.get());
+            let pin = std::env::var_os(PIN_ENV).is_some();
+            let profile_hz = std::env::var(PROFILE_HZ_ENV)
+                .ok()
+                .and_then(|hz| hz.parse().ok())
+                .unwrap_or(0);
+            let handoff_size = env_bytes(MEMORY_BUDGET_ENV).map_or(HANDOFF_SIZE, |budget| {
+                let size = (budget as usize).max(HANDOFF_MIN_SIZE);
+                1 << (usize::BITS - 1 - size.leading_zeros())
+            });
+            let spill_bytes = env_bytes(SPILL_BUDGET_ENV).unwrap_or(SPILL_BUDGET);
+            let spill_path = match std::env::var_os(SPILL_DIR_ENV) {
+                Some(dir) if spill_bytes > 0 => Some(CString::new(dir.as_bytes())?),
+                _ => None,
+            };
+            let event_mask = std::env::var(EVENT_MASK_ENV)
+                .ok()
+                .and_then(|mask| mask.parse().ok())
+                .unwrap_or(EVENT_MASK);
+            let opts = TracerOpts {
+                wakeup_watermark: WAKEUP_WATERMARK,
+                event_mask,
+                ring_layout: if cpus >= PER_CPU_RINGS_MIN_CPUS && !pin {
+                    RING_LAYOUT_PER_CPU
+                } else {
+                    RING_LAYOUT_SHARED
+                },
+                snapshot_existing: true,
+                pin_path: if pin {
+                    NonNull::new(PIN_PATH.as_ptr().cast_mut())
+                } else {
+                    None
+                },
+                // Cloud VMs get suspended; keep their timestamps on the wall clock
+                boot_clock: true,
+                profile_hz,
+                spill_path: spill_path
+                    .as_ref()
+                    .and_then(|path| NonNull::new(path.as_ptr().cast_mut())),
+                spill_bytes,
+                ..Default::default()
+            };
+            let handle = unsafe { tracer_open(&opts) };
+            if handle.is_null() {
+                return Err(anyhow::anyhow!(
+                    "eBPF tracer_open failed: {}",
+                    std::io::Error::last_os_error()
+                ));
+            }
 
-        // Create our shared context
-        let shared_context = Arc::new(ProcessingContext {
-            events_tx,
-            initialize_tx,
-        });
+            // From here on, Drop tears the handle down on any error
+            let mut tracer = Self {
+                handle,
+                handoff: std::ptr::null_mut(),
+                tx,
+                profiling: profile_hz > 0,
+            };
+            tracer.handoff = unsafe { tracer_set_handoff(handle, handoff_size) };
+            if tracer.handoff.is_null() {
+                return Err(anyhow::anyhow!(
+                    "eBPF tracer_set_handoff failed: {}",
+                    std::io::Error::last_os_error()
+                ));
+            }
+            check(unsafe { tracer_attach(handle) }, "tracer_attach")?;
+            Ok(tracer)
+        }
 
-        // Callback to be invoked by the C code, notifying Rust of writes to the shared buffer
-        extern "C" fn callback_func(context_ptr: *mut c_void, filled_bytes: usize) {
-            unsafe {
-                // Get our context
-                let context = &mut *(context_ptr as *mut BufferContext);
+        /// Decodes and forwards the records published so far, for as long as
+        /// the channel has room for them, then releases their slots. Returns
+        /// how many were forwarded.
+        fn drain(&self) -> usize {
+            let ring = unsafe { &*self.handoff };
+            let head = ring.head.0.load(Ordering::Acquire);
+            let mut tail = ring.tail.0.load(Ordering::Relaxed);
+            let mask = ring.size - 1;
+            let mut count = 0;
+
+            // Room for what one record can turn into: its trigger and a profile
+            while tail != head && self.tx.capacity() >= 2 {
+                let slot = unsafe { ring.data.add((tail & mask) as usize) };
+                let len = unsafe { (slot as *const u32).read() };
+                if len == HANDOFF_WRAP {
+                    tail = (tail | mask) + 1;
+                    continue;
+                }
+                let record = unsafe {
+                    std::slice::from_raw_parts(slot.add(HANDOFF_HDR as usize), len as usize)
+                };
+                self.forward(record);
+                tail += (HANDOFF_HDR + len as u64 + HANDOFF_ALIGN - 1) & !(HANDOFF_ALIGN - 1);
+                count += 1;
+            }
+            ring.tail.0.store(tail, Ordering::SeqCst);
+            count
+        }
 
-                // Parse events from the buffer
-                let buffer_slice = &context.buffer[..filled_bytes];
+        fn forward(&self, record: &[u8]) {
+            let c_event = match CEvent::parse(record) {
+                Ok(c_event) => c_event,
+                Err(e) => {
+                    eprintln!("Malformed event record: {:?}", e);
+                    return;
+                }
+            };
+
+            // Convert directly from CEvent to Trigger and send it onwards
+            match (&c_event).try_into() {
+                Ok(trigger) => {
+                    // drain() made sure of the room; a closed channel is
+                    // noticed by the draining loop
+                    let _ = self.tx.try_send(trigger);
+                }
+                Err(e) => eprintln!("Error converting CEvent to Trigger: {:?}", e),
+            }
 
-                let event_size = std::mem::size_of::<CEvent>();
-                let event_count = filled_bytes / event_size;
+            // The process's samples are complete once it has exited
+            if self.profiling
+                && c_event.header.event_type as u32 == EVENT__SCHED__SCHED_PROCESS_EXIT
+            {
+                if let Some(profile) = self.profile(&c_event) {
+                    let _ = self.tx.try_send(Trigger::CpuProfile(profile));
+                }
+            }
+        }
 
-                let mut events = Vec::with_capacity(event_count);
+        /// Reads and resets the stacks sampled in the process of an exit
+        /// record, if any
+        fn profile(&self, exit: &CEvent) -> Option<CpuProfileTrigger> {
+            extern "C" fn collect(ctx: *mut c_void, stack: *const c_char, count: u64) {
+                let stacks = unsafe { &mut *(ctx as *mut Vec<(String, u64)>) };
+                let stack = unsafe { CStr::from_ptr(stack) };
+                stacks.push((stack.to_string_lossy().into_owned(), count));
+            }
 
-                for i in 0..event_count {
-                    let offset = i * event_size;
+            let mut stacks: Vec<(String, u64)> = Vec::new();
+            let result = unsafe {
+                tracer_profile_read(
+                    self.handle,
+                    exit.header.upid,
+                    collect,
+                    &mut stacks as *mut _ as *mut c_void,
+                )
+            };
+            if let Err(e) = check(result, "tracer_profile_read") {
+                eprintln!("{}", e);
+            }
+            if stacks.is_empty() {
+                return None;
+            }
+            Some(CpuProfileTrigger {
+                pid: exit.header.pid as usize,
+                upid: exit.header.upid,
+                stacks,
+                timestamp: chrono::DateTime::from_timestamp(
+                    (exit.header.timestamp_ns / 1_000_000_000) as i64,
+                    (exit.header.timestamp_ns % 1_000_000_000) as u32,
+                )
+                .unwrap_or_default(),
+            })
+        }
+    }
 
-                    // Check if we have enough bytes for a complete event
-                    if offset + event_size > buffer_slice.len() {
-                        eprintln!("Buffer too small for event at offset {}", offset);
-                        continue;
-                    }
+    impl Tracer {
+        /// Reads the counters of every event type the program knows about
+        fn stats(&self) -> Vec<(u32, EventStats)> {
+            EVENT_TYPES
+                .iter()
+                .filter_map(|&event_type| {
+                    let mut stats = EventStats::default();
+                    let result = unsafe { tracer_event_stats(self.handle, event_type, &mut stats) };
+                    (result == 0).then_some((event_type, stats))
+                })
+                .collect()
+        }
 
-                    // Get event slice and cast to CEvent
-                    let event_slice = &buffer_slice[offset..offset + event_size];
-                    let c_event = &*(event_slice.as_ptr() as *const CEvent);
+        /// Reads the counters of the spill, if there is one
+        fn spill_stats(&self) -> Option<SpillStats> {
+            let mut stats = SpillStats::default();
+            let result = unsafe { tracer_spill_stats(self.handle, &mut stats) };
+            (result == 0).then_some(stats)
+        }
+    }
 
-                    // Convert directly from CEvent to Trigger
-                    match c_event.try_into() {
-                        Ok(trigger) => events.push(trigger),
-                        Err(e) => {
-                            eprintln!("Error converting CEvent to Trigger: {:?}", e);
-                            continue;
-                        }
-                    }
-                }
+    impl Drop for Tracer {
+        fn drop(&mut self) {
+            unsafe { tracer_destroy(self.handle) }
+        }
+    }
 
-                // Send the events to our channel
-                if !events.is_empty() {
-                    if let Err(e) = context.shared_context.events_tx.send(events) {
-                        eprintln!("Failed to send events: {:?}", e);
-                    }
-                }
+    // A byte count set in the environment
+    fn env_bytes(name: &str) -> Option<u64> {
+        std::env::var(name)
+            .ok()
+            .and_then(|bytes| bytes.parse().ok())
+    }
 
-                // Signal that we should call initialize again
-                if let Err(e) = context.shared_context.initialize_tx.send(()) {
-                    eprintln!("Failed to send initialize signal: {:?}", e);
-                }
-            }
+    fn check(result: i32, what: &str) -> Result<()> {
+        if result < 0 {
+            return Err(anyhow::anyhow!(
+                "eBPF {} failed: {}",
+                what,
+                std::io::Error::from_raw_os_error(-result)
+            ));
         }
+        Ok(())
+    }
 
-        // Spawn a thread to handle calling initialize
-        let shared_context_clone = shared_context.clone();
+    /// Forwards the decoded events into `tx`, which should hold
+    /// TRIGGER_CHANNEL_CAPACITY triggers. While it is full, records are
+    /// held back undecoded, in memory then, if enabled, on disk (see
+    /// MEMORY_BUDGET_ENV and SPILL_DIR_ENV), and forwarded in order once
+    /// the receiving side catches up.
+    pub fn start_processing_events(tx: Sender<Trigger>) -> Result<()> {
+        // Load and attach up front, so failures reach the caller
+        let tracer = Tracer::open(tx)?;
+
+        // Drain the handoff on a dedicated OS thread, so it works across
+        // runtimes; the library's own thread polls the kernel. The program
+        // stays loaded for as long as anyone is listening.
         std::thread::spawn(move || {
-            loop {
-                // Allocate a buffer for the C function to write to
-                let buffer = vec![0u8; BUFFER_SIZE];
-
-                // Create our buffer context
-                let buffer_context = Box::new(BufferContext {
-                    buffer,
-                    shared_context: shared_context_clone.clone(),
-                });
-                let buffer_context_ptr = Box::into_raw(buffer_context);
-
-                // Call the C function - this will block until an event occurs or error
-                unsafe {
-                    let result = initialize(
-                        (*buffer_context_ptr).buffer.as_mut_ptr() as *mut c_void,
-                        (*buffer_context_ptr).buffer.len(),
-                        callback_func,
-                        buffer_context_ptr as *mut c_void,
-                    );
-
-                    // Now that initialize() has returned, we can free the context
-                    // This avoids the use-after-free issue in the callback
-                    let _ = Box::from_raw(buffer_context_ptr);
-
-                    if result != 0 {
-                        // If initialization failed, break the loop
-                        eprintln!("eBPF initialization failed with code: {}", result);
-                        break;
+            let mut last_refresh = Instant::now();
+            let mut dropped = 0;
+            let mut spill_dropped = 0;
+            while !tracer.tx.is_closed() {
+                if tracer.drain() == 0 {
+                    if tracer.tx.capacity() < 2 {
+                        // Held back until the receiving side catches up
+                        std::thread::sleep(FULL_CHANNEL_BACKOFF);
+                    } else {
+                        let result =
+                            unsafe { tracer_handoff_wait(tracer.handoff, POLL_TIMEOUT_MS) };
+                        if let Err(e) = check(result, "tracer_handoff_wait") {
+                            eprintln!("{}", e);
+                            break;
+                        }
                     }
                 }
 
-                // Use a timeout on receive to avoid being stuck waiting forever
-                match initialize_rx.recv_timeout(Duration::from_secs(5)) {
-                    Ok(_) => {}
-                    Err(std_mpsc::RecvTimeoutError::Timeout) => {}
-                    Err(std_mpsc::RecvTimeoutError::Disconnected) => {
-                        eprintln!("Initialize channel closed, stopping eBPF processing");
-                        break;
+                if last_refresh.elapsed() >= STATS_INTERVAL {
+                    last_refresh = Instant::now();
+                    let stats = tracer.stats();
+                    let total: u64 = stats.iter().map(|(_, s)| s.dropped).sum();
+                    if total > dropped {
+                        eprintln!("eBPF ring buffer full: {} events dropped", total - dropped);
+                        dropped = total;
                     }
-                }
-            }
-        });
-
-        // Task to forward events from internal std channel to external Tokio channel
-        // Use a separate OS thread for this to ensure it works across runtimes
-        std::thread::spawn(move || {
-            while let Ok(events) = events_rx.recv() {
-                for event in events {
-                    // Use unbounded_send which doesn't require async
-                    if let Err(e) = tx.send(event) {
-                        eprintln!("Failed to send event, channel likely closed: {:?}", e);
-                        return;
+                    *STATS.lock().unwrap() = stats;
+
+                    if let Some(spill) = tracer.spill_stats() {
+                        if spill.dropped > spill_dropped {
+                            eprintln!(
+                                "eBPF spill budget used up: {} events dropped",
+                                spill.dropped - spill_dropped
+                            );
+                            spill_dropped = spill.dropped;
+                        }
+                        *SPILL_STATS.lock().unwrap() = spill;
                     }
                 }
             }
@@ -169,9 +458,35 @@ mod linux {
         Ok(())
     }
 
+    /// Removes what TRACER_EBPF_PIN left pinned for the next daemon, for a
+    /// shutdown that is not a restart: the programs then stop once this
+    /// process lets go of its handle, and the ring goes with them. Whether
+    /// to is the daemon's call, as dropping the receiver looks the same on
+    /// an update as on a terminate. Does nothing without TRACER_EBPF_PIN.
+    pub fn unpin() -> Result<()> {
+        if std::env::var_os(PIN_ENV).is_none() {
+            return Ok(());
+        }
+        check(unsafe { tracer_unpin(PIN_PATH.as_ptr()) }, "tracer_unpin")
+    }
+
+    /// Delivery counters per event type, as of the last refresh (at most
+    /// a second old). Empty until the tracer has been running for a while.
+    pub fn event_stats() -> Vec<(u32, EventStats)> {
+        STATS.lock().unwrap().clone()
+    }
+
+    /// Counters of the records held on disk while the channel was full, as
+    /// of the last refresh. All zero without a spill.
+    pub fn spill_stats() -> SpillStats {
+        *SPILL_STATS.lock().unwrap()
+    }
+
     #[cfg(test)]
     mod tests {
+        use super::TracerHandoff;
         use crate::ebpf_trigger::{ProcessEndTrigger, ProcessStartTrigger, Trigger};
+        use std::mem::{align_of, offset_of, size_of};
         use std::process::Command;
         use std::time::Duration;
         use tempfile::TempDir;
@@ -184,7 +499,7 @@ mod linux {
                 eprintln!("Skipping eBPF test_exit_code: requires root privileges");
                 return;
             }
-            let (tx, mut rx) = mpsc::unbounded_channel::<Trigger>();
+            let (tx, mut rx) = mpsc::channel::<Trigger>(crate::binding::TRIGGER_CHANNEL_CAPACITY);
             super::start_processing_events(tx).unwrap();
 
             // wait for eBPF to start up
@@ -244,6 +559,18 @@ mod linux {
             assert_eq!(exit_trigger.unwrap().exit_reason.unwrap().code, 1);
         }
 
+        #[test]
+        fn test_handoff_layout() {
+            // As laid out by the C compiler for struct tracer_handoff
+            assert_eq!(offset_of!(TracerHandoff, head), 0);
+            assert_eq!(offset_of!(TracerHandoff, tail), 64);
+            assert_eq!(offset_of!(TracerHandoff, data), 128);
+            assert_eq!(offset_of!(TracerHandoff, size), 136);
+            assert_eq!(offset_of!(TracerHandoff, wakeup_fd), 144);
+            assert_eq!(size_of::<TracerHandoff>(), 192);
+            assert_eq!(align_of::<TracerHandoff>(), 64);
+        }
+
         fn is_root_user() -> bool {
             use std::process::Command;
             if let Ok(output) = Command::new("id").arg("-u").output() {
@@ -260,11 +587,24 @@ mod linux {
 #[cfg(not(target_os = "linux"))]
 mod non_linux {
     use crate::ebpf_trigger::Trigger;
+    use crate::types::{EventStats, SpillStats};
     use anyhow::Result;
-    use tokio::sync::mpsc::UnboundedSender;
+    use tokio::sync::mpsc::Sender;
 
-    pub fn start_processing_events(_tx: UnboundedSender<Trigger>) -> Result<()> {
+    pub fn start_processing_events(_tx: Sender<Trigger>) -> Result<()> {
         eprintln!("eBPF functionality is only supported on Linux");
         Ok(())
     }
+
+    pub fn event_stats() -> Vec<(u32, EventStats)> {
+        Vec::new()
+    }
+
+    pub fn spill_stats() -> SpillStats {
+        SpillStats::default()
+    }
+
+    pub fn unpin() -> Result<()> {
+        Ok(())
+    }
 }
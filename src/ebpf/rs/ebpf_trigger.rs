@@ -106,6 +106,10 @@ pub struct FileOpenTrigger {
     pub size_bytes: i128, // -1 if we can't get the size of the file, otherwise the size in bytes
     pub timestamp: DateTime<Utc>, // timestamp of the event
     pub file_full_path: String, // we use it to understand if 2 equals filenames are the same file
+    #[serde(default)]
+    pub device: u32, // device and inode of the opened file, 0 if unknown
+    #[serde(default)]
+    pub inode: u64,
 }
 
 #[derive(Debug, Clone)]
@@ -131,12 +135,138 @@ pub fn format_duration_ns(duration_ns: u64) -> String {
     }
 }
 
+/// Total I/O of a process over its lifetime, aggregated in the kernel and
+/// sent once when it exits
+#[derive(Debug, Clone, Eq, PartialEq, Hash)]
+pub struct IoSummaryTrigger {
+    pub pid: usize,
+    pub upid: u64,
+    pub read_calls: u64,
+    pub read_bytes: u64,
+    pub write_calls: u64,
+    pub write_bytes: u64,
+    pub openat_calls: u64,
+    pub openat_failures: u64,
+    pub timestamp: DateTime<Utc>,
+}
+
+/// Direct reclaim and memory stall time of a process over one interval,
+/// aggregated in the kernel and sent periodically while it feels pressure
+#[derive(Debug, Clone, Eq, PartialEq, Hash)]
+pub struct MemoryPressureTrigger {
+    pub pid: usize,
+    pub upid: u64,
+    pub interval_ns: u64,
+    pub reclaim_count: u64,
+    pub reclaim_ns: u64,
+    pub reclaimed_pages: u64,
+    pub memstall_count: u64,
+    pub memstall_ns: u64,
+    pub timestamp: DateTime<Utc>,
+}
+
+/// Run-queue delay and on-CPU time of a process over its lifetime,
+/// aggregated in the kernel from scheduler events and sent once when it
+/// exits. Histogram bucket i counts intervals of [2^i, 2^(i+1)) ns.
+#[derive(Debug, Clone, Eq, PartialEq, Hash)]
+pub struct SchedStatsTrigger {
+    pub pid: usize,
+    pub upid: u64,
+    pub oncpu_ns: u64,
+    pub runq_ns: u64, // time spent runnable but waiting for a CPU
+    pub preemptions: u64,
+    pub runq_delay: [u64; 32],
+    pub oncpu: [u64; 32],
+    pub timestamp: DateTime<Utc>,
+}
+
+/// Lower bound of the bucket of a log2 histogram holding its `p`-th
+/// fraction, or None if it is empty
+fn hist_percentile(hist: &[u64; 32], p: f64) -> Option<u64> {
+    let total: u64 = hist.iter().sum();
+    if total == 0 {
+        return None;
+    }
+    let rank = ((total as f64) * p).ceil().max(1.0) as u64;
+    let mut seen = 0;
+    for (bucket, count) in hist.iter().enumerate() {
+        seen += count;
+        if seen >= rank {
+            return Some(1 << bucket);
+        }
+    }
+    None
+}
+
+impl SchedStatsTrigger {
+    /// Lower bound of the bucket holding the `p`-th fraction of the waits
+    /// for a CPU, or None if the process never waited
+    pub fn runq_delay_percentile(&self, p: f64) -> Option<u64> {
+        hist_percentile(&self.runq_delay, p)
+    }
+}
+
+/// Block device I/O of a process over its lifetime: the requests it queued
+/// or issued itself, aggregated in the kernel and sent once when it exits.
+/// Page-cache hits and writeback don't count. Latency histograms are as in
+/// SchedStatsTrigger, from issue to completion.
+#[derive(Debug, Clone, Eq, PartialEq, Hash)]
+pub struct BlockIoStatsTrigger {
+    pub pid: usize,
+    pub upid: u64,
+    pub read_bytes: u64,
+    pub write_bytes: u64,
+    pub reads: u64, // requests
+    pub writes: u64,
+    pub read_ns: u64, // device time, summed over requests
+    pub write_ns: u64,
+    pub errors: u64,
+    pub read_latency: [u64; 32],
+    pub write_latency: [u64; 32],
+    pub timestamp: DateTime<Utc>,
+}
+
+impl BlockIoStatsTrigger {
+    /// Lower bound of the bucket holding the `p`-th fraction of the read
+    /// latencies, or None if the process read nothing from a device
+    pub fn read_latency_percentile(&self, p: f64) -> Option<u64> {
+        hist_percentile(&self.read_latency, p)
+    }
+
+    /// Same, for the writes
+    pub fn write_latency_percentile(&self, p: f64) -> Option<u64> {
+        hist_percentile(&self.write_latency, p)
+    }
+}
+
+/// On-CPU stacks sampled in a process over its lifetime, read once it
+/// exits. Each stack is folded (outermost frame first, separated by ';',
+/// kernel frames suffixed "_[k]"), as flame graph tools take them.
+#[derive(Debug, Clone, Eq, PartialEq, Hash)]
+pub struct CpuProfileTrigger {
+    pub pid: usize,
+    pub upid: u64,
+    pub stacks: Vec<(String, u64)>, // folded stack and its sample count
+    pub timestamp: DateTime<Utc>,
+}
+
+impl CpuProfileTrigger {
+    pub fn samples(&self) -> u64 {
+        self.stacks.iter().map(|(_, count)| count).sum()
+    }
+}
+
 #[derive(Debug, Clone)]
 pub enum Trigger {
     ProcessStart(ProcessStartTrigger),
     ProcessEnd(ProcessEndTrigger),
     OutOfMemory(OutOfMemoryTrigger),
     FileOpen(FileOpenTrigger),
+    IoSummary(IoSummaryTrigger),
+    MemoryPressure(MemoryPressureTrigger),
+    SchedStats(Box<SchedStatsTrigger>), // boxed: the histograms dwarf the other variants
+    CpuProfile(CpuProfileTrigger),
+    BlockIoStats(Box<BlockIoStatsTrigger>),
 }
 
 impl fmt::Display for Trigger {
@@ -146,6 +276,41 @@ impl fmt::Display for Trigger {
             Trigger::ProcessEnd(t) => write!(f, "ProcessEnd(pid={})", t.pid),
             Trigger::OutOfMemory(t) => write!(f, "OOM(pid={}, comm={})", t.pid, t.comm),
             Trigger::FileOpen(t) => write!(f, "FileOpen(pid={}, file={})", t.pid, t.filename),
+            Trigger::IoSummary(t) => write!(
+                f,
+                "IoSummary(pid={}, read={}B, written={}B)",
+                t.pid, t.read_bytes, t.write_bytes
+            ),
+            Trigger::MemoryPressure(t) => write!(
+                f,
+                "MemoryPressure(pid={}, reclaim={}, stalled={})",
+                t.pid,
+                format_duration_ns(t.reclaim_ns),
+                format_duration_ns(t.memstall_ns)
+            ),
+            Trigger::SchedStats(t) => write!(
+                f,
+                "SchedStats(pid={}, on_cpu={}, run_queue={})",
+                t.pid,
+                format_duration_ns(t.oncpu_ns),
+                format_duration_ns(t.runq_ns)
+            ),
+            Trigger::CpuProfile(t) => write!(
+                f,
+                "CpuProfile(pid={}, samples={}, stacks={})",
+                t.pid,
+                t.samples(),
+                t.stacks.len()
+            ),
+            Trigger::BlockIoStats(t) => write!(
+                f,
+                "BlockIoStats(pid={}, read={}B/{}, written={}B/{})",
+                t.pid,
+                t.read_bytes,
+                format_duration_ns(t.read_ns),
+                t.write_bytes,
+                format_duration_ns(t.write_ns)
+            ),
         }
     }
 }
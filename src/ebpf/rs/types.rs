@@ -3,60 +3,245 @@ use crate::utils::{get_file_full_path, get_file_size};
 
 // CEvent must be kept in-sync with bootstrap.h types
 pub const TASK_COMM_LEN: usize = 16;
-pub const MAX_ARR_LEN: usize = 16;
 pub const MAX_STR_LEN: usize = 128;
+pub const MAX_ARGV_BYTES: usize = 28 * 1024;
+pub const MAX_PATH_LEN: usize = 4096;
 pub const MAX_ENV_LEN: usize = 1;
+
+// Flags of SysEnterOpenAtPayload::filename_flags
+pub const OPENAT_FILE_INFO: u32 = 2;
 pub const ENV_KEYS: [&str; MAX_ENV_LEN] = ["TRACER_TRACE_ID"];
 
-// Event type constants matching enum event_type
-pub const EVENT__SCHED__SCHED_PROCESS_EXEC: u32 = 0;
-pub const EVENT__SCHED__SCHED_PROCESS_EXIT: u32 = 1;
-pub const EVENT__SCHED__PSI_MEMSTALL_ENTER: u32 = 16;
-pub const EVENT__SYSCALL__SYS_ENTER_OPENAT: u32 = 1024;
-pub const EVENT__SYSCALL__SYS_EXIT_OPENAT: u32 = 1025;
-pub const EVENT__SYSCALL__SYS_ENTER_READ: u32 = 1026;
-pub const EVENT__SYSCALL__SYS_EXIT_READ: u32 = 1027;
-pub const EVENT__SYSCALL__SYS_ENTER_WRITE: u32 = 1028;
-pub const EVENT__SYSCALL__SYS_EXIT_WRITE: u32 = 1029;
-pub const EVENT__VMSCAN__MM_VMSCAN_DIRECT_RECLAIM_BEGIN: u32 = 2048;
-pub const EVENT__OOM__MARK_VICTIM: u32 = 3072;
-
-// Define payload structs for the events we care about
+// Event type constants, payload extents, EVENT_TYPES and EVENT_LAYOUT_HASH,
+// generated from c/event_schema.h at build time
+include!(concat!(env!("OUT_DIR"), "/event_schema.rs"));
+
+/// Label of an event type in event_schema.h, for messages
+pub fn event_label(event_type: u32) -> &'static str {
+    EVENT_LABELS
+        .iter()
+        .find(|(t, _)| *t == event_type)
+        .map_or("unknown", |(_, label)| label)
+}
+
+// struct event_stats in bootstrap.h: delivery counters of one event type
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct EventStats {
+    pub seen: u64,
+    pub emitted: u64,
+    pub dropped: u64,
+    pub shed: u64,
+}
+
+// struct spill_stats in bootstrap.h: counters of the handoff's on-disk overflow
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct SpillStats {
+    pub spilled: u64,
+    pub replayed: u64,
+    pub dropped: u64,
+    pub queued_bytes: u64,
+}
+
+// struct event_header in bootstrap.h: common prefix of every framed record
+#[repr(C, packed)]
+#[derive(Clone, Copy)]
+pub struct CEventHeader {
+    pub event_type: u16,
+    pub layout: u16, // EVENT_LAYOUT_HASH of the producer
+    pub len: u32,    // total record length in bytes, header included
+    pub timestamp_ns: u64,
+    pub pid: u32,
+    pub ppid: u32,
+    pub upid: u64,
+    pub uppid: u64,
+}
+
+pub const EVENT_HEADER_SIZE: usize = std::mem::size_of::<CEventHeader>();
+
+// Fixed leading fields of struct sched__sched_process_exec__payload;
+// `argv_len` bytes of NUL-separated arguments follow
 #[repr(C, packed)]
 pub struct SchedProcessExecPayload {
     pub comm: [u8; TASK_COMM_LEN],
     pub argc: u32,
-    pub argv: [[u8; MAX_STR_LEN]; MAX_ARR_LEN],
-    pub env_found_mask: u32,
-    pub env_values: [[u8; MAX_STR_LEN]; MAX_ENV_LEN],
+    pub argv_len: u32,
+    pub flags: u32,
+    pub reserved: u32,
+    pub start_ns: u64,
 }
 
+// struct sched__sched_process_exit__payload in bootstrap.h
+#[repr(C, packed)]
 pub struct SchedProcessExitPayload {
-    pub status: u16,
+    pub status: i32,
 }
 
-// struct syscall__sys_enter_openat__payload in bootstrap.h
+// Fixed leading fields of struct syscall__sys_enter_openat__payload, also
+// used by EVENT__SYSCALL__OPENAT; the NUL-terminated filename follows
 #[repr(C, packed)]
 pub struct SysEnterOpenAtPayload {
     pub dfd: i32,
-    pub filename: [u8; MAX_STR_LEN],
     pub flags: i32,
     pub mode: i32,
+    pub filename_flags: u32,
+    pub filename_hash: u64,
+    pub ret: i32,
+    pub dev: u32,
+    pub ino: u64,
+    pub size: u64,
 }
 
-// Define the CEvent struct to match the memory layout of the C struct
+// struct syscall__io_summary__payload in bootstrap.h
 #[repr(C, packed)]
-pub struct CEvent {
-    // Common fields
-    pub event_type: u32,
-    pub timestamp_ns: u64,
-    pub pid: u32,
-    pub ppid: u32,
-    pub upid: u64,
-    pub uppid: u64,
+pub struct IoSummaryPayload {
+    pub read_calls: u64,
+    pub read_bytes: u64,
+    pub write_calls: u64,
+    pub write_bytes: u64,
+    pub openat_calls: u64,
+    pub openat_failures: u64,
+}
 
-    // Payload - using a byte array large enough to hold any payload
-    pub payload: [u8; 2048],
+// struct vmscan__memory_pressure__payload in bootstrap.h
+#[repr(C, packed)]
+pub struct MemoryPressurePayload {
+    pub interval_ns: u64,
+    pub reclaim_count: u64,
+    pub reclaim_ns: u64,
+    pub reclaimed_pages: u64,
+    pub memstall_count: u64,
+    pub memstall_ns: u64,
+}
+
+pub const LATENCY_BUCKETS: usize = 32;
+
+// struct sched__sched_stats__payload in bootstrap.h
+#[repr(C, packed)]
+pub struct SchedStatsPayload {
+    pub oncpu_ns: u64,
+    pub runq_ns: u64,
+    pub preemptions: u64,
+    pub reserved: u64,
+    pub runq_delay: [u64; LATENCY_BUCKETS],
+    pub oncpu: [u64; LATENCY_BUCKETS],
+}
+
+// struct block__block_io_stats__payload in bootstrap.h
+#[repr(C, packed)]
+pub struct BlockIoStatsPayload {
+    pub read_bytes: u64,
+    pub write_bytes: u64,
+    pub reads: u64,
+    pub writes: u64,
+    pub read_ns: u64,
+    pub write_ns: u64,
+    pub errors: u64,
+    pub reserved: u64,
+    pub read_latency: [u64; LATENCY_BUCKETS],
+    pub write_latency: [u64; LATENCY_BUCKETS],
+}
+
+// The mirrors above against the C layouts, as measured by event_schema_rs.c
+const _: () = assert!(EVENT_HEADER_SIZE == EVENT_HEADER_LEN);
+const _: () = assert!(
+    std::mem::size_of::<SchedProcessExecPayload>() == PAYLOAD_EXTENT__SCHED__SCHED_PROCESS_EXEC
+);
+const _: () = assert!(
+    std::mem::size_of::<SchedProcessExitPayload>() == PAYLOAD_EXTENT__SCHED__SCHED_PROCESS_EXIT
+);
+const _: () = assert!(
+    std::mem::size_of::<SysEnterOpenAtPayload>() == PAYLOAD_EXTENT__SYSCALL__SYS_ENTER_OPENAT
+);
+const _: () =
+    assert!(std::mem::size_of::<IoSummaryPayload>() == PAYLOAD_EXTENT__SYSCALL__IO_SUMMARY);
+const _: () = assert!(
+    std::mem::size_of::<MemoryPressurePayload>() == PAYLOAD_EXTENT__VMSCAN__MEMORY_PRESSURE
+);
+const _: () =
+    assert!(std::mem::size_of::<SchedStatsPayload>() == PAYLOAD_EXTENT__SCHED__SCHED_STATS);
+const _: () =
+    assert!(std::mem::size_of::<BlockIoStatsPayload>() == PAYLOAD_EXTENT__BLOCK__BLOCK_IO_STATS);
+
+/// A single framed record borrowed from the shared buffer: the common
+/// header followed by only the bytes of its payload
+pub struct CEvent<'a> {
+    pub header: CEventHeader,
+    pub payload: &'a [u8],
+}
+
+impl<'a> CEvent<'a> {
+    /// Parses the record at the start of `buf`, validating its framing
+    pub fn parse(buf: &'a [u8]) -> anyhow::Result<Self> {
+        if buf.len() < EVENT_HEADER_SIZE {
+            anyhow::bail!("Truncated event header ({} bytes)", buf.len());
+        }
+        let header = unsafe { std::ptr::read_unaligned(buf.as_ptr() as *const CEventHeader) };
+        let len = header.len as usize;
+        if len < EVENT_HEADER_SIZE || len > buf.len() {
+            anyhow::bail!(
+                "Invalid event length {} ({} bytes available)",
+                len,
+                buf.len()
+            );
+        }
+        // e.g. from programs an older build left pinned: the payload can't be read
+        if header.layout != EVENT_LAYOUT_HASH {
+            anyhow::bail!(
+                "Event of another layout ({:#x}, expected {:#x})",
+                { header.layout },
+                EVENT_LAYOUT_HASH
+            );
+        }
+        Ok(Self {
+            header,
+            payload: &buf[EVENT_HEADER_SIZE..len],
+        })
+    }
+
+    /// Reads the fixed-layout prefix of the payload, if the record is long enough
+    fn payload_prefix<T>(&self) -> anyhow::Result<(T, &'a [u8])> {
+        let size = std::mem::size_of::<T>();
+        if self.payload.len() < size {
+            anyhow::bail!(
+                "Truncated payload for event type {}",
+                event_label(self.header.event_type as u32)
+            );
+        }
+        let prefix = unsafe { std::ptr::read_unaligned(self.payload.as_ptr() as *const T) };
+        Ok((prefix, &self.payload[size..]))
+    }
+}
+
+/// Walks a buffer of framed records by the length in each header
+pub struct CEventIter<'a> {
+    buf: &'a [u8],
+}
+
+impl<'a> Iterator for CEventIter<'a> {
+    type Item = anyhow::Result<CEvent<'a>>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        if self.buf.is_empty() {
+            return None;
+        }
+        match CEvent::parse(self.buf) {
+            Ok(event) => {
+                self.buf = &self.buf[event.header.len as usize..];
+                Some(Ok(event))
+            }
+            Err(e) => {
+                // Framing is lost, so nothing after this point can be trusted
+                self.buf = &[];
+                Some(Err(e))
+            }
+        }
+    }
+}
+
+pub fn events(buf: &[u8]) -> CEventIter<'_> {
+    CEventIter { buf }
 }
 
 // --------------------------------------------------------------------------
@@ -114,45 +299,53 @@ pub fn format_duration_ns(duration_ns: u64) -> String {
 }
 
 // Implement TryInto for CEvent to convert directly to Trigger
-impl TryInto<ebpf_trigger::Trigger> for &CEvent {
+impl TryInto<ebpf_trigger::Trigger> for &CEvent<'_> {
     type Error = anyhow::Error;
 
     fn try_into(self) -> Result<ebpf_trigger::Trigger, Self::Error> {
-        match self.event_type {
-            EVENT__SCHED__SCHED_PROCESS_EXEC => {
-                let payload_ptr = self.payload.as_ptr() as *const SchedProcessExecPayload;
-                let payload = unsafe { &*payload_ptr };
+        let header = self.header;
+        let event_type = header.event_type as u32;
+        match event_type {
+            // A snapshot record describes a process already running at
+            // attach, started at `start_ns` rather than at the record's time
+            EVENT__SCHED__SCHED_PROCESS_EXEC | EVENT__SCHED__PROCESS_SNAPSHOT => {
+                let (payload, argv_bytes) = self.payload_prefix::<SchedProcessExecPayload>()?;
 
                 let comm = from_bpf_str(&payload.comm)?;
 
-                let mut args = Vec::new();
-                for i in 0..payload.argc as usize {
-                    if i >= MAX_ARR_LEN {
-                        break;
-                    }
-                    args.push(from_bpf_str(&payload.argv[i])?);
+                // Arguments are packed back to back, each NUL-terminated
+                let argv_len = (payload.argv_len as usize).min(argv_bytes.len());
+                let mut args = Vec::with_capacity(payload.argc as usize);
+                for arg in argv_bytes[..argv_len]
+                    .split(|&b| b == 0)
+                    .take(payload.argc as usize)
+                {
+                    args.push(from_bpf_str(arg)?);
                 }
 
                 Ok(ebpf_trigger::Trigger::ProcessStart(
                     ebpf_trigger::ProcessStartTrigger::from_bpf_event(
-                        self.pid,
-                        self.ppid,
+                        header.pid,
+                        header.ppid,
                         comm.as_str(),
                         args,
-                        self.timestamp_ns,
+                        if event_type == EVENT__SCHED__PROCESS_SNAPSHOT {
+                            payload.start_ns
+                        } else {
+                            header.timestamp_ns
+                        },
                     ),
                 ))
             }
             EVENT__SCHED__SCHED_PROCESS_EXIT => {
-                let payload_ptr = self.payload.as_ptr() as *const SchedProcessExitPayload;
-                let payload = unsafe { &*payload_ptr };
+                let (payload, _) = self.payload_prefix::<SchedProcessExitPayload>()?;
 
                 Ok(ebpf_trigger::Trigger::ProcessEnd(
                     ebpf_trigger::ProcessEndTrigger {
-                        pid: self.pid as usize,
+                        pid: header.pid as usize,
                         finished_at: chrono::DateTime::from_timestamp(
-                            (self.timestamp_ns / 1_000_000_000) as i64,
-                            (self.timestamp_ns % 1_000_000_000) as u32,
+                            (header.timestamp_ns / 1_000_000_000) as i64,
+                            (header.timestamp_ns % 1_000_000_000) as u32,
                         )
                         .unwrap(),
                         exit_reason: Some((payload.status as i64).into()),
@@ -160,29 +353,39 @@ impl TryInto<ebpf_trigger::Trigger> for &CEvent {
                 ))
             }
             EVENT__OOM__MARK_VICTIM => {
-                let comm = from_bpf_str(&self.payload[..TASK_COMM_LEN])?;
+                let comm_len = self.payload.len().min(TASK_COMM_LEN);
+                let comm = from_bpf_str(&self.payload[..comm_len])?;
 
                 Ok(ebpf_trigger::Trigger::OutOfMemory(
                     ebpf_trigger::OutOfMemoryTrigger {
-                        pid: self.pid as usize,
-                        upid: self.upid,
+                        pid: header.pid as usize,
+                        upid: header.upid,
                         comm,
                         timestamp: chrono::DateTime::from_timestamp(
-                            (self.timestamp_ns / 1_000_000_000) as i64,
-                            (self.timestamp_ns % 1_000_000_000) as u32,
+                            (header.timestamp_ns / 1_000_000_000) as i64,
+                            (header.timestamp_ns % 1_000_000_000) as u32,
                         )
                         .unwrap(),
                     },
                 ))
             }
-            EVENT__SYSCALL__SYS_ENTER_OPENAT => {
-                let payload_ptr = self.payload.as_ptr() as *const SysEnterOpenAtPayload;
-                let payload = unsafe { &*payload_ptr };
-                let pid = self.pid;
+            EVENT__SYSCALL__SYS_ENTER_OPENAT | EVENT__SYSCALL__OPENAT => {
+                let (payload, filename_bytes) = self.payload_prefix::<SysEnterOpenAtPayload>()?;
+                let pid = header.pid;
 
-                let filename = from_bpf_str(&payload.filename)?;
+                let filename = from_bpf_str(filename_bytes)?;
 
-                let size_bytes = get_file_size(pid, &filename).unwrap_or(-1);
+                // A successful open already describes its file (with its
+                // absolute path as filename). Only the tracepoint fallback,
+                // which never sees the result, still has to stat the path.
+                let file_info = payload.filename_flags & OPENAT_FILE_INFO != 0;
+                let size_bytes = if file_info {
+                    payload.size as i128
+                } else if event_type == EVENT__SYSCALL__OPENAT {
+                    -1
+                } else {
+                    get_file_size(pid, &filename).unwrap_or(-1)
+                };
                 let file_full_path = get_file_full_path(pid, &filename);
 
                 Ok(ebpf_trigger::Trigger::FileOpen(
@@ -191,15 +394,340 @@ impl TryInto<ebpf_trigger::Trigger> for &CEvent {
                         filename,
                         size_bytes,
                         timestamp: chrono::DateTime::from_timestamp(
-                            (self.timestamp_ns / 1_000_000_000) as i64,
-                            (self.timestamp_ns % 1_000_000_000) as u32,
+                            (header.timestamp_ns / 1_000_000_000) as i64,
+                            (header.timestamp_ns % 1_000_000_000) as u32,
                         )
                         .unwrap(),
                         file_full_path,
+                        device: if file_info { payload.dev } else { 0 },
+                        inode: if file_info { payload.ino } else { 0 },
+                    },
+                ))
+            }
+            EVENT__VMSCAN__MEMORY_PRESSURE => {
+                let (payload, _) = self.payload_prefix::<MemoryPressurePayload>()?;
+
+                Ok(ebpf_trigger::Trigger::MemoryPressure(
+                    ebpf_trigger::MemoryPressureTrigger {
+                        pid: header.pid as usize,
+                        upid: header.upid,
+                        interval_ns: payload.interval_ns,
+                        reclaim_count: payload.reclaim_count,
+                        reclaim_ns: payload.reclaim_ns,
+                        reclaimed_pages: payload.reclaimed_pages,
+                        memstall_count: payload.memstall_count,
+                        memstall_ns: payload.memstall_ns,
+                        timestamp: chrono::DateTime::from_timestamp(
+                            (header.timestamp_ns / 1_000_000_000) as i64,
+                            (header.timestamp_ns % 1_000_000_000) as u32,
+                        )
+                        .unwrap(),
+                    },
+                ))
+            }
+            EVENT__SCHED__SCHED_STATS => {
+                let (payload, _) = self.payload_prefix::<SchedStatsPayload>()?;
+
+                Ok(ebpf_trigger::Trigger::SchedStats(Box::new(
+                    ebpf_trigger::SchedStatsTrigger {
+                        pid: header.pid as usize,
+                        upid: header.upid,
+                        oncpu_ns: payload.oncpu_ns,
+                        runq_ns: payload.runq_ns,
+                        preemptions: payload.preemptions,
+                        runq_delay: payload.runq_delay,
+                        oncpu: payload.oncpu,
+                        timestamp: chrono::DateTime::from_timestamp(
+                            (header.timestamp_ns / 1_000_000_000) as i64,
+                            (header.timestamp_ns % 1_000_000_000) as u32,
+                        )
+                        .unwrap(),
+                    },
+                )))
+            }
+            EVENT__BLOCK__BLOCK_IO_STATS => {
+                let (payload, _) = self.payload_prefix::<BlockIoStatsPayload>()?;
+
+                Ok(ebpf_trigger::Trigger::BlockIoStats(Box::new(
+                    ebpf_trigger::BlockIoStatsTrigger {
+                        pid: header.pid as usize,
+                        upid: header.upid,
+                        read_bytes: payload.read_bytes,
+                        write_bytes: payload.write_bytes,
+                        reads: payload.reads,
+                        writes: payload.writes,
+                        read_ns: payload.read_ns,
+                        write_ns: payload.write_ns,
+                        errors: payload.errors,
+                        read_latency: payload.read_latency,
+                        write_latency: payload.write_latency,
+                        timestamp: chrono::DateTime::from_timestamp(
+                            (header.timestamp_ns / 1_000_000_000) as i64,
+                            (header.timestamp_ns % 1_000_000_000) as u32,
+                        )
+                        .unwrap(),
+                    },
+                )))
+            }
+            EVENT__SYSCALL__IO_SUMMARY => {
+                let (payload, _) = self.payload_prefix::<IoSummaryPayload>()?;
+
+                Ok(ebpf_trigger::Trigger::IoSummary(
+                    ebpf_trigger::IoSummaryTrigger {
+                        pid: header.pid as usize,
+                        upid: header.upid,
+                        read_calls: payload.read_calls,
+                        read_bytes: payload.read_bytes,
+                        write_calls: payload.write_calls,
+                        write_bytes: payload.write_bytes,
+                        openat_calls: payload.openat_calls,
+                        openat_failures: payload.openat_failures,
+                        timestamp: chrono::DateTime::from_timestamp(
+                            (header.timestamp_ns / 1_000_000_000) as i64,
+                            (header.timestamp_ns % 1_000_000_000) as u32,
+                        )
+                        .unwrap(),
                     },
                 ))
             }
-            _ => Err(anyhow::anyhow!("Unsupported event type")),
+            _ => Err(anyhow::anyhow!(
+                "Unsupported event type {}",
+                event_label(event_type)
+            )),
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::ebpf_trigger::Trigger;
+
+    fn record(event_type: u32, pid: u32, payload: &[u8]) -> Vec<u8> {
+        let header = CEventHeader {
+            event_type: event_type as u16,
+            layout: EVENT_LAYOUT_HASH,
+            len: (EVENT_HEADER_SIZE + payload.len()) as u32,
+            timestamp_ns: 1_000_000_123,
+            pid,
+            ppid: 1,
+            upid: 0,
+            uppid: 0,
+        };
+        let header_bytes = unsafe {
+            std::slice::from_raw_parts(&header as *const _ as *const u8, EVENT_HEADER_SIZE)
+        };
+        [header_bytes, payload].concat()
+    }
+
+    fn exec_payload(comm: &str, argv: &[&str]) -> Vec<u8> {
+        let mut comm_bytes = [0u8; TASK_COMM_LEN];
+        comm_bytes[..comm.len()].copy_from_slice(comm.as_bytes());
+        let packed: Vec<u8> = argv
+            .iter()
+            .flat_map(|a| a.bytes().chain(std::iter::once(0)))
+            .collect();
+        let mut payload = comm_bytes.to_vec();
+        payload.extend_from_slice(&(argv.len() as u32).to_ne_bytes());
+        payload.extend_from_slice(&(packed.len() as u32).to_ne_bytes());
+        payload.extend_from_slice(&[0u8; 16]); // flags, reserved, start_ns
+        payload.extend_from_slice(&packed);
+        payload
+    }
+
+    #[test]
+    fn test_walk_variable_length_records() {
+        let mut buf = record(
+            EVENT__SCHED__SCHED_PROCESS_EXEC,
+            42,
+            &exec_payload("cat", &["cat", "file1", "file2"]),
+        );
+        buf.extend(record(
+            EVENT__SCHED__SCHED_PROCESS_EXIT,
+            42,
+            &(1i32 << 8).to_ne_bytes(),
+        ));
+
+        let triggers: Vec<Trigger> = events(&buf)
+            .map(|e| (&e.unwrap()).try_into().unwrap())
+            .collect();
+        assert_eq!(triggers.len(), 2);
+        match &triggers[0] {
+            Trigger::ProcessStart(t) => {
+                assert_eq!(t.pid, 42);
+                assert_eq!(t.comm, "cat");
+                assert_eq!(t.argv, vec!["cat", "file1", "file2"]);
+            }
+            other => panic!("unexpected trigger {}", other),
+        }
+        match &triggers[1] {
+            Trigger::ProcessEnd(t) => assert_eq!(t.exit_reason.as_ref().unwrap().code, 1),
+            other => panic!("unexpected trigger {}", other),
+        }
+    }
+
+    #[test]
+    fn test_io_summary_record() {
+        let counters: [u64; 6] = [3, 4096, 2, 100, 5, 1];
+        let payload: Vec<u8> = counters.iter().flat_map(|c| c.to_ne_bytes()).collect();
+        let buf = record(EVENT__SYSCALL__IO_SUMMARY, 42, &payload);
+
+        let event = CEvent::parse(&buf).unwrap();
+        match (&event).try_into().unwrap() {
+            Trigger::IoSummary(t) => {
+                assert_eq!(t.pid, 42);
+                assert_eq!(t.read_bytes, 4096);
+                assert_eq!(t.write_calls, 2);
+                assert_eq!(t.openat_failures, 1);
+            }
+            other => panic!("unexpected trigger {}", other),
         }
     }
+
+    #[test]
+    fn test_resolved_openat_record() {
+        let mut payload = Vec::new();
+        for v in [-100i32, 0, 0] {
+            payload.extend_from_slice(&v.to_ne_bytes());
+        }
+        payload.extend_from_slice(&(OPENAT_FILE_INFO | 4).to_ne_bytes());
+        payload.extend_from_slice(&0u64.to_ne_bytes()); // filename_hash
+        payload.extend_from_slice(&3i32.to_ne_bytes()); // ret
+        payload.extend_from_slice(&0x0080_0001u32.to_ne_bytes()); // dev
+        payload.extend_from_slice(&1234u64.to_ne_bytes()); // ino
+        payload.extend_from_slice(&(1u64 << 33).to_ne_bytes()); // size
+        payload.extend_from_slice(b"/data/sample.bam\0");
+        let buf = record(EVENT__SYSCALL__OPENAT, 42, &payload);
+
+        let event = CEvent::parse(&buf).unwrap();
+        match (&event).try_into().unwrap() {
+            Trigger::FileOpen(t) => {
+                assert_eq!(t.filename, "/data/sample.bam");
+                assert_eq!(t.size_bytes, 1 << 33);
+                assert_eq!(t.device, 0x0080_0001);
+                assert_eq!(t.inode, 1234);
+            }
+            other => panic!("unexpected trigger {}", other),
+        }
+    }
+
+    #[test]
+    fn test_sched_stats_record() {
+        let mut fields = vec![5_000_000u64, 300_000, 7, 0];
+        let mut runq_delay = [0u64; LATENCY_BUCKETS];
+        runq_delay[10] = 4;
+        let mut oncpu = [0u64; LATENCY_BUCKETS];
+        oncpu[20] = 3;
+        fields.extend_from_slice(&runq_delay);
+        fields.extend_from_slice(&oncpu);
+        let payload: Vec<u8> = fields.iter().flat_map(|v| v.to_ne_bytes()).collect();
+        let buf = record(EVENT__SCHED__SCHED_STATS, 42, &payload);
+
+        let event = CEvent::parse(&buf).unwrap();
+        match (&event).try_into().unwrap() {
+            Trigger::SchedStats(t) => {
+                assert_eq!(t.pid, 42);
+                assert_eq!(t.oncpu_ns, 5_000_000);
+                assert_eq!(t.preemptions, 7);
+                assert_eq!(t.runq_delay[10], 4);
+                assert_eq!(t.oncpu[20], 3);
+                assert_eq!(t.runq_delay_percentile(0.5), Some(1 << 10));
+            }
+            other => panic!("unexpected trigger {}", other),
+        }
+    }
+
+    #[test]
+    fn test_block_io_stats_record() {
+        let mut fields = vec![1 << 20, 4096, 16, 1, 8_000_000u64, 50_000, 0, 0];
+        let mut read_latency = [0u64; LATENCY_BUCKETS];
+        read_latency[19] = 15;
+        read_latency[22] = 1;
+        fields.extend_from_slice(&read_latency);
+        fields.extend_from_slice(&[0u64; LATENCY_BUCKETS]);
+        let payload: Vec<u8> = fields.iter().flat_map(|v| v.to_ne_bytes()).collect();
+        let buf = record(EVENT__BLOCK__BLOCK_IO_STATS, 42, &payload);
+
+        let event = CEvent::parse(&buf).unwrap();
+        match (&event).try_into().unwrap() {
+            Trigger::BlockIoStats(t) => {
+                assert_eq!(t.pid, 42);
+                assert_eq!(t.read_bytes, 1 << 20);
+                assert_eq!(t.reads, 16);
+                assert_eq!(t.write_ns, 50_000);
+                assert_eq!(t.read_latency_percentile(0.5), Some(1 << 19));
+                assert_eq!(t.read_latency_percentile(0.99), Some(1 << 22));
+                assert_eq!(t.write_latency_percentile(0.5), None);
+            }
+            other => panic!("unexpected trigger {}", other),
+        }
+    }
+
+    #[test]
+    fn test_memory_pressure_record() {
+        let counters: [u64; 6] = [1_000_000_000, 12, 3_000_000, 640, 2, 500_000];
+        let payload: Vec<u8> = counters.iter().flat_map(|c| c.to_ne_bytes()).collect();
+        let buf = record(EVENT__VMSCAN__MEMORY_PRESSURE, 42, &payload);
+
+        let event = CEvent::parse(&buf).unwrap();
+        match (&event).try_into().unwrap() {
+            Trigger::MemoryPressure(t) => {
+                assert_eq!(t.pid, 42);
+                assert_eq!(t.reclaim_count, 12);
+                assert_eq!(t.reclaimed_pages, 640);
+                assert_eq!(t.memstall_ns, 500_000);
+            }
+            other => panic!("unexpected trigger {}", other),
+        }
+    }
+
+    #[test]
+    fn test_snapshot_record_uses_start_time() {
+        let mut payload = exec_payload("sleep", &["sleep", "60"]);
+        let start_ns = 5_000_000_123u64;
+        let offset = std::mem::offset_of!(SchedProcessExecPayload, start_ns);
+        payload[offset..offset + 8].copy_from_slice(&start_ns.to_ne_bytes());
+        let buf = record(EVENT__SCHED__PROCESS_SNAPSHOT, 42, &payload);
+
+        let event = CEvent::parse(&buf).unwrap();
+        match (&event).try_into().unwrap() {
+            Trigger::ProcessStart(t) => {
+                assert_eq!(t.argv, vec!["sleep", "60"]);
+                assert_eq!(t.started_at.timestamp(), 5);
+                assert_eq!(t.started_at.timestamp_subsec_nanos(), 123);
+            }
+            other => panic!("unexpected trigger {}", other),
+        }
+    }
+
+    #[test]
+    fn test_truncated_record_stops_walk() {
+        let mut buf = record(EVENT__SCHED__SCHED_PROCESS_EXIT, 7, &0i32.to_ne_bytes());
+        buf.truncate(buf.len() - 1);
+        let mut iter = events(&buf);
+        assert!(iter.next().unwrap().is_err());
+        assert!(iter.next().is_none());
+    }
+
+    #[test]
+    fn test_foreign_layout_rejected() {
+        let mut buf = record(EVENT__SCHED__SCHED_PROCESS_EXIT, 7, &0i32.to_ne_bytes());
+        let offset = std::mem::offset_of!(CEventHeader, layout);
+        buf[offset..offset + 2].copy_from_slice(&EVENT_LAYOUT_HASH.wrapping_add(1).to_ne_bytes());
+        assert!(CEvent::parse(&buf).is_err());
+        assert_eq!(event_label(EVENT__SYSCALL__IO_SUMMARY), "io_summary");
+    }
+
+    #[test]
+    fn test_event_stats_layout() {
+        // Four u64 counters, matching struct event_stats
+        assert_eq!(std::mem::size_of::<EventStats>(), 32);
+    }
+
+    #[test]
+    fn test_spill_stats_layout() {
+        // Four u64 counters, matching struct spill_stats
+        assert_eq!(std::mem::size_of::<SpillStats>(), 32);
+        assert_eq!(std::mem::offset_of!(SpillStats, queued_bytes), 24);
+    }
 }
@@ -1,5 +1,7 @@
 /// Getting the size of a file in bytes.
 /// This considers both the host and container filesystems.
+/// Opens traced by the fexit program carry the size already; this is for the
+/// tracepoint fallback and for polling files that are still growing.
 pub fn get_file_size(pid: u32, filename: &str) -> Option<i128> {
     // Construct the container-aware path via /proc
     let file_full_path = get_file_full_path(pid, filename);
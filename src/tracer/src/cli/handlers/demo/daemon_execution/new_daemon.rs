@@ -67,5 +67,5 @@ async fn execute_pipeline_and_report(pipeline: Pipeline, api_client: &DaemonClie
 
 async fn cleanup_daemon(api_client: &DaemonClient) {
     info_message!("Cleaning up daemon...");
-    terminate::terminate(api_client).await;
+    terminate::terminate(api_client, false).await;
 }
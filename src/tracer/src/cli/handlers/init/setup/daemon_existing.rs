@@ -20,7 +20,7 @@ pub async fn handle_existing_daemon(
             "Daemon already running{}. Terminating due to --force flag...",
             pid_info
         );
-        if !terminate(api_client).await {
+        if !terminate(api_client, true).await {
             return Err(anyhow::anyhow!("Failed to terminate existing daemon"));
         }
         return Ok(());
@@ -37,7 +37,7 @@ pub async fn handle_existing_daemon(
 
         if should_terminate {
             info_message!("Terminating existing daemon...");
-            if !terminate(api_client).await {
+            if !terminate(api_client, true).await {
                 return Err(anyhow::anyhow!("Failed to terminate existing daemon"));
             }
             return Ok(());
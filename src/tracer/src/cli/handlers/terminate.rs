@@ -17,12 +17,14 @@ pub(super) fn get_pid() -> Option<String> {
     }
 }
 
-pub async fn terminate(api_client: &DaemonClient) -> bool {
+/// `restart`: a new daemon is started next, which takes over the eBPF
+/// programs the old one leaves pinned
+pub async fn terminate(api_client: &DaemonClient, restart: bool) -> bool {
     if !DaemonServer::is_running() {
         warning_message!("Daemon server is not running. Nothing to terminate.");
         return false;
     }
-    if let Err(e) = api_client.send_terminate_request().await {
+    if let Err(e) = api_client.send_terminate_request(restart).await {
         error_message!("Failed to send terminate request to the daemon: {e}");
         error_message!(
             "Try running `sudo kill -9 {}` to forcefully terminate the daemon.",
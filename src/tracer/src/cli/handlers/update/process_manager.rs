@@ -77,9 +77,10 @@ impl ProcessManager {
 
         let api_client = DaemonClient::new(format!("http://127.0.0.1:{}", DEFAULT_DAEMON_PORT));
 
-        // Use async runtime to call the terminate API
+        // Use async runtime to call the terminate API. The updated daemon
+        // takes over whatever eBPF state this one leaves pinned.
         let rt = tokio::runtime::Runtime::new()?;
-        rt.block_on(async { api_client.send_terminate_request().await })?;
+        rt.block_on(async { api_client.send_terminate_request(true).await })?;
 
         Ok(())
     }
@@ -74,11 +74,11 @@ pub async fn process_daemon_command(command: Command, config: Config) {
         Command::Stop { terminate } => {
             let _ = handlers::stop(&api_client).await;
             if terminate {
-                let _ = handlers::terminate(&api_client).await;
+                let _ = handlers::terminate(&api_client, false).await;
             }
         }
         Command::Terminate => {
-            let _ = handlers::terminate(&api_client).await;
+            let _ = handlers::terminate(&api_client, false).await;
         }
         Command::Otel { command } => {
             if let Err(e) = handlers::handle_otel_command(command).await {
@@ -3,7 +3,7 @@ use crate::daemon::handlers::get_user_id::{GetUserIdResponse, GET_USER_ID_ENDPOI
 use crate::daemon::handlers::info::INFO_ENDPOINT;
 use crate::daemon::handlers::start::START_ENDPOINT;
 use crate::daemon::handlers::stop::STOP_ENDPOINT;
-use crate::daemon::handlers::terminate::TERMINATE_ENDPOINT;
+use crate::daemon::handlers::terminate::{TerminateRequest, TERMINATE_ENDPOINT};
 use crate::daemon::handlers::update_run_name::{
     UpdateRunNameRequest, UpdateRunNameResponse, UPDATE_RUN_NAME_ENDPOINT,
 };
@@ -79,8 +79,10 @@ impl DaemonClient {
         self.request(STOP_ENDPOINT, Some(())).await
     }
 
-    pub async fn send_terminate_request(&self) -> Result<String> {
-        self.request(TERMINATE_ENDPOINT, Some(())).await
+    /// `restart`: another daemon takes over, see TerminateRequest
+    pub async fn send_terminate_request(&self, restart: bool) -> Result<String> {
+        self.request(TERMINATE_ENDPOINT, Some(TerminateRequest { restart }))
+            .await
     }
 
     pub async fn send_info_request(&self) -> Result<PipelineMetadata> {
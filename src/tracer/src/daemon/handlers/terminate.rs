@@ -2,12 +2,23 @@ use crate::daemon::state::DaemonState;
 use axum::extract::State;
 use axum::response::IntoResponse;
 use axum::Json;
+use serde::{Deserialize, Serialize};
 
 pub const TERMINATE_ENDPOINT: &str = "/terminate";
 
+#[derive(Deserialize, Serialize, Default)]
+pub struct TerminateRequest {
+    /// Another daemon takes over (an update or `init --force`): the eBPF
+    /// programs and ring stay pinned for it, so no event falls in between
+    #[serde(default)]
+    pub restart: bool,
+}
+
 pub async fn terminate(
     State(state): State<DaemonState>,
+    // Older clients send no body (`null`): a terminate for good
+    Json(request): Json<Option<TerminateRequest>>,
 ) -> axum::response::Result<impl IntoResponse> {
-    state.terminate_server();
+    state.terminate_server(request.unwrap_or_default().restart);
     Ok(Json("Termination request sent successfully."))
 }
@@ -115,13 +115,20 @@ impl DaemonServer {
         });
 
         let _ = termination_token.cancelled().await;
-        self.terminate().await?;
+        self.terminate(state.is_restarting()).await?;
         Ok(())
     }
 
-    pub async fn terminate(mut self) -> anyhow::Result<()> {
+    /// `restart`: another daemon takes over, so the eBPF pins are left to it
+    pub async fn terminate(mut self, restart: bool) -> anyhow::Result<()> {
         use super::termination::{terminate_server, TerminationConfig, TerminationResult};
 
+        if !restart {
+            if let Err(e) = tracer_ebpf::binding::unpin() {
+                tracing::warn!("Failed to unpin eBPF programs: {}", e);
+            }
+        }
+
         let server = self.server.take();
         let config = TerminationConfig::default();
 
@@ -5,6 +5,7 @@ use crate::daemon::server::process_monitor::monitor;
 use crate::daemon::structs::PipelineMetadata;
 use anyhow::Context;
 use std::env;
+use std::sync::atomic::{AtomicBool, Ordering};
 use std::sync::Arc;
 use tokio::sync::Mutex;
 use tokio_util::sync::CancellationToken;
@@ -16,6 +17,7 @@ pub(super) struct DaemonState {
     tracer_client: Arc<Mutex<Option<Arc<Mutex<TracerClient>>>>>,
     pipeline: Arc<Mutex<PipelineMetadata>>,
     server_token: CancellationToken,
+    restart: Arc<AtomicBool>,
     directory: std::path::PathBuf,
 }
 
@@ -28,6 +30,7 @@ impl DaemonState {
             config: Arc::new(Mutex::new(config)),
             tracer_client: Arc::new(Mutex::new(None)),
             server_token,
+            restart: Arc::new(AtomicBool::new(false)),
             pipeline: Arc::new(Mutex::new(pipeline_data)),
             directory,
         }
@@ -48,9 +51,15 @@ impl DaemonState {
         Some(args.user_id.clone())
     }
 
-    pub fn terminate_server(&self) {
+    /// `restart`: another daemon takes over, see TerminateRequest
+    pub fn terminate_server(&self, restart: bool) {
+        self.restart.store(restart, Ordering::Relaxed);
         self.server_token.cancel();
     }
+
+    pub fn is_restarting(&self) -> bool {
+        self.restart.load(Ordering::Relaxed)
+    }
     pub async fn stop_client(&self) -> bool {
         let option_client = self.tracer_client.lock().await;
 
@@ -12,7 +12,7 @@ use std::fs::{self};
 use std::sync::Arc;
 use sysinfo::ProcessesToUpdate;
 use tokio::sync::{mpsc, Mutex, RwLock};
-use tracer_ebpf::binding::start_processing_events;
+use tracer_ebpf::binding::{start_processing_events, TRIGGER_CHANNEL_CAPACITY};
 use tracer_ebpf::ebpf_trigger::{
     FileOpenTrigger, OutOfMemoryTrigger, ProcessEndTrigger, ProcessStartTrigger, Trigger,
 };
@@ -136,8 +136,9 @@ impl ProcessWatcher {
 
     fn initialize_ebpf(self: Arc<Self>) -> Result<(), Error> {
         info!("Initializing eBPF monitoring");
-        // Use unbounded channel for cross-runtime compatibility
-        let (tx, rx) = mpsc::unbounded_channel::<Trigger>();
+        // Bounded, so a stalled consumer holds events back in the eBPF layer
+        // (in memory, then spilled to disk) instead of growing this channel
+        let (tx, rx) = mpsc::channel::<Trigger>(TRIGGER_CHANNEL_CAPACITY);
 
         // Start the eBPF event processing
         info!("Starting eBPF event processing");
@@ -179,32 +180,26 @@ impl ProcessWatcher {
     }
 
     /// Main loop that processes triggers from eBPF
-    async fn process_trigger_loop(
-        self: &Arc<Self>,
-        mut rx: mpsc::UnboundedReceiver<Trigger>,
-    ) -> Result<()> {
+    async fn process_trigger_loop(self: &Arc<Self>, mut rx: mpsc::Receiver<Trigger>) -> Result<()> {
         let mut buffer: Vec<Trigger> = Vec::with_capacity(100);
 
         loop {
             buffer.clear();
             debug!("Ready to receive triggers");
 
-            // Since UnboundedReceiver doesn't have recv_many, we need to use a different approach
-            // Try to receive a single event with timeout to avoid blocking forever
-            match tokio::time::timeout(std::time::Duration::from_secs(5), rx.recv()).await {
-                Ok(Some(event)) => {
-                    buffer.push(event);
-
-                    // Try to receive more events non-blocking (up to 99 more)
-                    while let Ok(Some(event)) =
-                        tokio::time::timeout(std::time::Duration::from_millis(10), rx.recv()).await
-                    {
-                        buffer.push(event);
-                        if buffer.len() >= 100 {
-                            break;
-                        }
-                    }
-
+            // Take whatever is waiting, up to 100 events, with a timeout to
+            // avoid blocking forever
+            match tokio::time::timeout(
+                std::time::Duration::from_secs(5),
+                rx.recv_many(&mut buffer, 100),
+            )
+            .await
+            {
+                Ok(0) => {
+                    error!("Event channel closed, exiting process loop");
+                    return Ok(());
+                }
+                Ok(_) => {
                     // Process all events
                     let triggers = std::mem::take(&mut buffer);
 
@@ -212,10 +207,6 @@ impl ProcessWatcher {
                         error!("Failed to process triggers: {}", e);
                     }
                 }
-                Ok(None) => {
-                    error!("Event channel closed, exiting process loop");
-                    return Ok(());
-                }
                 Err(_) => {
                     // Timeout occurred, just continue the loop
                     continue;
@@ -269,6 +260,49 @@ impl ProcessWatcher {
                     );
                     file_opening_triggers.push(file_opened);
                 }
+                Trigger::IoSummary(io_summary) => {
+                    debug!(
+                        "I/O summary from pid={}, read={}B, written={}B",
+                        io_summary.pid, io_summary.read_bytes, io_summary.write_bytes
+                    );
+                }
+                Trigger::MemoryPressure(memory_pressure) => {
+                    debug!(
+                        "Memory pressure on pid={}: {} reclaims ({}ns), {} stalls ({}ns)",
+                        memory_pressure.pid,
+                        memory_pressure.reclaim_count,
+                        memory_pressure.reclaim_ns,
+                        memory_pressure.memstall_count,
+                        memory_pressure.memstall_ns
+                    );
+                }
+                Trigger::SchedStats(sched_stats) => {
+                    debug!(
+                        "Scheduling of pid={}: {}ns on CPU, {}ns on the run queue, {} preemptions",
+                        sched_stats.pid,
+                        sched_stats.oncpu_ns,
+                        sched_stats.runq_ns,
+                        sched_stats.preemptions
+                    );
+                }
+                Trigger::CpuProfile(cpu_profile) => {
+                    debug!(
+                        "CPU profile of pid={}: {} samples in {} stacks",
+                        cpu_profile.pid,
+                        cpu_profile.samples(),
+                        cpu_profile.stacks.len()
+                    );
+                }
+                Trigger::BlockIoStats(block_io) => {
+                    debug!(
+                        "Block I/O of pid={}: {} bytes read in {} requests, {} bytes written in {}",
+                        block_io.pid,
+                        block_io.read_bytes,
+                        block_io.reads,
+                        block_io.write_bytes,
+                        block_io.writes
+                    );
+                }
             }
         }
 
@@ -133,6 +133,8 @@ mod tests {
             size_bytes: 5,
             filename: "test".to_string(),
             file_full_path: "/tmp/test".to_string(),
+            device: 0,
+            inode: 0,
         }));
 
         // Call the log method